@@ -0,0 +1,41 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __ANIMATE_H_
+#define __ANIMATE_H_
+
+#include "options.h"
+
+/* Zoom animations (--batch with --animate). The --batch viewport is
+   frame 0, the keyframe file adds lines "<frame> <ll_real> <ll_imag>
+   <ur_real> <ur_imag>" with increasing frame numbers (# starts a
+   comment); the frames in between move the center linearly and scale
+   the size geometrically. Rank 0 hands out the tiles one frame after
+   the other to the workers that ask, with no barrier between frames:
+   once the tiles of frame n are all out, the next requests get those
+   of frame n + 1 while the last ones of frame n are computed. A tile
+   whose pixels all fall on frame n - 1 (a hold, a pan by whole pixels
+   or an integer zoom out, see reuse_map) is copied from it instead.
+   Frames are written in order, as raw row-major ints, to
+   <batch_output>_<frame>.raw. */
+#define ANIMATE_WINDOW 4   // frames rank 0 holds: the last written and those being computed
+#define ANIMATE_PREFETCH 2 // tiles a worker is sent ahead of its responses
+
+/* collective, on every rank. Returns 0 once every frame is written. */
+int main_animate(const options_t *options);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __BATCH_H_
+#define __BATCH_H_
+
+#include "options.h"
+
+/* Static-partition baseline, without client nor coordinator round
+   trips. Rank 0 broadcasts the viewport once, the tiles are dealt
+   block-cyclically to the workers (options->batch_block consecutive
+   tiles per worker and round) and rank 0 gathers the whole frame with
+   a single MPI_Gatherv. With options->batch_output the workers write
+   their tiles into a raw image with collective MPI-IO instead, one
+   round at a time, and a progress map next to it lets a rerun skip the
+   written tiles. Timings and the compute imbalance go to
+   coordinator_log.txt, the totals of each worker to its worker log. */
+
+/* collective, on every rank. Returns 0 once the frame is gathered
+   or written. */
+int main_batch(const options_t *options);
+
+/* the totals of a worker go to its worker log */
+void batch_log_worker(int rank, double compute_time,
+                      long long total_pixels, long long total_iterations);
+
+#endif
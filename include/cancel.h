@@ -0,0 +1,39 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __CANCEL_H_
+#define __CANCEL_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Cancellation of obsolete tiles. Rank 0 writes the latest generation
+   into an MPI window on every worker as soon as the client sends it, and
+   the fractal kernel of the workers reads it back between rows, so a
+   tile of an older generation is abandoned without waiting for its end. */
+
+/* collective, on every rank */
+void cancel_init (void);
+void cancel_finalize (void);
+
+/* rank 0: generation is the only one workers should compute now */
+void cancel_publish (int generation);
+
+/* workers: true if payload belongs to an obsolete generation */
+bool cancel_is_stale (const payload_t *payload);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __CLIENTS_H_
+#define __CLIENTS_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Several clients served at once (--clients). Rank 0 multiplexes their
+   connections with epoll in a single thread, reading payloads and
+   writing responses without blocking, so a slow client does not hold
+   the others back. Every payload gets a generation unique among all
+   clients before it is discretized, and its responses get the
+   generation of the client back on the way out. A client's payload
+   makes only its own older generations obsolete, the tiles of all
+   current generations are queued one client after the other. */
+#define CLIENTS_EVENTS 16 // epoll events handled per wait
+
+void clients_init (int max_clients);
+void clients_finalize (void);
+
+/* rank 0: accept clients on socket and move their payloads and
+   responses until the last connected client asks for a shutdown.
+   submit takes the renumbered payloads, sent is told about every
+   response written along with the bytes of its values. */
+void clients_serve (int socket,
+                    void (*submit)(payload_t *payload),
+                    void (*sent)(const response_t *response, size_t bytes));
+
+/* false once the client of payload sent a newer one, or left */
+bool clients_current (const payload_t *payload);
+
+/* reorder count tiles so that each client has one in turn, keeping the
+   order of the tiles of every client */
+void clients_interleave (payload_t **tiles, int count);
+
+/* hand response to its client, or free it if its generation is obsolete */
+void clients_deliver (response_t *response);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __CODEC_H_
+#define __CODEC_H_
+
+#include "fractal.h"
+
+/* Compact encoding of the iteration counts of a tile. The first byte
+   tells the kind of encoding, the second one the width (1, 2 or 4
+   bytes) used for every value, the smallest one that holds the largest
+   count of the tile:
+   - CODEC_SOLID: the whole tile has a single value, stored once;
+   - CODEC_PACKED: every value, row after row;
+   - CODEC_RLE: every row as runs, a LEB128 run length then its value.
+   The encoder picks the smallest of the three. */
+#define CODEC_SOLID 1
+#define CODEC_PACKED 2
+#define CODEC_RLE 3
+
+/* encode width x height values into a new buffer, returns its size in bytes */
+int codec_encode (const int *values, int width, int height, unsigned char **encoded);
+
+/* decode size bytes into width x height values, returns -1 if malformed */
+int codec_decode (const unsigned char *encoded, int size, int *values, int width, int height);
+
+/* replace the values of response by their encoding */
+void response_encode (response_t *response);
+
+/* replace the encoding of response by its values, returns -1 if malformed */
+int response_decode (response_t *response);
+
+/* bytes of values (or of their encoding) that travel with response */
+int response_values_size (const response_t *response);
+
+#endif
@@ -20,10 +20,7 @@ along with "Fractal @ PCAD". If not, see
 
 #include <math.h>
 #include <raylib.h>
-
-// Definition for a normalizing function. Currently, these normalize values into a [0, 1] range.
-// The color values will then be fed into coloring functions.
-typedef double (*normalize_fn)(int depth, int max_depth);
+#include "normalize.h"
 
 // Definition for a coloring function. Currently, these take normalized values and map them to a color.
 typedef Color (*color_fn)(double t);
@@ -83,4 +80,10 @@ static const Color viridis_palette[VIRIDIS_SIZE] = {
 
 Color get_current_pallette_color(int current_color, int depth, int max_depth);
 
+/* NORMALIZE_* function used by a palette, to ask for indexed responses */
+int get_pallette_normalizer(int current_color);
+
+/* colors of the 256 palette indexes (see normalize.h) for a palette */
+void get_pallette_lut(int current_color, Color lut[256]);
+
 #endif
@@ -21,6 +21,9 @@ along with "Fractal @ PCAD". If not, see
 #include <stdint.h>
 #include <sys/types.h>
 
+/* pending connections the server socket keeps, see clients.h */
+#define CONNECTION_BACKLOG 16
+
 int open_connection(char host[], uint16_t port);
 int open_server_socket(uint16_t port);
 
@@ -0,0 +1,58 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __DEADLINE_H_
+#define __DEADLINE_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Deadline-driven rendering, for payloads with a latency budget. Rank 0
+   estimates the cost of the generation at every level of a quality
+   ladder (granularity_cost), from the full quality down to one pixel
+   per 8x8 block at a sixteenth of the depth. It queues the best level
+   that fits the budget on the workers first, then every better level
+   up to the full quality, which refines the image in the background.
+   Responses carry the stride and depth they were computed with, and a
+   response rougher than what the client already got for its tile is
+   dropped. How long first passes really took corrects the estimates of
+   the next generations. */
+#define DEADLINE_LEVELS 6
+#define DEADLINE_MARGIN 0.8 // of the budget the first pass is planned to take
+#define DEADLINE_WEIGHT 0.5 // of the newest first pass in the correction
+#define DEADLINE_MIN_CALIBRATION 0.1
+#define DEADLINE_MAX_CALIBRATION 100.0
+#define DEADLINE_NONE -1    // no level was complete when the budget expired
+#define DEADLINE_PENDING -2 // the budget has not expired yet
+
+void deadline_finalize (void);
+
+/* rank 0: plan the generation of origin on workers workers. levels
+   receives the levels of the passes in the order they are queued, the
+   last one is 0, the full quality. Returns the number of passes. */
+int deadline_plan (const payload_t *origin, int workers, int levels[DEADLINE_LEVELS]);
+
+/* origin at level, the payload of one pass */
+void deadline_pass (const payload_t *origin, int level, payload_t *pass);
+
+/* rank 0: account for a response of a planned generation. False if the
+   client already got its tile at a better level. Once the budget has
+   expired, reached is the best level complete by then (or
+   DEADLINE_NONE), reported for one response only; else DEADLINE_PENDING. */
+bool deadline_received (const response_t *response, int *reached);
+
+#endif
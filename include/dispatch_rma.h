@@ -0,0 +1,48 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __DISPATCH_RMA_H_
+#define __DISPATCH_RMA_H_
+
+#include "fractal.h"
+
+/* Coordinator-free tile dispatch. Rank 0 exposes the payload of the
+   current generation and a tile counter in an MPI window. Workers claim
+   tile indices with MPI_Fetch_and_op and discretize the claimed tile
+   themselves, so rank 0 only collects responses. */
+
+/* collective, on every rank */
+void rma_dispatch_init (void);
+void rma_dispatch_finalize (void);
+
+/* rank 0: make origin the generation whose tiles workers claim */
+void rma_dispatch_publish (const payload_t *origin);
+
+/* rank 0: wake up idle workers, generation may be PAYLOAD_GENERATION_SHUTDOWN */
+void rma_dispatch_notify (int generation);
+
+/* workers: block until rank 0 notifies, returns the latest notified generation */
+int rma_dispatch_wait_notice (void);
+
+/* workers: claim the next tile of the published generation into tile.
+   generation caches the published payload between calls and must start
+   with generation->generation == -1. The payload is fetched again at
+   every publish, even of a generation number seen before. Returns 0
+   once no tile is left. */
+int rma_dispatch_claim (payload_t *generation, payload_t *tile);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __DISPATCH_STEAL_H_
+#define __DISPATCH_STEAL_H_
+
+#include "fractal.h"
+
+/* Decentralized dispatch by work stealing. Every worker exposes the
+   range of tile indices it still has to compute in an MPI window. At
+   every generation rank 0 writes a static block of tiles in each
+   window and sends the generation payload to each worker. Workers take
+   tiles from the front of their own range and, once it is empty, steal
+   the back half of the range of a random victim, so rank 0 is out of
+   the way until the next generation. */
+
+typedef struct {
+  int attempts; // victims inspected
+  int steals;   // inspections that got tiles
+  int tiles;    // tiles obtained by stealing
+} steal_stats_t;
+
+/* collective, on every rank */
+void steal_dispatch_init (void);
+void steal_dispatch_finalize (void);
+
+/* rank 0: hand out the tiles of origin, which may be a shutdown payload */
+void steal_dispatch_publish (const payload_t *origin);
+
+/* workers: block until rank 0 publishes, keep the latest generation in
+   generation and return its number */
+int steal_dispatch_wait (payload_t *generation);
+
+/* workers: next tile of the current generation into tile, from our own
+   range or stolen. Ranges are tied to the publishes of rank 0, so a
+   generation number sent again is still a new range. Returns 0 once no tile is left anywhere, or when the
+   generation was replaced by a shutdown. */
+int steal_dispatch_claim (payload_t *generation, payload_t *tile);
+
+/* workers: statistics since the last call */
+steal_stats_t steal_dispatch_take_stats (void);
+
+#endif
@@ -39,6 +39,11 @@ typedef struct {
   int generation; // generation of the user interaction
   int granularity; // size of the squared blocks
   int fractal_depth; // the depth of the fractal
+  int palette; // NORMALIZE_NONE for iteration counts, else the normalizer of 8-bit palette indexes
+  int schedule; // PAYLOAD_SCHEDULE_DEFAULT, or the scheduling policy the client asks for (options.h)
+  int budget_ms; // latency budget of the generation, 0 for none (deadline.h)
+  int stride; // 0 or 1 computes every pixel, s one pixel per s x s block
+  int hint; // 1 for a viewport the client may select next, computed while idle (--hints)
   
   fractal_coord_t ll; // lower-left corner
   fractal_coord_t ur; // upper-right corner
@@ -50,28 +55,68 @@ typedef struct {
 // Special poison pill payloads
 #define PAYLOAD_GENERATION_DONE -1 // Signals to workers that the current round is done
 #define PAYLOAD_GENERATION_SHUTDOWN -2 // Signals that the coordinator is shutting down
+#define PAYLOAD_GENERATION_EVICT -3 // Tells a worker to drop a tile from its cache (tiledir.h)
+#define PAYLOAD_GENERATION_FLUSH -4 // Tells a worker to drop its whole cache (tiledir.h)
 
 /* the response obtained from the coordinator */
 typedef struct {
   payload_t payload; // the origin of this response
   int worker_id; // between [0, n-1]
   int max_worker_id; // maximum is n-1, n is the number of workers
+  int encoded_size; // bytes of encoded, 0 when values travel as plain ints
+  long long iterations; // spent by the worker on this tile
+  double compute_time; // seconds the worker spent on this tile
   int *values; // there are granularity * granularity elements
+  unsigned char *encoded; // compact encoding of values, see codec.h
 } response_t;
 
+/* granularity of a payload that lets the coordinator choose it, see
+   granularity.h. The responses tell the client the one it chose. */
+#define PAYLOAD_GRANULARITY_AUTO 0
+
+/* schedule of a payload that keeps the policy of the coordinator */
+#define PAYLOAD_SCHEDULE_DEFAULT 0
+
+/* encoded_size of a response whose values are in the shared
+   framebuffer (see framebuffer.h), they travel with no message. The
+   tile store lends its values the same way (tilestore.h). */
+#define RESPONSE_IN_FRAMEBUFFER -1
+
 typedef struct {
   response_t *response; 
   long long total_iterations;
+  bool cancelled; // response is NULL, the payload became obsolete
 } create_response_return_t;
 
+/* tells whether the computation of payload should be abandoned */
+typedef bool (*fractal_cancel_t) (const payload_t *payload);
+
+/* iterations computed between two calls to a fractal_cancel_t */
+#define FRACTAL_CANCEL_CHECK_ITERATIONS (1 << 22)
+
 void free_response(void* ptr); // custom free function for use in queue
 
 /* discretized a payload in several pieces, block-wise */
 payload_t **discretize_payload (payload_t *origin, int *length);
 
+/* number of blocks discretize_payload creates for origin */
+int discretize_length (const payload_t *origin);
+
+/* fill tile with the index-th block of origin, without creating the others */
+void discretize_tile (const payload_t *origin, int index, payload_t *tile);
+
 /* encapsulate a response for a given payload */
 create_response_return_t create_response_for_payload (payload_t *payload);
 
+/* same, but gives up as soon as cancelled says so, checked between rows */
+create_response_return_t create_response_for_payload_cancellable (payload_t *payload,
+								   fractal_cancel_t cancelled);
+
+/* same, computing into values, which the response does not own */
+create_response_return_t create_response_in_place (payload_t *payload,
+						    fractal_cancel_t cancelled,
+						    int *values);
+
 /* print a payload */
 void payload_print (const char *func, const char *message, const payload_t *p);
 
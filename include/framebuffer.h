@@ -0,0 +1,71 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __FRAMEBUFFER_H_
+#define __FRAMEBUFFER_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Generation framebuffer shared by rank 0 and the workers of its node,
+   allocated with MPI_Win_allocate_shared. Those workers compute tiles
+   straight into it and only send the response header, rank 0 streams
+   the values to the client from there. Tiles are stored one after the
+   other in discretization order. Consecutive generations alternate
+   between FRAMEBUFFER_BUFFERS buffers so that a new generation does not
+   overwrite the tiles of the previous one while they are still sent.
+   A buffer is held while a worker writes a tile into it and while rank
+   0 sends a tile from it. Publishing closes the buffer to its old
+   generation first, and a buffer still held after
+   FRAMEBUFFER_LENT_WAIT_MS does not take the new generation, whose
+   tiles then travel as messages. */
+#define FRAMEBUFFER_BUFFERS 2
+#define FRAMEBUFFER_LENT_WAIT_MS 100
+
+/* collective, on every rank. Each buffer holds megapixels million values. */
+void framebuffer_init (int megapixels);
+void framebuffer_finalize (void);
+
+/* true if this rank shares the framebuffer of rank 0 */
+bool framebuffer_attached (void);
+
+/* rank 0: origin is the generation whose tiles go to its buffer */
+void framebuffer_publish (const payload_t *origin);
+
+/* where the values of tile go, NULL if tile has no place in the
+   framebuffer (not attached, other generation, rougher pass of a
+   budget, buffer too small) */
+int *framebuffer_tile (const payload_t *tile);
+
+/* workers: framebuffer_tile, holding its buffer until framebuffer_written */
+int *framebuffer_write (const payload_t *tile);
+
+/* workers: the values of tile that framebuffer_write gave are written
+   (or given up), visible to rank 0 and the buffer is no longer held */
+void framebuffer_written (const payload_t *tile);
+
+/* rank 0: framebuffer_tile, for a response that goes on to a client.
+   Its buffer is not reused until framebuffer_free_response frees it. */
+int *framebuffer_lend (const payload_t *tile);
+
+/* rank 0: free_response, that also gives back values framebuffer_lend lent */
+void framebuffer_free_response (void *response);
+
+/* make the values written by this rank visible to the others, and theirs to us */
+void framebuffer_sync (void);
+
+#endif
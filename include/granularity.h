@@ -0,0 +1,57 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __GRANULARITY_H_
+#define __GRANULARITY_H_
+
+#include "fractal.h"
+
+/* Automatic granularity, for payloads that ask for
+   PAYLOAD_GRANULARITY_AUTO (every payload with --auto-granularity).
+   Rank 0 models a generation of N tiles on P workers as
+
+     T(N) = C/P + N o + k C/N
+
+   with C the compute seconds of the viewport, o the seconds rank 0
+   spends per tile, and k C/N the tail of the last tile, k being how
+   much the costliest part of the viewport exceeds the mean. A probe of
+   GRANULARITY_PROBE_CELLS^2 cells (schedule_probe) estimates C and k,
+   and the N that minimizes T is sqrt(k C / o). Once every tile of the
+   generation is back, o is solved from the elapsed time and the compute
+   time of the responses, so the next choice follows what was measured. */
+#define GRANULARITY_PROBE_CELLS 8          // per side of the viewport
+#define GRANULARITY_TILES_PER_WORKER 4     // at least, for the dynamic dispatch to balance
+#define GRANULARITY_MIN 8
+#define GRANULARITY_MAX 500                // the largest the client offers
+#define GRANULARITY_DEFAULT_OVERHEAD 50e-6 // seconds per tile, until measured
+#define GRANULARITY_WEIGHT 0.5             // of the newest measure of the overhead
+
+/* compute seconds of origin on one core according to the probe, and
+   the skew of its cells (costliest over mean) */
+double granularity_cost (const payload_t *origin, double *skew);
+
+/* rank 0: granularity for the generation of origin, on workers workers */
+int granularity_choose (const payload_t *origin, int workers);
+
+/* rank 0: account for a response, the last one of a generation whose
+   granularity was chosen updates the overhead */
+void granularity_received (const response_t *response);
+
+/* seconds per tile the model uses now */
+double granularity_overhead (void);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __HIERARCHY_H_
+#define __HIERARCHY_H_
+
+#include <mpi.h>
+#include <stdbool.h>
+
+/* Two-level dispatch. Workers are grouped per node (ranks sharing
+   memory), the lowest rank of every group is its leader. Rank 0 only
+   talks to leaders, handing them chunks of tiles and receiving
+   batches of responses; leaders serve the workers of their group. */
+
+/* collective, on every rank. group_size > 0 groups workers by that
+   many consecutive ranks instead of by node. */
+void hierarchy_init (int group_size);
+void hierarchy_finalize (void);
+
+/* workers: the communicator of our group, the leader is its rank 0 */
+MPI_Comm hierarchy_group_comm (void);
+bool hierarchy_is_leader (void);
+
+/* world ranks of all leaders, known on every rank */
+const int *hierarchy_leaders (int *count);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __LOCAL_H_
+#define __LOCAL_H_
+
+#include <stdbool.h>
+
+/* Tiles computed by rank 0 itself (queue dispatch). A low-priority
+   thread of the coordinator takes queued tiles while the dispatch keeps
+   up with the workers. The send thread reports how long a waiting
+   worker takes to get its tile: once that latency is known without
+   rank 0 computing, a tile that raises it well above stops the thread
+   for a while, twice as long each time it happens again in a row. */
+#define LOCAL_WEIGHT 0.3         // weight of the newest sample in the averages
+#define LOCAL_LATENCY_FACTOR 2.0 // back off above this times the idle latency
+#define LOCAL_MIN_BACKOFF 0.001  // seconds, first pause after a slow dispatch
+#define LOCAL_MAX_BACKOFF 0.064  // seconds, the pause doubles up to this
+
+/* the calling thread gets the lowest scheduling priority */
+void local_lower_priority (void);
+
+/* whether rank 0 is computing a tile, samples are told apart by it */
+void local_computing (bool busy);
+
+/* seconds the send thread took to hand a tile to a waiting worker */
+void local_dispatch_sample (double seconds);
+
+/* false until the idle latency is known, and while backing off */
+bool local_may_compute (void);
+
+/* after a tile, true if it slowed down the dispatch and rank 0 backs off */
+bool local_tile_done (void);
+
+#endif
@@ -23,11 +23,54 @@ along with "Fractal @ PCAD". If not, see
 #define FRACTAL_MPI_PAYLOAD_REQUEST 0
 #define FRACTAL_MPI_PAYLOAD_DATA 1
 
-#define FRACTAL_MPI_RESPONSE_REQUEST 2
 #define FRACTAL_MPI_RESPONSE_DATA 3
 
-payload_t *mpi_payload_receive (int target);
-void mpi_payload_send (payload_t *payload, int worker);
-response_t *mpi_response_receive (int worker);
-void mpi_response_send (response_t *response);
+#define FRACTAL_MPI_GENERATION_NOTICE 4
+#define FRACTAL_MPI_RESPONSE_BATCH 5
+#define FRACTAL_MPI_CACHE_FETCH 6
+
+/* create (and release) the derived datatypes used below, on every rank */
+void mpi_comm_init (void);
+void mpi_comm_finalize (void);
+
+/* the datatype describing one payload_t, for one-sided transfers */
+MPI_Datatype mpi_payload_datatype (void);
+
+payload_t *mpi_payload_receive (int source, MPI_Comm comm);
+void mpi_payload_send (payload_t *payload, int target, MPI_Comm comm);
+/* post a receive of the next payload from source into a caller buffer */
+void mpi_payload_irecv (payload_t *payload, int source, MPI_Comm comm, MPI_Request *request);
+
+/* a whole generation payload, sent aside from the tiles */
+void mpi_generation_send (const payload_t *payload, int target, MPI_Comm comm);
+void mpi_generation_receive (payload_t *payload, int source, MPI_Comm comm);
+
+/* several payloads in one message, the receiver gets up to max of them
+   and learns how many arrived with mpi_payload_count */
+void mpi_payload_chunk_send (payload_t *payloads, int count, int target, MPI_Comm comm);
+void mpi_payload_chunk_irecv (payload_t *payloads, int max, int source, MPI_Comm comm,
+			      MPI_Request *request);
+int mpi_payload_count (MPI_Status *status);
+
+/* tiles a worker holds in its cache, sent without waiting for its
+   request (see tiledir.h) */
+void mpi_cache_fetch_send (payload_t *payloads, int count, int target, MPI_Comm comm);
+void mpi_cache_fetch_irecv (payload_t *payloads, int max, int source, MPI_Comm comm,
+			    MPI_Request *request);
+
+/* source may be MPI_ANY_SOURCE, values come from whoever sent the header */
+response_t *mpi_response_receive (int source, MPI_Comm comm);
+/* split receive: post the header, then get the values from its sender */
+void mpi_response_header_irecv (response_t *header, int source, MPI_Comm comm,
+				MPI_Request *request);
+void mpi_response_values_receive (response_t *response, int source, MPI_Comm comm);
+
+void mpi_response_send (response_t *response, int target, MPI_Comm comm);
+/* nonblocking send, response must stay untouched until both requests complete */
+void mpi_response_isend (response_t *response, int target, MPI_Comm comm,
+			 MPI_Request requests[2]);
+
+/* several responses as one header message plus one values message */
+void mpi_response_batch_send (response_t **responses, int count, int target, MPI_Comm comm);
+response_t **mpi_response_batch_receive (int source, MPI_Comm comm, int *count);
 #endif
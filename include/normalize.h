@@ -0,0 +1,51 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __NORMALIZE_H_
+#define __NORMALIZE_H_
+
+#include "fractal.h"
+
+// Definition for a normalizing function. Currently, these normalize values into a [0, 1] range.
+// The color values will then be fed into coloring functions.
+typedef double (*normalize_fn)(int depth, int max_depth);
+
+double norm_linear(int depth, int max_depth);
+double norm_power_cycle(int depth, int max_depth);
+double norm_log_cycle(int depth, int max_depth);
+
+/* normalizers as they travel in payload_t.palette */
+#define NORMALIZE_NONE 0 // no palette, responses carry iteration counts
+#define NORMALIZE_LINEAR 1
+#define NORMALIZE_POWER_CYCLE 2
+#define NORMALIZE_LOG_CYCLE 3
+
+/* palette index of the points that did not escape, drawn black */
+#define PALETTE_INSIDE 255
+
+/* the function of a NORMALIZE_* value, norm_linear if unknown */
+normalize_fn normalize_get(int normalizer);
+
+/* 8-bit palette index of depth: [0, PALETTE_INSIDE) covers the
+   normalized range, PALETTE_INSIDE is for depth >= max_depth */
+unsigned char normalize_palette_index(int depth, int max_depth, int normalizer);
+
+/* replace the iteration counts of response by palette indexes, with
+   the normalizer its payload asks for */
+void response_to_palette(response_t *response);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __OPTIONS_H_
+#define __OPTIONS_H_
+
+#include <stdint.h>
+#include "fractal.h"
+
+/* how tiles reach the workers */
+typedef enum {
+  DISPATCH_QUEUE, // workers ask rank 0 for every tile (self-scheduling)
+  DISPATCH_RMA,   // workers claim tile indices from a counter in an RMA window
+  DISPATCH_HIERARCHICAL, // rank 0 feeds one leader per node, leaders feed their workers
+  DISPATCH_STEAL, // static blocks per worker, idle workers steal from each other
+} dispatch_mode_t;
+
+/* how iteration counts travel from workers to the client */
+typedef enum {
+  ENCODING_RAW,     // one int per pixel
+  ENCODING_COMPACT, // per-tile width, run-length rows or a single value, see codec.h
+} encoding_mode_t;
+
+/* order in which the queue dispatch hands out tiles, and how many at once */
+typedef enum {
+  SCHEDULE_DEFAULT = PAYLOAD_SCHEDULE_DEFAULT, // payloads only: the policy of the coordinator
+  SCHEDULE_FIFO,          // discretization order, one tile per request
+  SCHEDULE_GUIDED,        // chunks of remaining / workers tiles
+  SCHEDULE_FACTORING,     // rounds of one chunk per worker, half of the remaining tiles per round
+  SCHEDULE_LARGEST_FIRST, // most expensive tiles first according to a probe, one at a time
+  SCHEDULE_LOCALITY,      // Z-order curve, factoring chunks of neighbouring tiles
+} schedule_policy_t;
+
+/* where the ranks run, see placement.h */
+typedef enum {
+  PIN_NONE,   // wherever mpirun and the kernel put them
+  PIN_CORE,   // one core per worker, rank 0 on a core of its own
+  PIN_SOCKET, // workers spread over the sockets, rank 0 on a core of its own
+} pin_mode_t;
+
+#define OPTIONS_MAX_PATH 256
+
+/* launch options of the coordinator binary, parsed identically by every rank */
+typedef struct {
+  uint16_t port; // TCP port the coordinator listens on
+  int prefetch;  // tiles a worker keeps requested besides the one it computes
+  dispatch_mode_t dispatch;
+  int group_size; // hierarchical: workers per leader, 0 groups them by node
+  encoding_mode_t encoding;
+  int framebuffer; // million values per shared framebuffer buffer, 0 disables it
+  int batch;       // render batch_viewport once with a static partition, no client
+  payload_t batch_viewport;
+  int batch_block; // consecutive tiles per rank in each round of the static partition
+  char batch_output[OPTIONS_MAX_PATH]; // batch: raw image the workers write, empty gathers on rank 0
+  char animate[OPTIONS_MAX_PATH]; // batch: keyframes of an animation, frames go to batch_output (animate.h)
+  int speculate;   // queue: duplicate straggler tiles on idle workers
+  int split;       // queue: cut the last tiles of a generation for idle workers
+  int throughput;  // queue: cut the last tiles more for slower workers
+  schedule_policy_t schedule; // unless the payload asks for another one
+  int local_compute; // queue: rank 0 computes tiles while the dispatch keeps up
+  pin_mode_t pin;
+  int auto_granularity; // every payload as if it asked for PAYLOAD_GRANULARITY_AUTO
+  int clients; // connections served at once, see clients.h
+  int tile_cache; // megabytes of responses rank 0 keeps, 0 disables it (tilecache.h)
+  int worker_cache; // queue: megabytes of tiles every worker keeps, 0 disables it (tiledir.h)
+  int reuse; // copy the pixels of the previous frame after a pan or a zoom out (reuse.h)
+  char tile_store[OPTIONS_MAX_PATH]; // files of the persistent tile store, empty disables it (tilestore.h)
+  int tile_store_size; // megabytes reserved for its values
+  int hints; // queue: compute the hint payloads of the client into the tile cache while idle
+} options_t;
+
+#define OPTIONS_DEFAULT_PREFETCH 1
+#define OPTIONS_MAX_PREFETCH 64
+#define OPTIONS_MAX_FRAMEBUFFER 1024
+#define OPTIONS_DEFAULT_BATCH_BLOCK 1
+#define OPTIONS_MAX_CLIENTS 64
+#define OPTIONS_MAX_TILE_CACHE (1 << 20)
+#define OPTIONS_DEFAULT_TILE_STORE_SIZE 1024
+
+/* parse argv into options. Returns 0 on success, -1 on malformed input. */
+int options_parse(int argc, char *argv[], options_t *options);
+
+/* print the accepted command line */
+void options_usage(const char *program);
+
+/* name of a dispatch mode, as accepted on the command line */
+const char *options_dispatch_name(dispatch_mode_t dispatch);
+
+/* name of a scheduling policy, as accepted on the command line */
+const char *options_schedule_name(schedule_policy_t schedule);
+
+/* name of a placement, as accepted on the command line */
+const char *options_pin_name(pin_mode_t pin);
+
+/* name of an encoding, as accepted on the command line */
+const char *options_encoding_name(encoding_mode_t encoding);
+
+#endif
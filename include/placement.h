@@ -0,0 +1,35 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __PLACEMENT_H_
+#define __PLACEMENT_H_
+
+#include "options.h"
+
+/* Placement of the ranks on the cores of their node. The CPUs usable by
+   the ranks of a node are ordered socket by socket, core by core, from
+   the sysfs topology. Rank 0 keeps the last core of its node for its
+   threads (they inherit its affinity), the workers get the other cores,
+   one each with PIN_CORE, or spread over the sockets with PIN_SOCKET.
+   Ranks are pinned before they allocate their buffers, so the first
+   touch places those on the NUMA node they run on. */
+
+/* collective, on every rank, before any buffer is allocated. Rank 0
+   prints the mapping of every rank. */
+void placement_init (pin_mode_t mode);
+
+#endif
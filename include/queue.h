@@ -45,6 +45,16 @@ void* queue_dequeue(queue_t *q);
 /* Non-blocking dequeue. Returns NULL if queue is empty. */
 void* queue_try_dequeue(queue_t *q);
 
+/* Non-blocking dequeue that leaves at least keep items queued. Returns NULL
+   if there are not more than keep items, or if the next one is a NULL
+   poison pill, which stays queued for the blocking consumers. */
+void* queue_try_dequeue_keep(queue_t *q, size_t keep);
+
+/* Blocking dequeue of up to max items. Waits for the first one, then takes
+   what is already queued. A NULL poison pill is only returned alone, as
+   the first item, so it is never lost among other items. Returns the count. */
+size_t queue_dequeue_many(queue_t *q, void **items, size_t max);
+
 size_t queue_size(queue_t *q);
 void queue_clear(queue_t *q);
 void queue_destroy(queue_t *q);
@@ -0,0 +1,78 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __REUSE_H_
+#define __REUSE_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Reuse of the previous frame (--reuse, queue or hierarchical
+   dispatch). Rank 0 keeps the pixels of the last frame it sent
+   entirely at full quality. When a new generation, with the same depth
+   and palette, only shifts that frame by whole pixels or zooms out of
+   it by an integer ratio, the pixels of the new screen that fall on a
+   pixel of the frame are copied from it. A tile covered entirely is
+   answered by rank 0 right away; a tile covered in part only sends
+   square pieces over its uncovered strips to the workers, and rank 0
+   puts them together with the copied pixels, so clients never see a
+   piece. Zooming in is not reused: only one pixel in ratio^2 of the new
+   screen falls on the previous one. */
+#define REUSE_TOLERANCE 1e-3 // pixels, shift and ratio errors over the screen
+#define REUSE_MIN_PIECE 16   // pieces over a thinner strip cover some known pixels
+#define REUSE_MAX_PIECES 32  // beyond that, the tile is computed whole
+
+typedef struct {
+  int answered; // tiles copied entirely from the previous frame
+  int partial;  // tiles of which only pieces were computed
+  int pieces;
+  long long pixels; // copied from the previous frame
+} reuse_stats_t;
+
+void reuse_init (void);
+void reuse_finalize (void);
+
+/* origin is the new generation: find how the last complete frame maps
+   onto it and start keeping its own pixels */
+void reuse_begin (const payload_t *origin);
+
+/* the response of tile if the previous frame covers it entirely,
+   otherwise NULL and the pieces to compute (up to REUSE_MAX_PIECES) in
+   pieces, *count is 0 if the whole tile has to be computed */
+response_t *reuse_tile (const payload_t *tile, payload_t *pieces, int *count);
+
+/* true if response is the response of a piece */
+bool reuse_is_piece (const response_t *response);
+
+/* take ownership of the response of a piece. Returns the response of
+   its tile once all of its pieces are in, NULL otherwise. */
+response_t *reuse_collect (response_t *piece);
+
+/* keep the pixels of response if it belongs to the current frame */
+void reuse_record (const response_t *response);
+
+/* whether the pixels of to fall on those of from, the pixel (x, y) of
+   to then being the pixel (shift_x + ratio * x, shift_y + ratio * y)
+   of from, when on its screen. Keeps no state, the animations of
+   --batch use it too (animate.h). */
+bool reuse_map (const payload_t *from, const payload_t *to,
+                int *ratio, int *shift_x, int *shift_y);
+
+/* the counts since reuse_begin */
+reuse_stats_t reuse_stats (void);
+
+#endif
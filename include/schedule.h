@@ -0,0 +1,54 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __SCHEDULE_H_
+#define __SCHEDULE_H_
+
+#include "fractal.h"
+#include "options.h"
+
+/* Scheduling policies of the queue dispatch. A policy orders the tiles
+   of a generation before they are queued, and tells how many queued
+   tiles the next worker request gets in one message. Every policy goes
+   through the same queue, so the logs of a generation are the same
+   whatever the policy. */
+typedef struct {
+  /* reorder the tiles of origin before they are queued, NULL keeps them */
+  void (*order) (const payload_t *origin, payload_t **tiles, int length);
+  /* tiles the next request gets, remaining tiles are queued for workers */
+  int (*chunk) (int remaining, int workers);
+} schedule_t;
+
+/* most tiles in one message, workers receive up to this many at once */
+#define SCHEDULE_MAX_CHUNK 64
+/* pixels of a tile computed by the cost probe of largest-first */
+#define SCHEDULE_PROBE_POINTS 5
+
+/* the policy of origin: the one it asks for, else fallback */
+schedule_policy_t schedule_policy (const payload_t *origin, schedule_policy_t fallback);
+
+/* rank 0: policy schedules the next generation, whose tiles are reordered */
+void schedule_generation (schedule_policy_t policy, const payload_t *origin,
+                          payload_t **tiles, int length);
+
+/* rank 0: tiles for the next request, at least 1 and at most SCHEDULE_MAX_CHUNK */
+int schedule_chunk (int remaining, int workers);
+
+/* estimated cost of tile, the iterations of a few of its pixels */
+long long schedule_probe (const payload_t *tile);
+
+#endif
@@ -0,0 +1,58 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __SPECULATE_H_
+#define __SPECULATE_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Speculative re-execution of straggler tiles (queue dispatch). Rank 0
+   tracks the tiles of the current generation that were sent but not
+   answered yet, oldest first. Once the queue is empty, idle workers get
+   a copy of the oldest outstanding tile, whichever copy answers first
+   is kept and the other one is dropped. A tile has at most one copy. */
+
+typedef struct {
+  int copies; // speculative copies sent
+  int wins;   // tiles answered first by their copy
+  int dropped; // late answers of tiles already answered
+} speculate_stats_t;
+
+void speculate_init (void);
+void speculate_finalize (void);
+
+/* origin is the generation whose tiles are tracked from now on */
+void speculate_reset (const payload_t *origin);
+
+/* tile was sent to worker */
+void speculate_sent (const payload_t *tile, int worker);
+
+/* number of tiles of generation sent and not answered yet */
+int speculate_outstanding (int generation);
+
+/* copy into tile the oldest outstanding tile of generation that may be
+   duplicated on worker. Returns false if there is none. */
+bool speculate_pick (int generation, int worker, payload_t *tile);
+
+/* account for response, false if its tile was already answered */
+bool speculate_received (const response_t *response);
+
+/* counters of the tracked generation so far */
+speculate_stats_t speculate_stats (void);
+
+#endif
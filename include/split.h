@@ -0,0 +1,50 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __SPLIT_H_
+#define __SPLIT_H_
+
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Dynamic splitting of tiles at the end of a generation (queue
+   dispatch). When fewer tiles than workers are left, rank 0 cuts the
+   next tile in four square pieces of half its granularity, so that a
+   few large tiles do not keep most workers idle. Pieces can be cut
+   again. Their responses are put back together into the response of
+   the original tile, so clients never see a piece. */
+#define SPLIT_PIECES 4
+#define SPLIT_MIN_GRANULARITY 8 // pieces are never smaller than this
+
+void split_init (void);
+void split_finalize (void);
+
+/* origin is the generation whose tiles may be split from now on */
+void split_reset (const payload_t *origin);
+
+/* cut tile into pieces (at most SPLIT_PIECES), returns their number, 0
+   if tile is too small or belongs to another generation */
+int split_tile (const payload_t *tile, payload_t *pieces);
+
+/* true if response is the response of a piece */
+bool split_is_piece (const response_t *response);
+
+/* take ownership of the response of a piece. Returns the response of
+   the original tile once all of its pieces are in, NULL otherwise. */
+response_t *split_collect (response_t *piece);
+
+#endif
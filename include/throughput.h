@@ -0,0 +1,44 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __THROUGHPUT_H_
+#define __THROUGHPUT_H_
+
+#include <stdio.h>
+#include "fractal.h"
+
+/* Throughput estimates of the workers, for heterogeneous or
+   oversubscribed runs. Rank 0 keeps a moving average of the pixels and
+   iterations per second of every worker, from the compute time that
+   comes with each response, and sizes the work it hands out with it. */
+#define THROUGHPUT_WEIGHT 0.3 // weight of the newest tile in the averages
+#define THROUGHPUT_MAX_CUTS 3 // a tile is cut in at most 4^3 pieces for a slow worker, odd pieces are not cut again
+
+void throughput_init (void);
+void throughput_finalize (void);
+
+/* account for the tile of response */
+void throughput_update (const response_t *response);
+
+/* how many times to cut a tile in four for worker, so that it finishes
+   its piece about when the fastest worker would finish a whole tile */
+int throughput_cuts (int worker);
+
+/* write one [WORKER_N_RATE]: pixels/s, iterations/s line per known worker */
+void throughput_log (FILE *log);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __TILECACHE_H_
+#define __TILECACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fractal.h"
+
+/* Tile cache of rank 0 (--tile-cache). Responses are kept with their
+   values as they were sent to the client, keyed by the fractal corners
+   of their tile, its size in pixels, depth, palette and stride, so that
+   a tile the client asks for again (C-z, a view visited before) is
+   answered without the workers, wherever it lies on the screen. The
+   least recently used tiles go once the values exceed the limit. */
+#define TILECACHE_BUCKETS 65536
+
+typedef struct {
+  long long hits;
+  long long misses;
+  long long evictions;
+  size_t bytes; // values and bookkeeping of the tiles held
+  size_t limit;
+  int tiles;
+} tilecache_stats_t;
+
+void tilecache_init (size_t limit);
+void tilecache_finalize (void);
+
+/* a copy of the cached response of tile, with tile as its payload, or
+   NULL. The caller owns it. */
+response_t *tilecache_lookup (const payload_t *tile);
+
+/* keep a copy of response, whose values are complete */
+void tilecache_store (const response_t *response);
+
+/* forget the response of tile, if there is one */
+void tilecache_remove (const payload_t *tile);
+
+/* forget every response */
+void tilecache_clear (void);
+
+tilecache_stats_t tilecache_stats (void);
+
+/* the key of the cache, also used by tiledir.h */
+uint64_t tilecache_key_hash (const payload_t *tile);
+bool tilecache_key_equal (const payload_t *a, const payload_t *b);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __TILEDIR_H_
+#define __TILEDIR_H_
+
+#include <stddef.h>
+#include "fractal.h"
+
+/* Tile cache spread over the workers (--worker-cache, queue dispatch).
+   Every worker keeps the responses it computed, with the key of
+   tilecache.h, and answers a tile it holds from memory. Rank 0 keeps
+   the directory of which worker holds which tile, and sends a held
+   tile straight to its holder instead of queueing it. Rank 0 also
+   decides the evictions: once the values a worker holds exceed the
+   limit, its least recently used tiles are dropped from the directory,
+   and the worker is told to drop them with the next tiles it gets. A
+   tile computed again elsewhere moves to its new holder. A worker that
+   gets no tiles for a while would pile up notices, past
+   TILEDIR_MAX_NOTICES the directory forgets all it holds and the
+   notices collapse into one that drops its whole cache. */
+#define TILEDIR_BUCKETS 65536
+#define TILEDIR_MAX_NOTICES 4096 // per worker
+
+typedef struct {
+  long long routed;    // tiles sent to the worker that holds them
+  long long evictions; // notices sent to the workers
+  size_t bytes;        // values held by all the workers together
+  int tiles;
+} tiledir_stats_t;
+
+void tiledir_init (int world_size, size_t limit);
+void tiledir_finalize (void);
+
+/* the worker that holds tile, or -1 */
+int tiledir_holder (const payload_t *tile);
+
+/* tile was sent to its holder */
+void tiledir_routed (const payload_t *tile);
+
+/* the worker of response keeps its tile now */
+void tiledir_received (const response_t *response);
+
+/* copy into notices up to max tiles that worker has to drop (with
+   the generation PAYLOAD_GENERATION_EVICT, or one with
+   PAYLOAD_GENERATION_FLUSH for all of them), returns their number */
+int tiledir_evictions (int worker, payload_t *notices, int max);
+
+tiledir_stats_t tiledir_stats (void);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#ifndef __TILESTORE_H_
+#define __TILESTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fractal.h"
+
+/* Persistent tile store of rank 0 (--tile-store <path>). The values of
+   the tiles sent to clients survive restarts in two append-only files:
+   <path>.data holds the iteration counts (or palette indexes) of every
+   tile, memory-mapped with its whole capacity reserved, and <path>.index
+   one fixed-size entry per tile. An entry is keyed by the quadtree
+   address of the tile, the kernel and depth that computed it, with the
+   exact corners, size, palette and stride of the tile telling apart
+   tiles that are not aligned on the quadtree. Hits are lent straight
+   from the mapping, with no copy; the index is read back at startup so
+   that a restart starts warm, and --batch fills the store offline. The
+   files are only meant for the machine that wrote them. */
+#define TILESTORE_MAGIC "FRACSTO1"
+#define TILESTORE_BUCKETS 65536
+#define TILESTORE_ALIGN 64 // of the values of every tile in the data file
+#define TILESTORE_ROOT_LL (-2.0L) // the quadtree covers [-2, 2] x [-2, 2]
+#define TILESTORE_ROOT_SIZE 4.0L
+#define TILESTORE_MAX_LEVEL 31 // two bits of address per level
+
+/* the kernels whose tiles may be kept, mandelbrot.c is the only one */
+#define TILESTORE_KERNEL_MANDELBROT 1
+
+typedef struct {
+  long long hits;
+  long long misses;
+  long long refused; // appended once the data file was full
+  int tiles;
+  size_t bytes;      // of the data file in use
+  size_t capacity;
+} tilestore_stats_t;
+
+/* open or create the files of path, reserving capacity bytes of values
+   (more if the data file is already larger). Returns -1 on failure. */
+int tilestore_open (const char *path, size_t capacity);
+void tilestore_close (void);
+
+/* a response of tile whose values are lent by the store, with
+   encoded_size RESPONSE_IN_FRAMEBUFFER, or NULL. The caller owns the
+   response but not its values. */
+response_t *tilestore_lookup (const payload_t *tile);
+
+/* append the values of response (decoded if need be), unless its tile
+   is already there */
+void tilestore_store (const response_t *response);
+
+tilestore_stats_t tilestore_stats (void);
+
+/* quadtree address of the cell of the center of tile, at the level
+   whose cells have the size of the tile, returned in *level */
+uint64_t tilestore_address (const payload_t *tile, int *level);
+
+#endif
@@ -10,7 +10,9 @@ HOST="localhost"
 PORT=5000 
 COORDINATOR="./bin/coordinator"
 CLIENT="./bin/textual"
-EXPERIMENT_DIR="experiments"
+EXPERIMENT_DIR="${EXPERIMENT_DIR:-experiments}"
+COORDINATOR_OPTIONS="${COORDINATOR_OPTIONS:-}" # e.g. "--dispatch rma"
+BATCH="${BATCH:-}" # non-empty: static-partition batch runs, no client
 CLIENT_OUTPUT_FILE="client_output.txt"
 SERVER_OUTPUT_FOLDER="server_output"
 
@@ -31,36 +33,45 @@ for line in "${csv_lines[@]}"; do
     echo "    Depth: $max_depth"
     echo "    Coords: LL=($llx, $lly), UR=($urx, $ury)"
     echo "    Resolution: ${screen_width}x${screen_height}"
+    echo "    Coordinator options: ${COORDINATOR_OPTIONS:-none}"
   
-    # Check if port is available before launching coordinator
-    while ! is_port_free "$PORT"; do
-        echo "Port $PORT is busy, waiting..."
-        leep 1
-    done
-
-    # Launch coordinator
-    mpirun -n $((nodes * 2)) --quiet --output-filename "$SERVER_OUTPUT_FOLDER" "$COORDINATOR" "$PORT" &> /dev/null &
-    coord_pid=$!
-
-    # Wait for coordinator to open port before launching client
-    while is_port_free "$PORT"; do
-        echo "Waiting for coordinator to start before launching client..."
-        sleep 1
-    done
-
-    # Start client
-    "$CLIENT" "$HOST" "$PORT" "$granularity" "$max_depth" "$screen_width" "$screen_height" \
-               "$llx" "$lly" "$urx" "$ury" &> "$CLIENT_OUTPUT_FILE" &
-    client_pid=$!
-
-    wait "$client_pid"
-    client_status=$?
-
-    wait "$coord_pid"
-    coord_status=$?
-
-    echo "Client exited with status $client_status."
-    echo "Coordinator exited with status $coord_status."
+    if [[ -n "$BATCH" ]]; then
+        # Whole frame in one collective run, the coordinator output stands for the client
+        mpirun -n $((nodes * 2)) --quiet --output-filename "$SERVER_OUTPUT_FOLDER" "$COORDINATOR" \
+               --batch "$granularity,$max_depth,$screen_width,$screen_height,$llx,$lly,$urx,$ury" \
+               $COORDINATOR_OPTIONS &> "$CLIENT_OUTPUT_FILE"
+        echo "Coordinator exited with status $?."
+    else
+        # Check if port is available before launching coordinator
+        while ! is_port_free "$PORT"; do
+            echo "Port $PORT is busy, waiting..."
+            leep 1
+        done
+
+        # Launch coordinator
+        mpirun -n $((nodes * 2)) --quiet --output-filename "$SERVER_OUTPUT_FOLDER" "$COORDINATOR" "$PORT" $COORDINATOR_OPTIONS &> /dev/null &
+        coord_pid=$!
+
+        # Wait for coordinator to open port before launching client
+        while is_port_free "$PORT"; do
+            echo "Waiting for coordinator to start before launching client..."
+            sleep 1
+        done
+
+        # Start client
+        "$CLIENT" "$HOST" "$PORT" "$granularity" "$max_depth" "$screen_width" "$screen_height" \
+                   "$llx" "$lly" "$urx" "$ury" &> "$CLIENT_OUTPUT_FILE" &
+        client_pid=$!
+
+        wait "$client_pid"
+        client_status=$?
+
+        wait "$coord_pid"
+        coord_status=$?
+
+        echo "Client exited with status $client_status."
+        echo "Coordinator exited with status $coord_status."
+    fi
 
     # Remove '.' from blocks
     blocks_cleaned="${blocks//./}"
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+# Runs run_experiment_local.sh once per scheduling policy, with the
+# same parameter file. The results of policy p go to ${EXPERIMENT_DIR}_p.
+SCHEDULES="${SCHEDULES:-fifo guided factoring largest-first locality}"
+BASE_DIR="${EXPERIMENT_DIR:-experiments}"
+BASE_OPTIONS="${COORDINATOR_OPTIONS:-}"
+
+for schedule in $SCHEDULES; do
+    echo "Scheduling policy: $schedule"
+    COORDINATOR_OPTIONS="$BASE_OPTIONS --schedule $schedule" \
+    EXPERIMENT_DIR="${BASE_DIR}_${schedule}" \
+        "$(dirname "$0")/run_experiment_local.sh"
+done
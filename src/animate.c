@@ -0,0 +1,445 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#include "fractal.h"
+#include "mpi_comm.h"
+#include "timing.h"
+#include "logging.h"
+#include "reuse.h"
+#include "batch.h"
+#include "animate.h"
+
+typedef struct {
+  int frame;
+  fractal_coord_t ll;
+  fractal_coord_t ur;
+} animate_keyframe_t;
+
+/* a frame on rank 0 */
+typedef struct {
+  payload_t origin;
+  int *values;  // row-major, width * height
+  char *copied; // by discretization index, tiles copied from the previous frame
+  int next;     // next discretization index to hand out
+  int pending;  // tiles still computed by the workers
+  bool mapped;  // the pixels fall on the previous frame, see reuse_map
+  int ratio, shift_x, shift_y;
+} animate_frame_t;
+
+static int floor_div (int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* frame f between the keyframes a and b: linear center, geometric size */
+static void animate_interpolate (const animate_keyframe_t *a, const animate_keyframe_t *b,
+                                 int f, payload_t *frame)
+{
+  if (f == a->frame || f == b->frame) {
+    const animate_keyframe_t *k = (f == a->frame) ? a : b;
+    frame->ll = k->ll;
+    frame->ur = k->ur;
+    return;
+  }
+  long double t = (long double)(f - a->frame) / (b->frame - a->frame);
+  long double wa = a->ur.real - a->ll.real, wb = b->ur.real - b->ll.real;
+  long double ha = a->ur.imag - a->ll.imag, hb = b->ur.imag - b->ll.imag;
+  long double w = wa * powl(wb / wa, t);
+  long double h = ha * powl(hb / ha, t);
+  long double cx = (a->ll.real + a->ur.real) / 2;
+  long double cy = (a->ll.imag + a->ur.imag) / 2;
+  cx += ((b->ll.real + b->ur.real) / 2 - cx) * t;
+  cy += ((b->ll.imag + b->ur.imag) / 2 - cy) * t;
+  frame->ll.real = cx - w / 2;
+  frame->ll.imag = cy - h / 2;
+  frame->ur.real = cx + w / 2;
+  frame->ur.imag = cy + h / 2;
+}
+
+/* the viewport of every frame of the path in filename, NULL if it does
+   not parse */
+static payload_t *animate_path (const char *filename, const payload_t *first, int *frames)
+{
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    return NULL;
+  }
+  int count = 1, capacity = 16;
+  animate_keyframe_t *keys = malloc(capacity * sizeof(animate_keyframe_t));
+  if (keys == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  keys[0] = (animate_keyframe_t) { .frame = 0, .ll = first->ll, .ur = first->ur };
+
+  char line[512];
+  bool valid = true;
+  while (valid && fgets(line, sizeof(line), file) != NULL) {
+    char *start = line + strspn(line, " \t");
+    if (*start == '#' || *start == '\n' || *start == '\0') continue;
+    animate_keyframe_t k;
+    valid = sscanf(start, "%d %Lf %Lf %Lf %Lf", &k.frame,
+                   &k.ll.real, &k.ll.imag, &k.ur.real, &k.ur.imag) == 5 &&
+      k.frame > keys[count - 1].frame && k.ur.real > k.ll.real && k.ur.imag > k.ll.imag;
+    if (!valid) break;
+    if (count == capacity) {
+      capacity *= 2;
+      keys = realloc(keys, capacity * sizeof(animate_keyframe_t));
+      if (keys == NULL) {
+        fprintf(stderr, "malloc failed.\n");
+        exit(1);
+      }
+    }
+    keys[count++] = k;
+  }
+  fclose(file);
+  if (!valid) {
+    free(keys);
+    return NULL;
+  }
+
+  *frames = keys[count - 1].frame + 1;
+  payload_t *path = malloc(*frames * sizeof(payload_t));
+  if (path == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  int segment = 0;
+  for (int f = 0; f < *frames; f++) {
+    while (segment + 2 < count && keys[segment + 1].frame < f) segment++;
+    path[f] = *first;
+    path[f].generation = f;
+    const animate_keyframe_t *b = (count > 1) ? &keys[segment + 1] : &keys[0];
+    animate_interpolate(&keys[segment], b, f, &path[f]);
+  }
+  free(keys);
+  return path;
+}
+
+/* the part of tile on the screen of origin */
+static void animate_clip (const payload_t *origin, const payload_t *tile,
+                          int *x0, int *y0, int *columns, int *rows)
+{
+  int g = origin->granularity;
+  int width = origin->s_ur.x - origin->s_ll.x;
+  int height = origin->s_ur.y - origin->s_ll.y;
+  *x0 = tile->s_ll.x - origin->s_ll.x;
+  *y0 = tile->s_ll.y - origin->s_ll.y;
+  *columns = (*x0 + g > width) ? width - *x0 : g;
+  *rows = (*y0 + g > height) ? height - *y0 : g;
+}
+
+/* start frame f of path on its slot, marking the tiles that fall on
+   frame f - 1. Returns the number of tiles copied. */
+static int animate_start (animate_frame_t *frame, const payload_t *path, int f, int length)
+{
+  frame->origin = path[f];
+  frame->next = 0;
+  frame->pending = 0;
+  frame->mapped = f > 0 &&
+    reuse_map(&path[f - 1], &path[f], &frame->ratio, &frame->shift_x, &frame->shift_y);
+
+  // The pixels of the screen that fall on the previous one
+  int width = frame->origin.s_ur.x - frame->origin.s_ll.x;
+  int height = frame->origin.s_ur.y - frame->origin.s_ll.y;
+  int cx0 = 0, cy0 = 0, cx1 = 0, cy1 = 0;
+  if (frame->mapped) {
+    cx0 = -floor_div(frame->shift_x, frame->ratio);
+    cy0 = -floor_div(frame->shift_y, frame->ratio);
+    cx1 = floor_div(width - 1 - frame->shift_x, frame->ratio) + 1;
+    cy1 = floor_div(height - 1 - frame->shift_y, frame->ratio) + 1;
+  }
+
+  int copied = 0;
+  for (int index = 0; index < length; index++) {
+    payload_t tile;
+    int x0, y0, columns, rows;
+    discretize_tile(&frame->origin, index, &tile);
+    animate_clip(&frame->origin, &tile, &x0, &y0, &columns, &rows);
+    frame->copied[index] = frame->mapped &&
+      cx0 <= x0 && cy0 <= y0 && x0 + columns <= cx1 && y0 + rows <= cy1;
+    if (frame->copied[index]) {
+      copied++;
+    } else {
+      frame->pending++;
+    }
+  }
+  return copied;
+}
+
+/* fill the copied tiles of frame from previous, once previous is complete */
+static void animate_copy (animate_frame_t *frame, const animate_frame_t *previous, int length)
+{
+  int width = frame->origin.s_ur.x - frame->origin.s_ll.x;
+  for (int index = 0; index < length; index++) {
+    if (!frame->copied[index]) continue;
+    payload_t tile;
+    int x0, y0, columns, rows;
+    discretize_tile(&frame->origin, index, &tile);
+    animate_clip(&frame->origin, &tile, &x0, &y0, &columns, &rows);
+    for (int y = y0; y < y0 + rows; y++) {
+      const int *row = previous->values +
+        (size_t)(frame->shift_y + frame->ratio * y) * width + frame->shift_x;
+      int *to = frame->values + (size_t)y * width;
+      for (int x = x0; x < x0 + columns; x++) {
+        to[x] = row[frame->ratio * x];
+      }
+    }
+  }
+}
+
+static void animate_write (const animate_frame_t *frame, const char *prefix, int f)
+{
+  char filename[OPTIONS_MAX_PATH + 16];
+  snprintf(filename, sizeof(filename), "%s_%05d.raw", prefix, f);
+  size_t pixels = (size_t)(frame->origin.s_ur.x - frame->origin.s_ll.x) *
+    (frame->origin.s_ur.y - frame->origin.s_ll.y);
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL || fwrite(frame->values, sizeof(int), pixels, file) != pixels ||
+      fclose(file) != 0) {
+    fprintf(stderr, "Failed to write %s.\n", filename);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+
+/* worker side: compute the tiles rank 0 sends until it sends the
+   shutdown payload, returns the compute time */
+static double animate_worker (int rank)
+{
+  long long total_iterations = 0;
+  long long total_pixels = 0;
+  double compute_time = 0;
+  while (1) {
+    payload_t *tile = mpi_payload_receive(0, MPI_COMM_WORLD);
+    if (tile->generation == PAYLOAD_GENERATION_SHUTDOWN) {
+      free(tile);
+      break;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    create_response_return_t result = create_response_for_payload(tile);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (result.response == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    result.response->worker_id = rank;
+    result.response->compute_time = timespec_to_double(timespec_diff(start, end));
+    compute_time += result.response->compute_time;
+    total_iterations += result.total_iterations;
+    total_pixels += tile->granularity * tile->granularity;
+    mpi_response_send(result.response, 0, MPI_COMM_WORLD);
+    free_response(result.response);
+    free(tile);
+  }
+  batch_log_worker(rank, compute_time, total_pixels, total_iterations);
+  return compute_time;
+}
+
+typedef struct {
+  int copied; // tiles copied from the previous frame
+  int ahead;  // tiles handed out while an earlier frame was incomplete
+  long long iterations;
+} animate_stats_t;
+
+/* rank 0 side, see animate.h */
+static animate_stats_t animate_coordinator (const options_t *options, const payload_t *path,
+                                            int frames, int workers)
+{
+  const payload_t *first = &path[0];
+  int length = discretize_length(first);
+  int g = first->granularity;
+  int width = first->s_ur.x - first->s_ll.x;
+
+  animate_frame_t slots[ANIMATE_WINDOW];
+  for (int i = 0; i < ANIMATE_WINDOW; i++) {
+    slots[i].values = malloc((size_t)width * (first->s_ur.y - first->s_ll.y) * sizeof(int));
+    slots[i].copied = malloc(length);
+    if (slots[i].values == NULL || slots[i].copied == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  int *outstanding = calloc(workers + 1, sizeof(int));
+  if (outstanding == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  animate_stats_t stats = {0};
+  int started = 0; // frames whose tiles are handed out, or were
+  int written = 0;
+  while (written < frames) {
+    // Hand out tiles, moving on to the next frame as soon as one is drained
+    for (int w = 1; w <= workers; w++) {
+      while (outstanding[w] < ANIMATE_PREFETCH) {
+        animate_frame_t *frame = (started > 0) ? &slots[(started - 1) % ANIMATE_WINDOW] : NULL;
+        while (frame != NULL && frame->next < length && frame->copied[frame->next]) {
+          frame->next++;
+        }
+        if (frame == NULL || frame->next == length) {
+          // The slot of frame started - ANIMATE_WINDOW + 1 is free once
+          // the frame after it is written, it was copied from
+          if (started == frames || started >= written + ANIMATE_WINDOW - 1) break;
+          frame = &slots[started % ANIMATE_WINDOW];
+          stats.copied += animate_start(frame, path, started, length);
+          started++;
+          continue;
+        }
+        payload_t tile;
+        discretize_tile(&frame->origin, frame->next++, &tile);
+        if (tile.generation > written) stats.ahead++;
+        mpi_payload_send(&tile, w, MPI_COMM_WORLD);
+        outstanding[w]++;
+      }
+    }
+
+    // Frames go out in order, the copied tiles need the previous one whole
+    bool progress = false;
+    while (written < started && slots[written % ANIMATE_WINDOW].pending == 0) {
+      animate_frame_t *frame = &slots[written % ANIMATE_WINDOW];
+      if (frame->mapped) {
+        animate_copy(frame, &slots[(written - 1) % ANIMATE_WINDOW], length);
+      }
+      animate_write(frame, options->batch_output, written);
+      written++;
+      progress = true;
+    }
+    if (progress || written == frames) continue;
+
+    response_t *response = mpi_response_receive(MPI_ANY_SOURCE, MPI_COMM_WORLD);
+    animate_frame_t *frame = &slots[response->payload.generation % ANIMATE_WINDOW];
+    int x0, y0, columns, rows;
+    animate_clip(&frame->origin, &response->payload, &x0, &y0, &columns, &rows);
+    for (int y = 0; y < rows; y++) {
+      memcpy(frame->values + (size_t)(y0 + y) * width + x0,
+             response->values + y * g, columns * sizeof(int));
+    }
+    frame->pending--;
+    outstanding[response->worker_id]--;
+    stats.iterations += response->iterations;
+    free_response(response);
+  }
+
+  payload_t shutdown = {0};
+  shutdown.generation = PAYLOAD_GENERATION_SHUTDOWN;
+  for (int w = 1; w <= workers; w++) {
+    mpi_payload_send(&shutdown, w, MPI_COMM_WORLD);
+  }
+
+  for (int i = 0; i < ANIMATE_WINDOW; i++) {
+    free(slots[i].values);
+    free(slots[i].copied);
+  }
+  free(outstanding);
+  return stats;
+}
+
+int main_animate(const options_t *options)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  int workers = size - 1;
+  if (workers < 1) {
+    if (rank == 0) fprintf(stderr, "Batch mode needs at least one worker.\n");
+    return 1;
+  }
+
+  // Only rank 0 reads the path, the workers get their tiles from it
+  payload_t *path = NULL;
+  int frames = 0;
+  if (rank == 0) {
+    path = animate_path(options->animate, &options->batch_viewport, &frames);
+    if (path == NULL) {
+      fprintf(stderr, "Failed to read the keyframes of %s.\n", options->animate);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+#if LOG_LEVEL >= LOG_BASIC
+  FILE *coordinator_log = NULL;
+  if (rank == 0) {
+    coordinator_log = fopen("coordinator_log.txt", "w");
+    if (coordinator_log == NULL) {
+      fprintf(stderr, "Failed to create coordinator log file.\n");
+      exit(1);
+    }
+  }
+#endif
+
+  struct timespec start_time, end_time;
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  animate_stats_t stats = {0};
+  double compute_time = 0;
+  if (rank == 0) {
+    stats = animate_coordinator(options, path, frames, workers);
+  } else {
+    compute_time = animate_worker(rank);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  double *compute_times = NULL;
+  if (rank == 0) {
+    compute_times = malloc(size * sizeof(double));
+    if (compute_times == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  MPI_Gather(&compute_time, 1, MPI_DOUBLE, compute_times, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    // Imbalance as max / mean of the compute time of the workers
+    double max_time = 0, sum_time = 0;
+    for (int i = 1; i < size; i++) {
+      sum_time += compute_times[i];
+      if (compute_times[i] > max_time) max_time = compute_times[i];
+    }
+    double imbalance = (sum_time > 0) ? max_time / (sum_time / workers) : 1;
+    double total_time = timespec_to_double(timespec_diff(start_time, end_time));
+    const payload_t *first = &path[0];
+    printf("Animation of %d frames of %dx%d pixels in %d tiles written to %s_*.raw: "
+           "%d tiles copied, %d handed out ahead, %lld iterations, %.9f s, imbalance %.3f\n",
+           frames, first->s_ur.x - first->s_ll.x, first->s_ur.y - first->s_ll.y,
+           discretize_length(first), options->batch_output, stats.copied, stats.ahead,
+           stats.iterations, total_time, imbalance);
+
+#if LOG_LEVEL >= LOG_BASIC
+    fprintf(coordinator_log, "[MPI_RECV_ALL]: %.9f\n", total_time);
+    fprintf(coordinator_log, "[BATCH_IMBALANCE]: %.9f\n", imbalance);
+    fprintf(coordinator_log, "[ANIMATE_FRAMES]: %d\n", frames);
+    fprintf(coordinator_log, "[ANIMATE_COPIED]: %d\n", stats.copied);
+    fprintf(coordinator_log, "[ANIMATE_AHEAD]: %d\n", stats.ahead);
+    fclose(coordinator_log);
+#endif
+  }
+
+  free(compute_times);
+  free(path);
+  return 0;
+}
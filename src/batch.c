@@ -0,0 +1,542 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#include "fractal.h"
+#include "mpi_comm.h"
+#include "timing.h"
+#include "logging.h"
+#include "batch.h"
+#include "tilestore.h"
+
+/* rank that computes tile index */
+static int batch_owner(int index, int block, int workers)
+{
+  return 1 + (index / block) % workers;
+}
+
+/* worker side: compute the tiles of rank one after the other into values */
+static void batch_compute(const payload_t *viewport, int block, int rank, int workers,
+                          int *values, double *compute_time)
+{
+  int length = discretize_length(viewport);
+  int tile_values = viewport->granularity * viewport->granularity;
+  long long total_iterations = 0;
+  long long total_pixels = 0;
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int index = 0; index < length; index++) {
+    if (batch_owner(index, block, workers) != rank) continue;
+    payload_t tile;
+    discretize_tile(viewport, index, &tile);
+    create_response_return_t result = create_response_in_place(&tile, NULL, values);
+    if (result.response == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    free_response(result.response); // values stay in our buffer
+    total_iterations += result.total_iterations;
+    total_pixels += tile_values;
+    values += tile_values;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *compute_time = timespec_to_double(timespec_diff(start, end));
+  batch_log_worker(rank, *compute_time, total_pixels, total_iterations);
+}
+
+void batch_log_worker(int rank, double compute_time,
+                      long long total_pixels, long long total_iterations)
+{
+#if LOG_LEVEL >= LOG_BASIC
+  if (mkdir("worker_logs", 0777) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create worker logs directory.\n");
+    exit(1);
+  }
+  char log_filename[64];
+  snprintf(log_filename, sizeof(log_filename), "worker_logs/worker_%d.txt", rank);
+  FILE *log = fopen(log_filename, "w");
+  if (log == NULL) {
+    fprintf(stderr, "Failed to create worker log file.\n");
+    exit(1);
+  }
+  fprintf(log, "[WORKER_%d_TOTAL]: %.9f, %lld, %lld\n",
+          rank, compute_time, total_pixels, total_iterations);
+  fclose(log);
+#else
+  (void)rank;
+  (void)compute_time;
+  (void)total_iterations;
+  (void)total_pixels;
+#endif
+}
+
+/* rank 0: copy the gathered tiles, stored rank after rank, into a
+   row-major frame of the viewport, and into the tile store if store */
+static void batch_assemble(const payload_t *viewport, int block, int workers,
+                           const int *gathered, const int *displs, int *frame, bool store)
+{
+  int length = discretize_length(viewport);
+  int g = viewport->granularity;
+  int width = viewport->s_ur.x - viewport->s_ll.x;
+  int height = viewport->s_ur.y - viewport->s_ll.y;
+  int *next = malloc((workers + 1) * sizeof(int));
+  if (next == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  memcpy(next, displs, (workers + 1) * sizeof(int));
+
+  for (int index = 0; index < length; index++) {
+    int owner = batch_owner(index, block, workers);
+    const int *values = gathered + next[owner];
+    next[owner] += g * g;
+    payload_t tile;
+    discretize_tile(viewport, index, &tile);
+    if (store) {
+      response_t response = {0};
+      response.payload = tile;
+      response.values = (int *)values;
+      tilestore_store(&response);
+    }
+    int x0 = tile.s_ll.x - viewport->s_ll.x;
+    int y0 = tile.s_ll.y - viewport->s_ll.y;
+    // the last row and column of tiles may stick out of the screen
+    int columns = (x0 + g > width) ? width - x0 : g;
+    int rows = (y0 + g > height) ? height - y0 : g;
+    for (int y = 0; y < rows; y++) {
+      memcpy(frame + (long long)(y0 + y) * width + x0, values + y * g, columns * sizeof(int));
+    }
+  }
+  free(next);
+}
+
+/* output mode: the first tile of rank in round, or past length */
+static int batch_round_first(int round, int block, int rank, int workers)
+{
+  return (round * workers + rank - 1) * block;
+}
+
+/* output mode: write the tile of values to its place in the raw image
+   of fh. Collective, a rank without a tile passes NULL. */
+static void batch_write_tile(MPI_File fh, const payload_t *viewport,
+                             const payload_t *tile, const int *values)
+{
+  if (tile == NULL) {
+    MPI_File_set_view(fh, 0, MPI_INT, MPI_INT, "native", MPI_INFO_NULL);
+    MPI_File_write_all(fh, NULL, 0, MPI_INT, MPI_STATUS_IGNORE);
+    return;
+  }
+  int g = viewport->granularity;
+  int width = viewport->s_ur.x - viewport->s_ll.x;
+  int height = viewport->s_ur.y - viewport->s_ll.y;
+  int x0 = tile->s_ll.x - viewport->s_ll.x;
+  int y0 = tile->s_ll.y - viewport->s_ll.y;
+  // the last row and column of tiles may stick out of the image
+  int columns = (x0 + g > width) ? width - x0 : g;
+  int rows = (y0 + g > height) ? height - y0 : g;
+
+  int image_sizes[2] = {height, width};
+  int tile_sizes[2] = {g, g};
+  int subsizes[2] = {rows, columns};
+  int image_starts[2] = {y0, x0};
+  int tile_starts[2] = {0, 0};
+  MPI_Datatype filetype, memtype;
+  MPI_Type_create_subarray(2, image_sizes, subsizes, image_starts,
+                           MPI_ORDER_C, MPI_INT, &filetype);
+  MPI_Type_create_subarray(2, tile_sizes, subsizes, tile_starts,
+                           MPI_ORDER_C, MPI_INT, &memtype);
+  MPI_Type_commit(&filetype);
+  MPI_Type_commit(&memtype);
+  MPI_File_set_view(fh, 0, MPI_INT, filetype, "native", MPI_INFO_NULL);
+  MPI_File_write_all(fh, values, 1, memtype, MPI_STATUS_IGNORE);
+  MPI_Type_free(&filetype);
+  MPI_Type_free(&memtype);
+}
+
+/* a and b describe the same image. Field by field, the padding of the
+   structure (and of long double) is whatever the writer had there. */
+static int batch_same_viewport(const payload_t *a, const payload_t *b)
+{
+  return a->granularity == b->granularity && a->fractal_depth == b->fractal_depth &&
+    a->palette == b->palette && a->stride == b->stride &&
+    a->ll.real == b->ll.real && a->ll.imag == b->ll.imag &&
+    a->ur.real == b->ur.real && a->ur.imag == b->ur.imag &&
+    a->s_ll.x == b->s_ll.x && a->s_ll.y == b->s_ll.y &&
+    a->s_ur.x == b->s_ur.x && a->s_ur.y == b->s_ur.y;
+}
+
+/* output mode: open the progress map of path (one byte per tile after
+   the viewport), or start it over when it belongs to another
+   viewport. Collective; done receives the map on every rank. */
+static MPI_File batch_open_done(const char *path, const payload_t *viewport,
+                                int length, char *done, int *resumed)
+{
+  char done_path[OPTIONS_MAX_PATH + 8];
+  snprintf(done_path, sizeof(done_path), "%s.done", path);
+  MPI_File fh;
+  if (MPI_File_open(MPI_COMM_WORLD, done_path, MPI_MODE_RDWR | MPI_MODE_CREATE,
+                    MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    fprintf(stderr, "Failed to open %s.\n", done_path);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  int resume = 0;
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (rank == 0) {
+    MPI_Offset size;
+    payload_t header;
+    MPI_File_get_size(fh, &size);
+    // the marks only hold if the image is still the one they were made for
+    struct stat image;
+    off_t image_size = (off_t)(viewport->s_ur.x - viewport->s_ll.x) *
+      (viewport->s_ur.y - viewport->s_ll.y) * sizeof(int);
+    if (size == (MPI_Offset)sizeof(payload_t) + length &&
+        stat(path, &image) == 0 && image.st_size == image_size) {
+      MPI_File_read_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+      resume = batch_same_viewport(&header, viewport);
+    }
+  }
+  MPI_Bcast(&resume, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if (resume) {
+    MPI_File_read_at_all(fh, sizeof(payload_t), done, length, MPI_BYTE, MPI_STATUS_IGNORE);
+  } else {
+    memset(done, 0, length);
+    MPI_File_set_size(fh, 0);
+    if (rank == 0) {
+      MPI_File_write_at(fh, 0, viewport, sizeof(*viewport), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_set_size(fh, (MPI_Offset)sizeof(payload_t) + length);
+    MPI_File_sync(fh);
+  }
+  *resumed = resume;
+  return fh;
+}
+
+/* output mode: the workers write their tiles straight into a raw
+   row-major image of ints with collective MPI-IO, round after round
+   of block tiles per worker, so that no rank holds more than block
+   tiles. Tiles of a finished round are marked in the progress map
+   once the image is synced, a restart skips them. */
+static int batch_write(const options_t *options, int workers)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  payload_t viewport = options->batch_viewport;
+  int block = options->batch_block;
+
+#if LOG_LEVEL >= LOG_BASIC
+  FILE *coordinator_log = NULL;
+  if (rank == 0) {
+    coordinator_log = fopen("coordinator_log.txt", "w");
+    if (coordinator_log == NULL) {
+      fprintf(stderr, "Failed to create coordinator log file.\n");
+      exit(1);
+    }
+  }
+#endif
+
+  struct timespec start_time, broadcast_time, written_time;
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  // The viewport of rank 0 is the one everybody renders
+  MPI_Bcast(&viewport, 1, mpi_payload_datatype(), 0, MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &broadcast_time);
+
+  int length = discretize_length(&viewport);
+  int tile_values = viewport.granularity * viewport.granularity;
+  char *done = malloc(length + 1);
+  char *marks = malloc(block);
+  int *values = malloc(((size_t)block * tile_values + 1) * sizeof(int));
+  if (done == NULL || marks == NULL || values == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  memset(marks, 1, block);
+
+  MPI_File image;
+  if (MPI_File_open(MPI_COMM_WORLD, options->batch_output,
+                    MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                    MPI_INFO_NULL, &image) != MPI_SUCCESS) {
+    if (rank == 0) fprintf(stderr, "Failed to open %s.\n", options->batch_output);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  int resumed;
+  MPI_File progress = batch_open_done(options->batch_output, &viewport, length, done, &resumed);
+  int width = viewport.s_ur.x - viewport.s_ll.x;
+  int height = viewport.s_ur.y - viewport.s_ll.y;
+  if (!resumed) {
+    MPI_File_set_size(image, (MPI_Offset)width * height * sizeof(int));
+  }
+
+  int rounds = (length + block * workers - 1) / (block * workers);
+  long long total_iterations = 0;
+  long long total_pixels = 0;
+  int skipped = 0;
+  double compute_time = 0;
+  struct timespec start, end;
+  for (int round = 0; round < rounds; round++) {
+    int first = (rank == 0) ? length : batch_round_first(round, block, rank, workers);
+    int count = (first >= length) ? 0 : ((first + block > length) ? length - first : block);
+
+    // Compute the tiles of this round that a previous run did not write
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+      if (done[first + i]) {
+        skipped++;
+        continue;
+      }
+      payload_t tile;
+      discretize_tile(&viewport, first + i, &tile);
+      create_response_return_t result =
+        create_response_in_place(&tile, NULL, values + (size_t)i * tile_values);
+      if (result.response == NULL) {
+        fprintf(stderr, "malloc failed.\n");
+        exit(1);
+      }
+      free_response(result.response); // values stay in our buffer
+      total_iterations += result.total_iterations;
+      total_pixels += tile_values;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    compute_time += timespec_to_double(timespec_diff(start, end));
+
+    // Every rank takes part in the block collective writes of the round
+    for (int i = 0; i < block; i++) {
+      if (i < count && !done[first + i]) {
+        payload_t tile;
+        discretize_tile(&viewport, first + i, &tile);
+        batch_write_tile(image, &viewport, &tile, values + (size_t)i * tile_values);
+      } else {
+        batch_write_tile(image, &viewport, NULL, NULL);
+      }
+    }
+
+    // Only a synced round counts as done
+    MPI_File_sync(image);
+    MPI_File_write_at_all(progress, (MPI_Offset)sizeof(payload_t) + (count ? first : 0),
+                          marks, count, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_sync(progress);
+  }
+  MPI_File_close(&progress);
+  MPI_File_close(&image);
+  clock_gettime(CLOCK_MONOTONIC, &written_time);
+  if (rank != 0) {
+    batch_log_worker(rank, compute_time, total_pixels, total_iterations);
+  }
+
+  double *compute_times = NULL;
+  if (rank == 0) {
+    compute_times = malloc(size * sizeof(double));
+    if (compute_times == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  MPI_Gather(&compute_time, 1, MPI_DOUBLE, compute_times, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  long long iterations = 0;
+  int skipped_tiles = 0;
+  MPI_Reduce(&total_iterations, &iterations, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&skipped, &skipped_tiles, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    // Imbalance as max / mean of the compute time of the workers
+    double max_time = 0, sum_time = 0;
+    for (int i = 1; i < size; i++) {
+      sum_time += compute_times[i];
+      if (compute_times[i] > max_time) max_time = compute_times[i];
+    }
+    double imbalance = (sum_time > 0) ? max_time / (sum_time / workers) : 1;
+
+    printf("Batch image of %dx%d pixels in %d tiles (blocks of %d) written to %s: "
+           "%d skipped, %lld iterations, %.9f s, imbalance %.3f\n",
+           width, height, length, block, options->batch_output, skipped_tiles,
+           iterations, timespec_to_double(timespec_diff(start_time, written_time)), imbalance);
+
+#if LOG_LEVEL >= LOG_BASIC
+    fprintf(coordinator_log, "[DISCRETIZED]: %.9f\n",
+            timespec_to_double(timespec_diff(start_time, broadcast_time)));
+    fprintf(coordinator_log, "[MPI_RECV_ALL]: %.9f\n",
+            timespec_to_double(timespec_diff(start_time, written_time)));
+    fprintf(coordinator_log, "[BATCH_IMBALANCE]: %.9f\n", imbalance);
+    fprintf(coordinator_log, "[BATCH_SKIPPED]: %d\n", skipped_tiles);
+    fclose(coordinator_log);
+#endif
+  }
+
+  free(compute_times);
+  free(values);
+  free(marks);
+  free(done);
+  return 0;
+}
+
+int main_batch(const options_t *options)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  int workers = size - 1;
+  if (workers < 1) {
+    if (rank == 0) fprintf(stderr, "Batch mode needs at least one worker.\n");
+    return 1;
+  }
+  if (options->batch_output[0] != '\0') {
+    return batch_write(options, workers);
+  }
+
+  payload_t viewport = options->batch_viewport;
+  int block = options->batch_block;
+  int length = discretize_length(&viewport);
+  int tile_values = viewport.granularity * viewport.granularity;
+  if ((long long)length * tile_values > INT_MAX) {
+    if (rank == 0) fprintf(stderr, "Batch frame too large for MPI_Gatherv.\n");
+    return 1;
+  }
+
+#if LOG_LEVEL >= LOG_BASIC
+  FILE *coordinator_log = NULL;
+  if (rank == 0) {
+    coordinator_log = fopen("coordinator_log.txt", "w");
+    if (coordinator_log == NULL) {
+      fprintf(stderr, "Failed to create coordinator log file.\n");
+      exit(1);
+    }
+  }
+#endif
+
+  // Same share of tiles on every rank, no need to ask rank 0 for them
+  int *counts = calloc(size, sizeof(int));
+  int *displs = calloc(size, sizeof(int));
+  if (counts == NULL || displs == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  for (int index = 0; index < length; index++) {
+    counts[batch_owner(index, block, workers)] += tile_values;
+  }
+  for (int i = 1; i < size; i++) {
+    displs[i] = displs[i - 1] + counts[i - 1];
+  }
+
+  struct timespec start_time, broadcast_time, gathered_time;
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  // The viewport of rank 0 is the one everybody renders
+  MPI_Bcast(&viewport, 1, mpi_payload_datatype(), 0, MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &broadcast_time);
+
+  int *values = NULL;
+  int *gathered = NULL;
+  double compute_time = 0;
+  if (rank == 0) {
+    gathered = malloc((size_t)length * tile_values * sizeof(int));
+    if (gathered == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  } else {
+    values = malloc(((size_t)counts[rank] + 1) * sizeof(int));
+    if (values == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    batch_compute(&viewport, block, rank, workers, values, &compute_time);
+  }
+
+  MPI_Gatherv(values, counts[rank], MPI_INT,
+              gathered, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &gathered_time);
+
+  double *compute_times = NULL;
+  if (rank == 0) {
+    compute_times = malloc(size * sizeof(double));
+    if (compute_times == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  MPI_Gather(&compute_time, 1, MPI_DOUBLE, compute_times, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    int width = viewport.s_ur.x - viewport.s_ll.x;
+    int height = viewport.s_ur.y - viewport.s_ll.y;
+    int *frame = malloc((size_t)width * height * sizeof(int));
+    if (frame == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    // Offline, the frame fills the persistent tile store for later runs
+    bool store = options->tile_store[0] != '\0';
+    if (store && tilestore_open(options->tile_store, (size_t)options->tile_store_size << 20) < 0) {
+      store = false;
+    }
+    batch_assemble(&viewport, block, workers, gathered, displs, frame, store);
+
+    // Imbalance as max / mean of the compute time of the workers
+    double max_time = 0, sum_time = 0;
+    for (int i = 1; i < size; i++) {
+      sum_time += compute_times[i];
+      if (compute_times[i] > max_time) max_time = compute_times[i];
+    }
+    double imbalance = (sum_time > 0) ? max_time / (sum_time / workers) : 1;
+
+    long long total_iterations = 0;
+    for (long long i = 0; i < (long long)width * height; i++) {
+      total_iterations += frame[i];
+    }
+    printf("Batch frame of %dx%d pixels in %d tiles (blocks of %d): %lld iterations, %.9f s, imbalance %.3f\n",
+           width, height, length, block, total_iterations,
+           timespec_to_double(timespec_diff(start_time, gathered_time)), imbalance);
+
+#if LOG_LEVEL >= LOG_BASIC
+    fprintf(coordinator_log, "[DISCRETIZED]: %.9f\n",
+            timespec_to_double(timespec_diff(start_time, broadcast_time)));
+    fprintf(coordinator_log, "[MPI_RECV_ALL]: %.9f\n",
+            timespec_to_double(timespec_diff(start_time, gathered_time)));
+    fprintf(coordinator_log, "[BATCH_IMBALANCE]: %.9f\n", imbalance);
+    if (store) {
+      fprintf(coordinator_log, "[STORE_TILES]: %d\n", tilestore_stats().tiles);
+    }
+    fclose(coordinator_log);
+#endif
+    if (store) {
+      tilestore_close();
+    }
+    free(frame);
+  }
+
+  free(compute_times);
+  free(gathered);
+  free(values);
+  free(counts);
+  free(displs);
+  return 0;
+}
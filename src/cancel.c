@@ -0,0 +1,61 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <mpi.h>
+#include "cancel.h"
+
+static MPI_Win window = MPI_WIN_NULL;
+static int *latest = NULL; // the generation rank 0 published last
+static int rank, world_size;
+
+void cancel_init (void)
+{
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  MPI_Aint size = (rank == 0) ? 0 : sizeof(int);
+  MPI_Win_allocate(size, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &latest, &window);
+  if (rank != 0) {
+    *latest = -1; // no generation yet
+  }
+  MPI_Barrier(MPI_COMM_WORLD); // no access before every window is initialized
+  // One passive epoch for the whole run, accesses are atomic operations
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+}
+
+void cancel_finalize (void)
+{
+  MPI_Win_unlock_all(window);
+  MPI_Win_free(&window);
+  latest = NULL;
+}
+
+void cancel_publish (int generation)
+{
+  for (int i = 1; i < world_size; i++) {
+    MPI_Accumulate(&generation, 1, MPI_INT, i, 0, 1, MPI_INT, MPI_REPLACE, window);
+  }
+  // Completed before any tile of this generation leaves rank 0
+  MPI_Win_flush_all(window);
+}
+
+bool cancel_is_stale (const payload_t *payload)
+{
+  int generation;
+  MPI_Fetch_and_op(NULL, &generation, MPI_INT, rank, 0, MPI_NO_OP, window);
+  MPI_Win_flush(rank, window);
+  return payload->generation != generation;
+}
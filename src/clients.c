@@ -0,0 +1,403 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "queue.h"
+#include "clients.h"
+#include "framebuffer.h"
+
+typedef struct {
+  int fd; // -1 for a free slot
+  int generation; // unique generation of its newest payload, -1 before one
+  int client_generation; // what the client called that payload
+  queue_t responses; // ready to be written
+  // the payload being received
+  payload_t incoming;
+  size_t incoming_bytes;
+  // the response being written, its header then its values
+  response_t *outgoing;
+  response_t header;
+  const char *values;
+  size_t values_size;
+  size_t outgoing_bytes;
+  bool writable; // waiting for EPOLLOUT
+} client_t;
+
+// Guards the generations and the response queues of the clients, the
+// rest of client_t belongs to the thread of clients_serve
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static client_t *clients = NULL;
+static int max_clients = 0;
+static int connected = 0;
+static int next_generation = 0;
+static int epoll_fd = -1;
+static int wake_fd = -1; // eventfd, written when responses are queued
+
+void clients_init (int count)
+{
+  max_clients = count;
+  clients = calloc(max_clients, sizeof(client_t));
+  if (clients == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  for (int i = 0; i < max_clients; i++) {
+    clients[i].fd = -1;
+    clients[i].generation = -1;
+    queue_init(&clients[i].responses, 256, framebuffer_free_response);
+  }
+}
+
+void clients_finalize (void)
+{
+  for (int i = 0; i < max_clients; i++) {
+    queue_destroy(&clients[i].responses);
+  }
+  free(clients);
+  clients = NULL;
+  max_clients = 0;
+}
+
+/* client whose newest payload is generation, or -1. Mutex held. */
+static int owner (int generation)
+{
+  for (int i = 0; i < max_clients; i++) {
+    if (clients[i].fd >= 0 && clients[i].generation == generation) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool clients_current (const payload_t *payload)
+{
+  pthread_mutex_lock(&mutex);
+  bool current = owner(payload->generation) >= 0;
+  pthread_mutex_unlock(&mutex);
+  return current;
+}
+
+void clients_interleave (payload_t **tiles, int count)
+{
+  // Tiles of no current generation go last, in a bucket of their own
+  int buckets = max_clients + 1;
+  int *owners = malloc(count * sizeof(int));
+  int *start = calloc(buckets + 1, sizeof(int));
+  int *taken = calloc(buckets, sizeof(int));
+  payload_t **sorted = malloc(count * sizeof(payload_t*));
+  if ((count > 0 && (owners == NULL || sorted == NULL)) || start == NULL || taken == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  pthread_mutex_lock(&mutex);
+  for (int i = 0; i < count; i++) {
+    owners[i] = owner(tiles[i]->generation);
+    if (owners[i] < 0) owners[i] = max_clients;
+    start[owners[i] + 1]++;
+  }
+  pthread_mutex_unlock(&mutex);
+
+  // counting sort by client, stable
+  for (int b = 0; b < buckets; b++) {
+    start[b + 1] += start[b];
+  }
+  for (int i = 0; i < count; i++) {
+    sorted[start[owners[i]] + taken[owners[i]]++] = tiles[i];
+  }
+
+  // then one tile of every client in turn
+  memset(taken, 0, buckets * sizeof(int));
+  int out = 0;
+  while (out < count) {
+    for (int b = 0; b < buckets; b++) {
+      if (start[b] + taken[b] < start[b + 1]) {
+        tiles[out++] = sorted[start[b] + taken[b]++];
+      }
+    }
+  }
+
+  free(owners);
+  free(start);
+  free(taken);
+  free(sorted);
+}
+
+void clients_deliver (response_t *response)
+{
+  pthread_mutex_lock(&mutex);
+  int c = owner(response->payload.generation);
+  if (c < 0) {
+    pthread_mutex_unlock(&mutex);
+    framebuffer_free_response(response);
+    return;
+  }
+  response->payload.generation = clients[c].client_generation;
+  queue_enqueue(&clients[c].responses, response);
+  pthread_mutex_unlock(&mutex);
+
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("Error waking up the client thread");
+  }
+}
+
+static void watch (int fd, uint32_t id, uint32_t events, int operation)
+{
+  struct epoll_event event = { .events = events, .data.u32 = id };
+  if (epoll_ctl(epoll_fd, operation, fd, &event) < 0) {
+    perror("Error on epoll_ctl");
+    exit(1);
+  }
+}
+
+static void accept_client (int socket)
+{
+  int fd = accept4(socket, NULL, NULL, SOCK_NONBLOCK);
+  if (fd < 0) {
+    return; // the client gave up meanwhile
+  }
+  int c = 0;
+  while (c < max_clients && clients[c].fd >= 0) c++;
+  if (c == max_clients) {
+    printf("Refused client connection, %d clients connected.\n", connected);
+    close(fd);
+    return;
+  }
+
+  client_t *client = &clients[c];
+  client->incoming_bytes = 0;
+  client->outgoing = NULL;
+  client->writable = false;
+  pthread_mutex_lock(&mutex);
+  client->fd = fd;
+  client->generation = -1;
+  connected++;
+  pthread_mutex_unlock(&mutex);
+  watch(fd, c, EPOLLIN, EPOLL_CTL_ADD);
+  printf("Accepted client connection %d.\n", c);
+}
+
+static void disconnect (int c)
+{
+  client_t *client = &clients[c];
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  pthread_mutex_lock(&mutex);
+  client->fd = -1;
+  client->generation = -1; // its tiles are obsolete now
+  queue_clear(&client->responses);
+  connected--;
+  pthread_mutex_unlock(&mutex);
+  if (client->outgoing != NULL) {
+    framebuffer_free_response(client->outgoing);
+    client->outgoing = NULL;
+  }
+  printf("Client connection %d lost.\n", c);
+}
+
+/* read what arrived of the payloads of client. Returns 1 if it asks
+   for a shutdown, -1 once it is gone, 0 otherwise. */
+static int receive (client_t *client, void (*submit)(payload_t *payload))
+{
+  while (1) {
+    ssize_t r = recv(client->fd, (char *)&client->incoming + client->incoming_bytes,
+                     sizeof(payload_t) - client->incoming_bytes, 0);
+    if (r == 0) {
+      return -1;
+    }
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    client->incoming_bytes += r;
+    if (client->incoming_bytes < sizeof(payload_t)) {
+      continue;
+    }
+    client->incoming_bytes = 0;
+
+#ifdef PAYLOAD_DEBUG
+    payload_print(__func__, "received payload", &client->incoming);
+#endif
+
+    if (client->incoming.generation == PAYLOAD_GENERATION_SHUTDOWN) {
+      return 1;
+    }
+    if (client->incoming.hint) {
+      continue; // --hints follows a single client
+    }
+
+    payload_t *payload = malloc(sizeof(payload_t));
+    if (payload == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    *payload = client->incoming;
+    pthread_mutex_lock(&mutex);
+    client->client_generation = payload->generation;
+    payload->generation = next_generation++;
+    client->generation = payload->generation;
+    pthread_mutex_unlock(&mutex);
+    submit(payload);
+  }
+}
+
+static void want_writable (int c, bool writable)
+{
+  if (clients[c].writable != writable) {
+    clients[c].writable = writable;
+    watch(clients[c].fd, c, writable ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+  }
+}
+
+/* write the queued responses of client c until its socket is full.
+   Returns -1 once it is gone, 0 otherwise. */
+static int flush (int c, void (*sent)(const response_t *response, size_t bytes))
+{
+  client_t *client = &clients[c];
+  while (1) {
+    if (client->outgoing == NULL) {
+      client->outgoing = (response_t *)queue_try_dequeue(&client->responses);
+      if (client->outgoing == NULL) {
+        break;
+      }
+      // Values travel as the workers sent them, encoded or plain ints
+      client->header = *client->outgoing;
+      if (client->outgoing->encoded_size > 0) {
+        client->values = (const char *)client->outgoing->encoded;
+        client->values_size = client->outgoing->encoded_size;
+      } else {
+        client->header.encoded_size = 0;
+        client->values = (const char *)client->outgoing->values;
+        client->values_size = client->outgoing->payload.granularity *
+          client->outgoing->payload.granularity * sizeof(int);
+      }
+      client->outgoing_bytes = 0;
+    }
+
+    size_t total = sizeof(response_t) + client->values_size;
+    while (client->outgoing_bytes < total) {
+      const char *from;
+      size_t left;
+      if (client->outgoing_bytes < sizeof(response_t)) {
+        from = (const char *)&client->header + client->outgoing_bytes;
+        left = sizeof(response_t) - client->outgoing_bytes;
+      } else {
+        from = client->values + (client->outgoing_bytes - sizeof(response_t));
+        left = total - client->outgoing_bytes;
+      }
+      ssize_t w = send(client->fd, from, left, MSG_NOSIGNAL);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          want_writable(c, true); // go on once the client has read some
+          return 0;
+        }
+        return -1;
+      }
+      client->outgoing_bytes += w;
+    }
+
+    sent(client->outgoing, client->values_size);
+    framebuffer_free_response(client->outgoing);
+    client->outgoing = NULL;
+  }
+  want_writable(c, false);
+  return 0;
+}
+
+void clients_serve (int socket,
+                    void (*submit)(payload_t *payload),
+                    void (*sent)(const response_t *response, size_t bytes))
+{
+  uint32_t listen_id = max_clients, wake_id = max_clients + 1;
+  epoll_fd = epoll_create1(0);
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  if (epoll_fd < 0 || wake_fd < 0) {
+    perror("Error creating the client event loop");
+    exit(1);
+  }
+  watch(socket, listen_id, EPOLLIN, EPOLL_CTL_ADD);
+  watch(wake_fd, wake_id, EPOLLIN, EPOLL_CTL_ADD);
+
+  struct epoll_event events[CLIENTS_EVENTS];
+  bool done = false;
+  while (!done) {
+    int n = epoll_wait(epoll_fd, events, CLIENTS_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("Error on epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n && !done; i++) {
+      uint32_t id = events[i].data.u32;
+      if (id == listen_id) {
+        accept_client(socket);
+        continue;
+      }
+      if (id == wake_id) {
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+          perror("Error reading the eventfd");
+        }
+        for (int c = 0; c < max_clients; c++) {
+          if (clients[c].fd >= 0 && flush(c, sent) < 0) {
+            disconnect(c);
+          }
+        }
+        continue;
+      }
+
+      if (clients[id].fd < 0) {
+        continue; // left earlier in this round
+      }
+      int status = 0;
+      if (events[i].events & EPOLLIN) {
+        status = receive(&clients[id], submit);
+      }
+      if (status == 0 && (events[i].events & EPOLLOUT)) {
+        status = flush(id, sent);
+      }
+      if (status == 0 && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+        status = -1;
+      }
+      if (status == 1 && connected == 1) {
+        done = true; // the last client is done, so are we
+      } else if (status != 0) {
+        disconnect(id);
+      }
+    }
+  }
+
+  for (int c = 0; c < max_clients; c++) {
+    if (clients[c].fd >= 0) {
+      disconnect(c);
+    }
+  }
+  close(wake_fd);
+  close(epoll_fd);
+}
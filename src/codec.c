@@ -0,0 +1,215 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "codec.h"
+
+static int value_width (int max)
+{
+  if (max < (1 << 8)) return 1;
+  if (max < (1 << 16)) return 2;
+  return 4;
+}
+
+static int varint_size (unsigned int value)
+{
+  int size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static unsigned char *put_varint (unsigned char *p, unsigned int value)
+{
+  while (value >= 0x80) {
+    *p++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (unsigned char)value;
+  return p;
+}
+
+static unsigned char *put_value (unsigned char *p, int value, int width)
+{
+  // values are iteration counts, never negative
+  unsigned int v = (unsigned int)value;
+  for (int i = 0; i < width; i++) {
+    *p++ = (unsigned char)(v >> (8 * i));
+  }
+  return p;
+}
+
+static int get_value (const unsigned char *p, int width)
+{
+  unsigned int v = 0;
+  for (int i = 0; i < width; i++) {
+    v |= (unsigned int)p[i] << (8 * i);
+  }
+  return (int)v;
+}
+
+int codec_encode (const int *values, int width, int height, unsigned char **encoded)
+{
+  int n = width * height;
+  int max = 0;
+  bool solid = true;
+  for (int i = 0; i < n; i++) {
+    if (values[i] > max) max = values[i];
+    if (values[i] != values[0]) solid = false;
+  }
+  int w = value_width(max);
+
+  // Size of every kind, to keep the smallest one
+  int size;
+  int kind;
+  if (solid) {
+    kind = CODEC_SOLID;
+    size = 2 + w;
+  } else {
+    int rle_size = 2;
+    for (int y = 0; y < height; y++) {
+      const int *row = values + y * width;
+      for (int x = 0; x < width; ) {
+	int run = 1;
+	while (x + run < width && row[x + run] == row[x]) run++;
+	rle_size += varint_size(run) + w;
+	x += run;
+      }
+    }
+    int packed_size = 2 + n * w;
+    kind = (rle_size < packed_size) ? CODEC_RLE : CODEC_PACKED;
+    size = (rle_size < packed_size) ? rle_size : packed_size;
+  }
+
+  unsigned char *buffer = malloc(size);
+  if (buffer == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  unsigned char *p = buffer;
+  *p++ = (unsigned char)kind;
+  *p++ = (unsigned char)w;
+  switch (kind) {
+  case CODEC_SOLID:
+    p = put_value(p, n > 0 ? values[0] : 0, w);
+    break;
+  case CODEC_PACKED:
+    for (int i = 0; i < n; i++) {
+      p = put_value(p, values[i], w);
+    }
+    break;
+  case CODEC_RLE:
+    for (int y = 0; y < height; y++) {
+      const int *row = values + y * width;
+      for (int x = 0; x < width; ) {
+	int run = 1;
+	while (x + run < width && row[x + run] == row[x]) run++;
+	p = put_varint(p, run);
+	p = put_value(p, row[x], w);
+	x += run;
+      }
+    }
+    break;
+  }
+  *encoded = buffer;
+  return size;
+}
+
+int codec_decode (const unsigned char *encoded, int size, int *values, int width, int height)
+{
+  int n = width * height;
+  if (size < 2) return -1;
+  int kind = encoded[0];
+  int w = encoded[1];
+  if (w != 1 && w != 2 && w != 4) return -1;
+  const unsigned char *p = encoded + 2;
+  const unsigned char *end = encoded + size;
+
+  switch (kind) {
+  case CODEC_SOLID: {
+    if (end - p < w) return -1;
+    int value = get_value(p, w);
+    for (int i = 0; i < n; i++) {
+      values[i] = value;
+    }
+    return 0;
+  }
+  case CODEC_PACKED:
+    if (end - p < (long)n * w) return -1;
+    for (int i = 0; i < n; i++, p += w) {
+      values[i] = get_value(p, w);
+    }
+    return 0;
+  case CODEC_RLE:
+    for (int i = 0; i < n; ) {
+      unsigned int run = 0;
+      int shift = 0;
+      do {
+	if (p == end || shift > 28) return -1;
+	run |= (unsigned int)(*p & 0x7f) << shift;
+	shift += 7;
+      } while (*p++ & 0x80);
+      if (end - p < w || run == 0 || run > (unsigned int)(n - i)) return -1;
+      int value = get_value(p, w);
+      p += w;
+      for (unsigned int j = 0; j < run; j++) {
+	values[i++] = value;
+      }
+    }
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+void response_encode (response_t *response)
+{
+  int g = response->payload.granularity;
+  response->encoded_size = codec_encode(response->values, g, g, &response->encoded);
+  free(response->values);
+  response->values = NULL;
+}
+
+int response_decode (response_t *response)
+{
+  int g = response->payload.granularity;
+  response->values = malloc(g * g * sizeof(int));
+  if (response->values == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  int ret = codec_decode(response->encoded, response->encoded_size, response->values, g, g);
+  free(response->encoded);
+  response->encoded = NULL;
+  response->encoded_size = 0;
+  return ret;
+}
+
+int response_values_size (const response_t *response)
+{
+  if (response->encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+    return 0;
+  }
+  if (response->encoded_size > 0) {
+    return response->encoded_size;
+  }
+  return response->payload.granularity * response->payload.granularity * sizeof(int);
+}
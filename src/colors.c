@@ -31,26 +31,6 @@ static Color linear_interpolation(Color c1, Color c2, double alpha) {
   return c;
 }
 
-// Normalizes depth to [0, 1] range linearly
-static double norm_linear(int depth, int max_depth){
-  return (double)depth / max_depth;
-}
-
-// Normalizes depth to [0, 1] range scaled with a power function (depth/k)^n
-// 256 and 1/e were chosen as balanced values, adjustment is possible
-// First full cycle happens at depth 256, then slows down gradually so that colors
-// keep stably looping as depth increases. The effect of this is as the depth increases, 
-// the color palette loops, more often initially then tapering off.
-static double norm_power_cycle(int depth, int max_depth) {
-  ++max_depth; // unused
-  return fmod(pow(depth / 256.0, (1.0 / 2.71828)), 1.0);
-}
-
-static double norm_log_cycle(int depth, int max_depth) {
-  ++max_depth; // unused
-  return fmod(log(depth / 256.0 + 1), 1.0);
-}
-
 // Functions below should be able to accept values outside [0, 1] range, but not tested
 
 // Maps to rainbow colors using sine wave
@@ -120,22 +100,47 @@ static Color get_color(int depth, int max_depth, normalize_fn normalize_fn, colo
   return color_fn(t);
 }
 
-// TODO: histogram coloring/other possibilities?
-Color get_current_pallette_color(int current_color, int depth, int max_depth){
+/* the normalizer and the coloring function of a palette */
+static void pallette_functions(int current_color, int *normalizer, color_fn *color) {
   switch (current_color) {
-    case 0:  return get_color(depth, max_depth, norm_linear, color_sine);
-    case 1:  return get_color(depth, max_depth, norm_power_cycle, color_sine);
-    case 2:  return get_color(depth, max_depth, norm_log_cycle, color_sine);
-  
-    case 3:  return get_color(depth, max_depth, norm_linear, color_viridis);
-    case 4:  return get_color(depth, max_depth, norm_power_cycle, color_viridis_mirrored);
-    case 5:  return get_color(depth, max_depth, norm_log_cycle, color_viridis_mirrored);
-  
-    case 6:  return get_color(depth, max_depth, norm_linear, color_linear_grayscale);
-    case 7:  return get_color(depth, max_depth, norm_power_cycle, color_linear_grayscale_mirrored);
-    case 8:  return get_color(depth, max_depth, norm_log_cycle, color_linear_grayscale_mirrored);
-
-    default: return get_color(depth, max_depth, norm_linear, color_sine);
+    case 0:  *normalizer = NORMALIZE_LINEAR;      *color = color_sine; break;
+    case 1:  *normalizer = NORMALIZE_POWER_CYCLE; *color = color_sine; break;
+    case 2:  *normalizer = NORMALIZE_LOG_CYCLE;   *color = color_sine; break;
+
+    case 3:  *normalizer = NORMALIZE_LINEAR;      *color = color_viridis; break;
+    case 4:  *normalizer = NORMALIZE_POWER_CYCLE; *color = color_viridis_mirrored; break;
+    case 5:  *normalizer = NORMALIZE_LOG_CYCLE;   *color = color_viridis_mirrored; break;
+
+    case 6:  *normalizer = NORMALIZE_LINEAR;      *color = color_linear_grayscale; break;
+    case 7:  *normalizer = NORMALIZE_POWER_CYCLE; *color = color_linear_grayscale_mirrored; break;
+    case 8:  *normalizer = NORMALIZE_LOG_CYCLE;   *color = color_linear_grayscale_mirrored; break;
+
+    default: *normalizer = NORMALIZE_LINEAR;      *color = color_sine; break;
   }
 }
 
+// TODO: histogram coloring/other possibilities?
+Color get_current_pallette_color(int current_color, int depth, int max_depth){
+  int normalizer;
+  color_fn color;
+  pallette_functions(current_color, &normalizer, &color);
+  return get_color(depth, max_depth, normalize_get(normalizer), color);
+}
+
+int get_pallette_normalizer(int current_color){
+  int normalizer;
+  color_fn color;
+  pallette_functions(current_color, &normalizer, &color);
+  return normalizer;
+}
+
+// Indexes were normalized by whoever computed them, only the coloring is left
+void get_pallette_lut(int current_color, Color lut[256]){
+  int normalizer;
+  color_fn color;
+  pallette_functions(current_color, &normalizer, &color);
+  for (int i = 0; i < PALETTE_INSIDE; i++) {
+    lut[i] = color((i + 0.5) / PALETTE_INSIDE);
+  }
+  lut[PALETTE_INSIDE] = (Color){0, 0, 0, 255};
+}
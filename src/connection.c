@@ -83,7 +83,7 @@ int open_server_socket(uint16_t port) {
     exit(1);
   }
 
-  if (listen(server_fd, 1) < 0) { // connection buffer size 1, should be fine
+  if (listen(server_fd, CONNECTION_BACKLOG) < 0) { // several clients may connect at once
     perror("Error listening.\n");
     exit(1);
   }
@@ -25,16 +25,47 @@ along with "Fractal @ PCAD". If not, see
 #include <pthread.h>
 #include <mpi.h>
 #include <sys/time.h>
+#include <time.h>
 #include <signal.h>
 #include <stdatomic.h>
-#include <errno.h>
-#include <sys/stat.h>
 #include "fractal.h"
 #include "connection.h"
 #include "queue.h"
 #include "mpi_comm.h"
 #include "timing.h"
 #include "logging.h"
+#include "options.h"
+#include "worker.h"
+#include "dispatch_rma.h"
+#include "hierarchy.h"
+#include "dispatch_steal.h"
+#include "cancel.h"
+#include "codec.h"
+#include "normalize.h"
+#include "framebuffer.h"
+#include "batch.h"
+#include "animate.h"
+#include "speculate.h"
+#include "split.h"
+#include "throughput.h"
+#include "schedule.h"
+#include "local.h"
+#include "placement.h"
+#include "granularity.h"
+#include "deadline.h"
+#include "clients.h"
+#include "tilecache.h"
+#include "tiledir.h"
+#include "reuse.h"
+#include "tilestore.h"
+
+static options_t options;
+
+/* tiles may be cut in pieces that rank 0 puts back together, see split.h */
+static bool tiles_may_split(void)
+{
+  return options.split || options.throughput;
+}
 
 static atomic_int shutdown_requested = ATOMIC_VAR_INIT(0);
 
@@ -43,6 +74,10 @@ static payload_t *newest_payload = NULL;
 static atomic_int latest_generation = ATOMIC_VAR_INIT(-1);
 static pthread_mutex_t newest_payload_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t new_payload = PTHREAD_COND_INITIALIZER;
+// With --hints, the last selection box the client hinted at, same mutex
+static payload_t *newest_hint = NULL;
+// With --clients, every payload of every client instead (see clients.h)
+static queue_t client_payload_queue;
 
 // Discretized payloads to the workers
 static queue_t payload_to_workers_queue;
@@ -63,8 +98,26 @@ static struct timespec last_response_received_time;
 int expected_payloads;
 int responses_received_from_workers = 0;
 int payloads_sent_to_workers = 0;
+int split_payloads = 0; // pieces sent on top of expected_payloads (split.h, reuse.h)
+int chunks_sent_to_workers = 0; // messages that carried the tiles
+int tiles_computed_locally = 0; // by rank 0 itself, see local.h
+int local_backoffs = 0;
+int superseded_responses = 0; // rougher than what the client has, see deadline.h
+int cached_responses = 0; // answered from the tile cache, see tilecache.h
+int tiles_fetched = 0; // sent to the worker that holds them, see tiledir.h
+int reused_responses = 0; // copied from the previous frame, see reuse.h
+int stored_responses = 0; // lent by the persistent tile store, see tilestore.h
+int hint_responses = 0; // hint tiles computed into the tile cache since the last payload
 int responses_sent_to_client = 0;
+long long bytes_sent_to_client = 0; // values only, headers excluded
+long long pixels_sent_to_client = 0;
 #endif
+// Orders the counts of the send thread and of the local compute thread
+static pthread_mutex_t handed_out_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Tiles go straight to the worker that holds them (see tiledir.h),
+// until the workers are told to shut down
+static pthread_mutex_t fetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool fetch_closed = false;
 
 /* Shutdown function. Shuts down the TCP connection and sends "poison pills" to queues.*/
 void request_shutdown(int connection){
@@ -77,12 +130,15 @@ void request_shutdown(int connection){
   // Send "poison pills" to queues, making threads dequeuing them quit
   queue_enqueue(&payload_to_workers_queue, NULL);
   queue_enqueue(&response_queue, NULL);
+  queue_enqueue(&client_payload_queue, NULL);
   // Signal compute_create_blocks to stop waiting for new payloads
   pthread_mutex_lock(&newest_payload_mutex);
   if (newest_payload != NULL) {
     free(newest_payload);
     newest_payload = NULL; // Ownership transferred to queue
   }
+  free(newest_hint);
+  newest_hint = NULL;
   pthread_cond_signal(&new_payload);
   pthread_mutex_unlock(&newest_payload_mutex);
 }
@@ -127,12 +183,33 @@ void *net_thread_receive_payload(void *arg)
       break;
     }
 
+    // A hint neither cancels nor replaces the real payload, it waits
+    // for the workers to be idle under the current generation
+    if (payload->hint) {
+      if (!options.hints || atomic_load(&latest_generation) < 0) {
+        free(payload);
+        continue;
+      }
+      pthread_mutex_lock(&newest_payload_mutex);
+      free(newest_hint);
+      payload->generation = atomic_load(&latest_generation);
+      newest_hint = payload;
+      pthread_cond_signal(&new_payload);
+      pthread_mutex_unlock(&newest_payload_mutex);
+      continue;
+    }
+
+    // Workers abandon the tiles they compute for older generations
+    cancel_publish(payload->generation);
+
     pthread_mutex_lock(&newest_payload_mutex);
     // Checking if there's a previous payload that hasn't been used in compute_create_blocks yet
     if (newest_payload != NULL) {
       free(newest_payload);
     }
     newest_payload = payload; // Update newest payload, signal compute_create_blocks
+    free(newest_hint); // it was a hint on the previous screen
+    newest_hint = NULL;
     atomic_store(&latest_generation, payload->generation);
     payload = NULL;
     pthread_cond_signal(&new_payload);
@@ -142,46 +219,373 @@ void *net_thread_receive_payload(void *arg)
 }
 
 /*
-  compute_create_blocks: after being signaled, this thread discretizes
-  the newest payload so we have numerous blocks to compute. The
-  "sub-blocks" will be queued in the =payload_to_workers_queue= so our
-  mpi thread can distribute them accordingly to the workers.
+  enqueue_among_clients: with --clients, the tiles of a generation are
+  queued among those of the other clients, one client after the other,
+  and the queued tiles of generations replaced meanwhile are dropped.
 */
-void *compute_create_blocks()
+static void enqueue_among_clients(payload_t **tiles, int count)
 {
-  while(!atomic_load(&shutdown_requested)) {
-    pthread_mutex_lock(&newest_payload_mutex);
-    while (newest_payload == NULL && !atomic_load(&shutdown_requested)) { // Wait for new payload to arrive
-      pthread_cond_wait(&new_payload, &newest_payload_mutex);
+  // Only this thread queues tiles, the queue may only shrink meanwhile
+  size_t queued = queue_size(&payload_to_workers_queue);
+  payload_t **all = malloc((queued + count) * sizeof(payload_t*));
+  if (all == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  int length = 0;
+  payload_t *tile;
+  for (size_t taken = 0; taken < queued; taken++) {
+    tile = (payload_t *)queue_try_dequeue_keep(&payload_to_workers_queue, 0);
+    if (tile == NULL) {
+      break;
     }
-    if (atomic_load(&shutdown_requested)) {
-      pthread_mutex_unlock(&newest_payload_mutex);
-      pthread_exit(NULL);
+    if (clients_current(tile)) {
+      all[length++] = tile;
+    } else {
+      free(tile);
     }
+  }
+  for (int i = 0; i < count; i++) {
+    all[length++] = tiles[i];
+    tiles[i] = NULL; //transfer ownership to the queue
+  }
 
+  clients_interleave(all, length);
+  for (int i = 0; i < length; i++) {
+    queue_enqueue(&payload_to_workers_queue, all[i]);
+  }
+  free(all);
+}
+
+static void forward_response(response_t *response);
+static void answer_from_cache(response_t *response);
+
+/*
+  fetch_from_holders: with --worker-cache, the tiles a worker holds in
+  its memory are sent to it right away, behind the tiles it has to
+  drop, instead of being queued. The others are moved to the front of
+  tiles, returns their number.
+*/
+static int fetch_from_holders(payload_t **tiles, int length)
+{
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  payload_t *chunks = malloc(world_size * SCHEDULE_MAX_CHUNK * sizeof(payload_t));
+  int *counts = calloc(world_size, sizeof(int));
+  if (chunks == NULL || counts == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  int kept = 0, fetched = 0;
+  pthread_mutex_lock(&fetch_mutex);
+  for (int i = 0; i < length; i++) {
+    int holder = fetch_closed ? -1 : tiledir_holder(tiles[i]);
+    if (holder <= 0) {
+      tiles[kept++] = tiles[i];
+      continue;
+    }
+    payload_t *chunk = &chunks[holder * SCHEDULE_MAX_CHUNK];
+    if (counts[holder] == 0) {
+      counts[holder] = tiledir_evictions(holder, chunk, SCHEDULE_MAX_CHUNK / 2);
+    }
+    chunk[counts[holder]++] = *tiles[i];
+    tiledir_routed(tiles[i]);
+    free(tiles[i]);
+    fetched++;
+    if (counts[holder] == SCHEDULE_MAX_CHUNK) {
+      mpi_cache_fetch_send(chunk, counts[holder], holder, MPI_COMM_WORLD);
+      counts[holder] = 0;
+    }
+  }
+  for (int w = 1; w < world_size; w++) {
+    if (counts[w] > 0) {
+      mpi_cache_fetch_send(&chunks[w * SCHEDULE_MAX_CHUNK], counts[w], w, MPI_COMM_WORLD);
+    }
+  }
+  pthread_mutex_unlock(&fetch_mutex);
+
+#if LOG_LEVEL >= LOG_BASIC
+  pthread_mutex_lock(&handed_out_mutex);
+  payloads_sent_to_workers += fetched;
+  tiles_fetched += fetched;
+  pthread_mutex_unlock(&handed_out_mutex);
+#endif
+  free(chunks);
+  free(counts);
+  return kept;
+}
+
+/*
+  answer_from_frame: with --reuse, the tiles the previous frame covers
+  are answered right away, those it covers in part give way to the
+  pieces of their uncovered strips (see reuse.h). Returns what is left
+  to queue instead of tiles, with its length in *length.
+*/
+static payload_t **answer_from_frame(payload_t **tiles, int *length)
+{
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  payload_t pieces[REUSE_MAX_PIECES];
+  int size = *length, kept = 0;
+  payload_t **ret = malloc((size + 1) * sizeof(payload_t*));
+  if (ret == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < *length; i++) {
+    int count;
+    response_t *response = reuse_tile(tiles[i], pieces, &count);
+    if (response == NULL && count == 0) {
+      ret[kept++] = tiles[i];
+      continue;
+    }
+    free(tiles[i]);
+
+    if (response != NULL) {
+      response->max_worker_id = world_size;
+      response->worker_id = 0;
+      if (response->payload.palette != NORMALIZE_NONE || options.encoding == ENCODING_COMPACT) {
+        response_encode(response); // as a worker would send it
+      }
+#if LOG_LEVEL >= LOG_BASIC
+      pthread_mutex_lock(&handed_out_mutex); // the workers get none of it
+      expected_payloads--;
+      reused_responses++;
+      pthread_mutex_unlock(&handed_out_mutex);
+#endif
+      answer_from_cache(response);
+      continue;
+    }
+
+    size += count - 1;
+    ret = realloc(ret, (size + 1) * sizeof(payload_t*));
+    if (ret == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    for (int p = 0; p < count; p++) {
+      ret[kept] = malloc(sizeof(payload_t));
+      if (ret[kept] == NULL) {
+        fprintf(stderr, "malloc failed.\n");
+        exit(1);
+      }
+      *ret[kept++] = pieces[p];
+    }
+#if LOG_LEVEL >= LOG_BASIC
+    pthread_mutex_lock(&handed_out_mutex); // their tile comes back once
+    split_payloads += count - 1;
+    pthread_mutex_unlock(&handed_out_mutex);
+#endif
+  }
+  free(tiles);
+  *length = kept;
+  return ret;
+}
+
+/* discretize origin into the tiles the workers get, takes ownership */
+static void create_blocks(payload_t *origin)
+{
 #ifdef PAYLOAD_DEBUG
-    payload_print(__func__, "received newest_payload", newest_payload);
+  payload_print(__func__, "received newest_payload", origin);
 #endif
 
-    // new payload, so clear obsolete payloads to workers
+  // new payload, so clear obsolete payloads to workers (those of the
+  // other clients stay, see enqueue_among_clients)
+  if (options.clients == 1) {
     queue_clear(&payload_to_workers_queue);
+  }
 
-    //payload consumer: get the payload, discretize in blocks
-    //Call Ana Laura function
-    int length = 0, i;
-    payload_t **payload_vector = discretize_payload(newest_payload, &length);
+  if (options.auto_granularity || origin->granularity == PAYLOAD_GRANULARITY_AUTO) {
+    int world_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    origin->granularity = granularity_choose(origin, world_size - 1);
+#if LOG_LEVEL >= LOG_BASIC
+    fprintf(coordinator_log, "[GRANULARITY]: %d\n", origin->granularity);
+    fprintf(coordinator_log, "[GRANULARITY_OVERHEAD]: %.9f\n", granularity_overhead());
+#endif
+  }
+
+  // co-located workers compute its tiles into the shared framebuffer
+  framebuffer_publish(origin);
+
+  if (options.speculate) {
+    speculate_reset(origin); // track its tiles before any is sent
+  }
+  if (tiles_may_split()) {
+    split_reset(origin);
+  }
+  if (options.reuse) {
+    reuse_begin(origin); // before any of its tiles is answered
+  }
 
+  if (options.dispatch == DISPATCH_RMA || options.dispatch == DISPATCH_STEAL) {
+    // Workers discretize by themselves, hand over the whole generation
 #if LOG_LEVEL >= LOG_BASIC
     clock_gettime(CLOCK_MONOTONIC, &payload_discretized_time);
     fprintf(coordinator_log, "[DISCRETIZED]: %.9f\n", 
             timespec_to_double(timespec_diff(payload_received_time, payload_discretized_time)));
-    expected_payloads = length;
+    expected_payloads = discretize_length(origin);
     responses_received_from_workers = 0;
     responses_sent_to_client = 0;
-    payloads_sent_to_workers = 0;
+    bytes_sent_to_client = 0;
+    pixels_sent_to_client = 0;
+    chunks_sent_to_workers = 0;
+    tiles_computed_locally = 0;
+    local_backoffs = 0;
+#endif
+    queue_enqueue(&payload_to_workers_queue, origin);
+    return; // Ownership transferred to queue
+  }
+
+  // A latency budget queues a pass that fits it first, then better
+  // ones up to the full quality (see deadline.h)
+  int levels[DEADLINE_LEVELS] = {0};
+  int passes = 1;
+  if (origin->budget_ms > 0) {
+    int world_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    passes = deadline_plan(origin, world_size - 1, levels);
+  }
+
+  //payload consumer: get the payload, discretize in blocks
+  //Call Ana Laura function
+  int length = 0, i, p;
+  payload_t **payload_vectors[DEADLINE_LEVELS];
+  int lengths[DEADLINE_LEVELS];
+  for (p = 0; p < passes; p++) {
+    payload_t pass;
+    deadline_pass(origin, levels[p], &pass);
+    payload_vectors[p] = discretize_payload(&pass, &length);
+    schedule_generation(schedule_policy(&pass, options.schedule),
+                        &pass, payload_vectors[p], length);
+    lengths[p] = length;
+  }
+
+#if LOG_LEVEL >= LOG_BASIC
+  clock_gettime(CLOCK_MONOTONIC, &payload_discretized_time);
+  fprintf(coordinator_log, "[DISCRETIZED]: %.9f\n", 
+          timespec_to_double(timespec_diff(payload_received_time, payload_discretized_time)));
+  expected_payloads = length * passes;
+  responses_received_from_workers = 0;
+  responses_sent_to_client = 0;
+  bytes_sent_to_client = 0;
+  pixels_sent_to_client = 0;
+  payloads_sent_to_workers = 0;
+  split_payloads = 0;
+  chunks_sent_to_workers = 0;
+  tiles_computed_locally = 0;
+  local_backoffs = 0;
+  superseded_responses = 0;
+  cached_responses = 0;
+  tiles_fetched = 0;
+  reused_responses = 0;
+  stored_responses = 0;
+  if (options.hints) {
+    pthread_mutex_lock(&handed_out_mutex);
+    fprintf(coordinator_log, "[HINT_COMPUTED]: %d\n", hint_responses);
+    hint_responses = 0;
+    pthread_mutex_unlock(&handed_out_mutex);
+  }
+  if (origin->budget_ms > 0) {
+    fprintf(coordinator_log, "[DEADLINE_PLANNED]: %d\n", levels[0]);
+  }
+#endif
+
+  // Tiles sent before are answered right away, only the others are queued
+  if (options.tile_cache > 0) {
+    int hits = 0;
+    for (p = 0; p < passes; p++) {
+      int kept = 0;
+      for (i = 0; i < lengths[p]; i++) {
+        response_t *cached = tilecache_lookup(payload_vectors[p][i]);
+        if (cached == NULL) {
+          payload_vectors[p][kept++] = payload_vectors[p][i];
+          continue;
+        }
+        free(payload_vectors[p][i]);
+#if LOG_LEVEL >= LOG_BASIC
+        pthread_mutex_lock(&handed_out_mutex); // the workers get none of them
+        expected_payloads--;
+        cached_responses++;
+        pthread_mutex_unlock(&handed_out_mutex);
+#endif
+        answer_from_cache(cached);
+        hits++;
+      }
+      lengths[p] = kept;
+    }
+#if LOG_LEVEL >= LOG_BASIC
+    tilecache_stats_t stats = tilecache_stats();
+    fprintf(coordinator_log, "[CACHE_HITS]: %d\n", hits);
+    fprintf(coordinator_log, "[CACHE_MISSES]: %d\n", length * passes - hits);
+    fprintf(coordinator_log, "[CACHE_BYTES]: %zu\n", stats.bytes);
+    fprintf(coordinator_log, "[CACHE_LIMIT]: %zu\n", stats.limit);
+    fprintf(coordinator_log, "[CACHE_EVICTIONS]: %lld\n", stats.evictions);
+#endif
+  }
+
+  // Tiles of the persistent store go with values lent from its mapping
+  if (options.tile_store[0] != '\0') {
+    int looked_up = 0, hits = 0;
+    for (p = 0; p < passes; p++) {
+      int kept = 0;
+      looked_up += lengths[p];
+      for (i = 0; i < lengths[p]; i++) {
+        response_t *stored = tilestore_lookup(payload_vectors[p][i]);
+        if (stored == NULL) {
+          payload_vectors[p][kept++] = payload_vectors[p][i];
+          continue;
+        }
+        free(payload_vectors[p][i]);
+#if LOG_LEVEL >= LOG_BASIC
+        pthread_mutex_lock(&handed_out_mutex); // the workers get none of them
+        expected_payloads--;
+        stored_responses++;
+        pthread_mutex_unlock(&handed_out_mutex);
+#endif
+        answer_from_cache(stored);
+        hits++;
+      }
+      lengths[p] = kept;
+    }
+#if LOG_LEVEL >= LOG_BASIC
+    tilestore_stats_t stats = tilestore_stats();
+    fprintf(coordinator_log, "[STORE_HITS]: %d\n", hits);
+    fprintf(coordinator_log, "[STORE_MISSES]: %d\n", looked_up - hits);
+    fprintf(coordinator_log, "[STORE_TILES]: %d\n", stats.tiles);
+    fprintf(coordinator_log, "[STORE_BYTES]: %zu\n", stats.bytes);
+    fprintf(coordinator_log, "[STORE_REFUSED]: %lld\n", stats.refused);
+#endif
+  }
+
+  // Pixels of the previous frame, the full quality pass only
+  if (options.reuse && passes == 1) {
+    payload_vectors[0] = answer_from_frame(payload_vectors[0], &lengths[0]);
+#if LOG_LEVEL >= LOG_BASIC
+    reuse_stats_t stats = reuse_stats();
+    fprintf(coordinator_log, "[REUSE_ANSWERED]: %d\n", stats.answered);
+    fprintf(coordinator_log, "[REUSE_PARTIAL]: %d\n", stats.partial);
+    fprintf(coordinator_log, "[REUSE_PIECES]: %d\n", stats.pieces);
+    fprintf(coordinator_log, "[REUSE_PIXELS]: %lld\n", stats.pixels);
 #endif
+  }
 
-    for (i = 0; i < length; i++){
+  if (options.worker_cache > 0) {
+    for (p = 0; p < passes; p++) {
+      lengths[p] = fetch_from_holders(payload_vectors[p], lengths[p]);
+    }
+  }
+
+  for (p = 0; p < passes; p++) {
+    payload_t **payload_vector = payload_vectors[p];
+    if (options.clients > 1) {
+      enqueue_among_clients(payload_vector, lengths[p]);
+      free(payload_vector);
+      continue;
+    }
+    for (i = 0; i < lengths[p]; i++){
 #ifdef PAYLOAD_DEBUG
       printf("(%d) %s: Enqueueing discretized payload %d\n", payload_vector[i]->generation, __func__, i);
 #endif
@@ -189,69 +593,365 @@ void *compute_create_blocks()
       payload_vector[i] = NULL; //transfer ownership to the queue
     }
     free(payload_vector); //no longer necessary as all members have been queued
-    free(newest_payload);
+  }
+  free(origin);
+}
+
+/*
+  create_hint: queue the tiles of a viewport the client may select next
+  (--hints) behind those of the real payload, in place of the tiles of
+  the previous hint. They keep the generation of the real payload, so
+  the next one cancels them on the workers and drops them from the
+  queue, and their responses only fill the tile cache, where the real
+  payload of the same selection finds them.
+*/
+static void create_hint(payload_t *origin)
+{
+  if (options.auto_granularity || origin->granularity == PAYLOAD_GRANULARITY_AUTO) {
+    int world_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    origin->granularity = granularity_choose(origin, world_size - 1);
+  }
+
+  // Only the full quality pass is kept in the cache
+  int length = 0, kept = 0;
+  payload_t **tiles = discretize_payload(origin, &length);
+  schedule_generation(schedule_policy(origin, options.schedule), origin, tiles, length);
+  for (int i = 0; i < length; i++) {
+    response_t *cached = tilecache_lookup(tiles[i]);
+    if (cached != NULL) {
+      free_response(cached);
+      free(tiles[i]);
+      continue;
+    }
+    tiles[kept++] = tiles[i];
+  }
+
+  // Only this thread queues tiles, the queue may only shrink meanwhile
+  size_t queued = queue_size(&payload_to_workers_queue);
+  payload_t **real = malloc((queued + 1) * sizeof(payload_t*));
+  if (real == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  int count = 0;
+  payload_t *tile;
+  for (size_t taken = 0; taken < queued; taken++) {
+    tile = (payload_t *)queue_try_dequeue_keep(&payload_to_workers_queue, 0);
+    if (tile == NULL) {
+      break;
+    }
+    if (tile->hint) {
+      free(tile);
+    } else {
+      real[count++] = tile;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    queue_enqueue(&payload_to_workers_queue, real[i]);
+  }
+  for (int i = 0; i < kept; i++) {
+    queue_enqueue(&payload_to_workers_queue, tiles[i]);
+  }
+#if LOG_LEVEL >= LOG_BASIC
+  fprintf(coordinator_log, "[HINT_QUEUED]: %d\n", kept);
+#endif
+  free(real);
+  free(tiles);
+  free(origin);
+}
+
+/*
+  compute_create_blocks: after being signaled, this thread discretizes
+  the newest payload so we have numerous blocks to compute. The
+  "sub-blocks" will be queued in the =payload_to_workers_queue= so our
+  mpi thread can distribute them accordingly to the workers.
+*/
+void *compute_create_blocks()
+{
+  while(!atomic_load(&shutdown_requested)) {
+    payload_t *payload;
+    if (options.clients > 1) {
+      payload = (payload_t *)queue_dequeue(&client_payload_queue);
+      if (payload == NULL) { // poison pill
+        break;
+      }
+      if (!clients_current(payload)) { // its client sent a newer one meanwhile
+        free(payload);
+        continue;
+      }
+      create_blocks(payload);
+      continue;
+    }
+
+    pthread_mutex_lock(&newest_payload_mutex);
+    while (newest_payload == NULL && newest_hint == NULL &&
+           !atomic_load(&shutdown_requested)) { // Wait for new payload to arrive
+      pthread_cond_wait(&new_payload, &newest_payload_mutex);
+    }
+    if (atomic_load(&shutdown_requested)) {
+      pthread_mutex_unlock(&newest_payload_mutex);
+      pthread_exit(NULL);
+    }
+    if (newest_payload == NULL) { // a hint, only while no newer payload waits
+      create_hint(newest_hint);
+      newest_hint = NULL;
+      pthread_mutex_unlock(&newest_payload_mutex);
+      continue;
+    }
+    create_blocks(newest_payload); // a hint that came after it waits for the next turn
     newest_payload = NULL; // Ownership transferred to queue
     pthread_mutex_unlock(&newest_payload_mutex);
   }
   pthread_exit(NULL);
 }
 
-void *main_thread_mpi_recv_responses ()
+/*
+  handle_worker_response: account for one computed tile and forward it
+  to the client if it belongs to the generation we are waiting for.
+*/
+static void handle_worker_response(response_t *response)
 {
-  int workers_exited = 0;
-  int num_workers;
-  MPI_Comm_size(MPI_COMM_WORLD, &num_workers);
-  num_workers--;
-
-  while(workers_exited < num_workers) { // wait for all workers to exit
-    int worker;
-    
-    // verify who wants to send us a response
-    MPI_Recv(&worker, 1, MPI_INT,
-	    MPI_ANY_SOURCE, // receive request from any worker
-	    FRACTAL_MPI_RESPONSE_REQUEST,
-	    MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  throughput_update(response);
+  if (response->payload.hint) {
+    // computed while the workers were idle, for when the client selects it
+    tilecache_store(response);
+    if (options.tile_store[0] != '\0') {
+      tilestore_store(response);
+    }
+#if LOG_LEVEL >= LOG_BASIC
+    pthread_mutex_lock(&handed_out_mutex);
+    hint_responses++;
+    pthread_mutex_unlock(&handed_out_mutex);
+#endif
+    free_response(response);
+    return;
+  }
+  if (options.worker_cache > 0) {
+    tiledir_received(response); // its worker keeps it, pieces and duplicates too
+  }
 
-    // receive response from this worker
-    response_t *response = mpi_response_receive (worker);
+  if (tiles_may_split() && split_is_piece(response)) {
+    response = split_collect(response);
+    if (response == NULL) {
+      return; // more pieces of its tile to come
+    }
+    if (response->payload.palette != NORMALIZE_NONE || options.encoding == ENCODING_COMPACT) {
+      response_encode(response); // as the worker would have sent the whole tile
+    }
+  }
 
-    if (response->payload.generation == PAYLOAD_GENERATION_SHUTDOWN) {
-      free(response->values);
-      free(response);
-      workers_exited++;
-      continue;
+  if (options.reuse && reuse_is_piece(response)) {
+    response = reuse_collect(response);
+    if (response == NULL) {
+      return; // more pieces of its tile to come
+    }
+    if (response->payload.palette != NORMALIZE_NONE || options.encoding == ENCODING_COMPACT) {
+      response_encode(response);
     }
+  }
+
+  if (options.speculate && !speculate_received(response)) {
+    free_response(response); // the other copy of this tile was faster
+    return;
+  }
+
+  granularity_received(response);
+  int reached;
+  bool forward = deadline_received(response, &reached);
 
 #if LOG_LEVEL >= LOG_BASIC
-    responses_received_from_workers++;
-    if (responses_received_from_workers == 1) {
-      clock_gettime(CLOCK_MONOTONIC, &first_response_received_time);
-      fprintf(coordinator_log, "[MPI_RECV_FIRST]: %.9f\n", 
-        timespec_to_double(timespec_diff(payload_received_time, first_response_received_time)));
-    } else if (responses_received_from_workers == expected_payloads) {
-      clock_gettime(CLOCK_MONOTONIC, &last_response_received_time);
-      fprintf(coordinator_log, "[MPI_RECV_ALL]: %.9f\n", 
-        timespec_to_double(timespec_diff(payload_received_time, last_response_received_time)));
+  pthread_mutex_lock(&handed_out_mutex); // rank 0 may answer tiles as well
+  responses_received_from_workers++;
+  if (!forward) {
+    superseded_responses++;
+  }
+  if (reached != DEADLINE_PENDING) {
+    fprintf(coordinator_log, "[DEADLINE_QUALITY]: %d\n", reached);
+  }
+  if (responses_received_from_workers == 1) {
+    clock_gettime(CLOCK_MONOTONIC, &first_response_received_time);
+    fprintf(coordinator_log, "[MPI_RECV_FIRST]: %.9f\n", 
+      timespec_to_double(timespec_diff(payload_received_time, first_response_received_time)));
+  } else if (responses_received_from_workers == expected_payloads) {
+    clock_gettime(CLOCK_MONOTONIC, &last_response_received_time);
+    fprintf(coordinator_log, "[MPI_RECV_ALL]: %.9f\n", 
+      timespec_to_double(timespec_diff(payload_received_time, last_response_received_time)));
+    if (options.speculate) {
+      speculate_stats_t stats = speculate_stats();
+      fprintf(coordinator_log, "[SPECULATIVE_COPIES]: %d\n", stats.copies);
+      fprintf(coordinator_log, "[SPECULATIVE_WINS]: %d\n", stats.wins);
+    }
+    fprintf(coordinator_log, "[SCHEDULE_CHUNKS]: %d\n", chunks_sent_to_workers);
+    if (options.local_compute) {
+      fprintf(coordinator_log, "[LOCAL_TILES]: %d\n", tiles_computed_locally);
+      fprintf(coordinator_log, "[LOCAL_BACKOFFS]: %d\n", local_backoffs);
     }
+    if (tiles_may_split()) {
+      fprintf(coordinator_log, "[SPLIT_PIECES]: %d\n", split_payloads);
+    }
+    if (options.worker_cache > 0) {
+      tiledir_stats_t stats = tiledir_stats();
+      fprintf(coordinator_log, "[WORKER_CACHE_FETCHED]: %d\n", tiles_fetched);
+      fprintf(coordinator_log, "[WORKER_CACHE_ROUTED]: %lld\n", stats.routed);
+      fprintf(coordinator_log, "[WORKER_CACHE_TILES]: %d\n", stats.tiles);
+      fprintf(coordinator_log, "[WORKER_CACHE_BYTES]: %zu\n", stats.bytes);
+      fprintf(coordinator_log, "[WORKER_CACHE_EVICTIONS]: %lld\n", stats.evictions);
+    }
+    throughput_log(coordinator_log);
+  }
+  pthread_mutex_unlock(&handed_out_mutex);
 #endif
 
+  if (!forward) {
+    free_response(response); // the client has this tile at a better quality
+    return;
+  }
+
+  if (response->encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+    // Only the header came, the values are where the worker wrote them
+    framebuffer_sync();
+    response->values = framebuffer_lend(&response->payload);
+    if (response->values == NULL) { // the buffer went to a newer generation
+      free_response(response);
+      return;
+    }
+  }
+
+  if (options.tile_cache > 0) {
+    tilecache_store(response);
+  }
+  if (options.tile_store[0] != '\0') {
+    tilestore_store(response);
+  }
+
+  forward_response(response);
+}
+
+/* send response on to its client, unless it is of an obsolete generation */
+static void forward_response(response_t *response)
+{
 #ifdef RESPONSE_DEBUG
-      response_print(__func__, "Enqueueing response", response);
+  response_print(__func__, "Enqueueing response", response);
+#endif
+
+  if (options.reuse) {
+    reuse_record(response); // the next generation may shift this frame
+  }
+
+  // only queue responses that we are waiting for
+  if (options.clients > 1) {
+    clients_deliver(response); // it knows the generations of every client
+  } else if (response->payload.generation == atomic_load(&latest_generation)) {
+    queue_enqueue(&response_queue, response);
+  }else{
+    //response_print(__func__, "Discard response", response);
+    framebuffer_free_response(response);
+  }
+}
+
+/* a tile of the tile cache or of the previous frame (reuse.h), it
+   passes where a worker response would */
+static void answer_from_cache(response_t *response)
+{
+  int reached;
+  bool forward = deadline_received(response, &reached);
+#if LOG_LEVEL >= LOG_BASIC
+  pthread_mutex_lock(&handed_out_mutex);
+  if (!forward) {
+    superseded_responses++;
+  }
+  if (reached != DEADLINE_PENDING) {
+    fprintf(coordinator_log, "[DEADLINE_QUALITY]: %d\n", reached);
+  }
+  pthread_mutex_unlock(&handed_out_mutex);
 #endif
+  if (!forward) {
+    free_response(response);
+    return;
+  }
+  forward_response(response);
+}
+
+void *main_thread_mpi_recv_responses ()
+{
+  int workers_exited = 0;
+  int num_workers;
+  MPI_Comm_size(MPI_COMM_WORLD, &num_workers);
+  num_workers--;
+  if (options.dispatch == DISPATCH_HIERARCHICAL) {
+    hierarchy_leaders(&num_workers); // only leaders talk to us
+  }
 
-    // only queue responses that we are waiting for
-    if (response->payload.generation == atomic_load(&latest_generation)) {
-	    queue_enqueue(&response_queue, response);
-    }else{
-	    //response_print(__func__, "Discard response", response);
-      free(response->values);
-	    free(response);
+  while(workers_exited < num_workers) { // wait for all workers to exit
+    // receive responses from any worker (a batch of them from any leader)
+    int count = 1;
+    response_t *single = NULL;
+    response_t **responses = &single;
+    if (options.dispatch == DISPATCH_HIERARCHICAL) {
+      responses = mpi_response_batch_receive(MPI_ANY_SOURCE, MPI_COMM_WORLD, &count);
+    } else {
+      single = mpi_response_receive(MPI_ANY_SOURCE, MPI_COMM_WORLD);
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (responses[i]->payload.generation == PAYLOAD_GENERATION_SHUTDOWN) {
+        free_response(responses[i]);
+        workers_exited++;
+        continue;
+      }
+      handle_worker_response(responses[i]);
+      responses[i] = NULL; // Transferred ownership to queue
+    }
+    if (responses != &single) {
+      free(responses);
     }
-    response = NULL; // Transferred ownership to queue
   }
   pthread_exit(NULL);
 }
 
+/*
+  split_if_running_out: once fewer tiles than workers are queued,
+  payload is cut in pieces for worker, once with --split and as many
+  times as its throughput requires with --throughput, as long as the
+  pieces are even. The first piece
+  replaces payload, the others are queued behind the last tiles.
+*/
+static void split_if_running_out(payload_t *payload, int worker, int workers)
+{
+  if (!tiles_may_split() || queue_size(&payload_to_workers_queue) >= (size_t)workers) {
+    return;
+  }
+  int cuts = options.split ? 1 : 0;
+  if (options.throughput) {
+    int slow = throughput_cuts(worker);
+    if (slow > cuts) cuts = slow;
+  }
+  for (int cut = 0; cut < cuts; cut++) {
+    if (cut > 0 && payload->granularity % 2 != 0) {
+      return; // the pieces of an odd piece overlap, computing some pixels twice
+    }
+    payload_t pieces[SPLIT_PIECES];
+    int count = split_tile(payload, pieces);
+    if (count == 0) {
+      return;
+    }
+    for (int i = 1; i < count; i++) {
+      payload_t *piece = malloc(sizeof(payload_t));
+      if (piece == NULL) {
+        fprintf(stderr, "malloc failed.\n");
+        exit(1);
+      }
+      *piece = pieces[i];
+      queue_enqueue(&payload_to_workers_queue, piece);
+    }
+    *payload = pieces[0];
+#if LOG_LEVEL >= LOG_BASIC
+    split_payloads += count - 1;
+#endif
+  }
+}
+
 /*
   main_thread_function: distribute discretized payloads to our workers.
 */
@@ -267,44 +967,86 @@ void *main_thread_mpi_send_payloads ()
   done_flag.generation = PAYLOAD_GENERATION_DONE;
 #endif
 
+  payload_t *dequeued[SCHEDULE_MAX_CHUNK];
+  payload_t chunk[SCHEDULE_MAX_CHUNK];
+
   while(1) {
     int worker;
 
-    // Get the payload (the queue-dequeue blocks this thread)
-    payload_t *payload = (payload_t *)queue_dequeue(&payload_to_workers_queue);
-    if (payload == NULL) { // Send shutdown signal to workers if poison pill received
+    // Get the tiles of the next request, as many as the policy wants
+    // (the queue-dequeue blocks this thread until there is one)
+    int wanted = schedule_chunk(queue_size(&payload_to_workers_queue), world_size - 1);
+    int count = queue_dequeue_many(&payload_to_workers_queue, (void **)dequeued, wanted);
+    if (dequeued[0] == NULL) { // Send shutdown signal to workers if poison pill received
+      pthread_mutex_lock(&fetch_mutex);
+      fetch_closed = true; // nothing may follow the shutdown flags
+      pthread_mutex_unlock(&fetch_mutex);
+      // Every worker keeps 1 + prefetch requests outstanding, answer all of them
       for (int i = 1; i < world_size; i++) {
-        MPI_Recv(&worker, 1, MPI_INT,
-	               MPI_ANY_SOURCE,
-	               FRACTAL_MPI_PAYLOAD_REQUEST,
-	               MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        mpi_payload_send(&shutdown_flag, i);
+        for (int j = 0; j <= options.prefetch; j++) {
+          MPI_Recv(&worker, 1, MPI_INT,
+                   i,
+                   FRACTAL_MPI_PAYLOAD_REQUEST,
+                   MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+          mpi_payload_send(&shutdown_flag, i, MPI_COMM_WORLD);
+        }
       }
       pthread_exit(NULL);
     }
 
+    // A worker that already waits tells how fast we dispatch, see local.h
+    int waiting = 0;
+    struct timespec dispatch_start_time, dispatch_end_time;
+    if (options.local_compute) {
+      MPI_Iprobe(MPI_ANY_SOURCE, FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD,
+                 &waiting, MPI_STATUS_IGNORE);
+      clock_gettime(CLOCK_MONOTONIC, &dispatch_start_time);
+    }
+
     // after getting a payload to do, check which worker is available
     MPI_Recv(&worker, 1, MPI_INT,
 	     MPI_ANY_SOURCE, // receive request from any worker
 	     FRACTAL_MPI_PAYLOAD_REQUEST,
 	     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
-    // send the work to this worker
-    mpi_payload_send (payload, worker);
+    if (count == 1) {
+      split_if_running_out(dequeued[0], worker, world_size - 1);
+    }
 
-    // free the payload
-    free(payload);
-    payload = NULL;    
+    // send the work to this worker, after the tiles it has to drop
+    int notices = 0;
+    if (options.worker_cache > 0) {
+      notices = tiledir_evictions(worker, chunk, SCHEDULE_MAX_CHUNK - count);
+    }
+    for (int i = 0; i < count; i++) {
+      chunk[notices + i] = *dequeued[i];
+      free(dequeued[i]);
+      dequeued[i] = NULL;
+    }
+    mpi_payload_chunk_send(chunk, notices + count, worker, MPI_COMM_WORLD);
+    if (waiting) {
+      clock_gettime(CLOCK_MONOTONIC, &dispatch_end_time);
+      local_dispatch_sample(timespec_to_double(timespec_diff(dispatch_start_time, dispatch_end_time)));
+    }
 
 #if LOG_LEVEL >= LOG_BASIC
-    payloads_sent_to_workers++;
-    if (payloads_sent_to_workers == expected_payloads) {
+    int hinted = 0; // hint tiles do not count among those of the generation
+    for (int i = 0; i < count; i++) {
+      hinted += chunk[notices + i].hint != 0;
+    }
+    pthread_mutex_lock(&handed_out_mutex);
+    chunks_sent_to_workers++;
+    payloads_sent_to_workers += count - hinted;
+    bool handed_out = hinted < count && payloads_sent_to_workers + tiles_computed_locally ==
+      expected_payloads + split_payloads;
+    pthread_mutex_unlock(&handed_out_mutex);
+    if (handed_out) {
       for (int i = 1; i < world_size; i++) {
         MPI_Recv(&worker, 1, MPI_INT,
 	        i, // receive request from worker i
 	        FRACTAL_MPI_PAYLOAD_REQUEST,
 	        MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        mpi_payload_send(&done_flag, i); // Signal it to print times
+        mpi_payload_send(&done_flag, i, MPI_COMM_WORLD); // Signal it to print times
       }
     }
 #endif
@@ -313,6 +1055,336 @@ void *main_thread_mpi_send_payloads ()
   pthread_exit(NULL);
 }
 
+/* cancellation of the tiles rank 0 computes, it knows the generation first hand */
+static bool local_is_stale(const payload_t *payload)
+{
+  if (options.clients > 1) {
+    return !clients_current(payload);
+  }
+  return payload->generation != atomic_load(&latest_generation);
+}
+
+/* compute tile on rank 0 and prepare it as a worker would send it,
+   NULL if its generation became obsolete meanwhile */
+static response_t *local_compute(payload_t *tile, int world_size)
+{
+  struct timespec compute_start_time, compute_end_time;
+  clock_gettime(CLOCK_MONOTONIC, &compute_start_time);
+  create_response_return_t result = create_response_for_payload_cancellable(tile, local_is_stale);
+  clock_gettime(CLOCK_MONOTONIC, &compute_end_time);
+  response_t *response = result.response;
+  if (response == NULL) {
+    return NULL;
+  }
+  response->max_worker_id = world_size;
+  response->worker_id = 0;
+  response->compute_time = timespec_to_double(timespec_diff(compute_start_time, compute_end_time));
+  if (response->payload.palette != NORMALIZE_NONE) {
+    response_to_palette(response);
+    response_encode(response);
+  } else if (options.encoding == ENCODING_COMPACT) {
+    response_encode(response);
+  }
+  return response;
+}
+
+/*
+  main_thread_local_compute: with --local-compute, rank 0 takes queued
+  tiles as well, in a thread of the lowest priority, and hands the
+  responses on without MPI. It leaves the last tiles of a generation to
+  the workers, and backs off while it slows down their dispatch (see
+  local.h).
+*/
+void *main_thread_local_compute ()
+{
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  const struct timespec poll_interval = {0, (long)(LOCAL_MIN_BACKOFF * 1e9)};
+  local_lower_priority();
+
+  while(!atomic_load(&shutdown_requested)) {
+    // counted under the lock, so the send thread sees it before the last tile
+    payload_t *tile = NULL;
+    pthread_mutex_lock(&handed_out_mutex);
+    if (local_may_compute()) {
+      tile = (payload_t *)queue_try_dequeue_keep(&payload_to_workers_queue, world_size - 1);
+    }
+#if LOG_LEVEL >= LOG_BASIC
+    if (tile != NULL) {
+      tiles_computed_locally++;
+    }
+#endif
+    pthread_mutex_unlock(&handed_out_mutex);
+    if (tile == NULL) {
+      nanosleep(&poll_interval, NULL); // backing off, or nothing to take
+      continue;
+    }
+
+    local_computing(true);
+    response_t *response = local_compute(tile, world_size);
+    local_computing(false);
+    free(tile);
+    if (response != NULL) {
+      handle_worker_response(response);
+    }
+
+    if (local_tile_done()) {
+#if LOG_LEVEL >= LOG_BASIC
+      local_backoffs++;
+#endif
+    }
+  }
+  pthread_exit(NULL);
+}
+
+/*
+  main_thread_mpi_send_speculative: queue dispatch with --speculate. We
+  collect tile requests as they arrive, so a worker whose requests are
+  all here is known to be idle. While the queue is empty but tiles of
+  the generation are outstanding, idle workers get copies of the
+  oldest of them.
+*/
+void *main_thread_mpi_send_speculative ()
+{
+  payload_t shutdown_flag = {0};
+  shutdown_flag.generation = PAYLOAD_GENERATION_SHUTDOWN;
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  int slots = options.prefetch + 1; // requests every worker keeps outstanding
+  int *requested = calloc(world_size, sizeof(int)); // received, not answered yet
+  if (requested == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  const struct timespec poll_interval = {0, 200000};
+
+#if LOG_LEVEL >= LOG_BASIC
+  payload_t done_flag = {0};
+  done_flag.generation = PAYLOAD_GENERATION_DONE;
+#endif
+
+  while(1) {
+    int worker, pending;
+    MPI_Status status;
+
+    MPI_Iprobe(MPI_ANY_SOURCE, FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, &pending, &status);
+    while (pending) {
+      MPI_Recv(&worker, 1, MPI_INT, status.MPI_SOURCE,
+               FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      requested[status.MPI_SOURCE]++;
+      MPI_Iprobe(MPI_ANY_SOURCE, FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, &pending, &status);
+    }
+
+    int generation = atomic_load(&latest_generation);
+    if (queue_size(&payload_to_workers_queue) == 0 && speculate_outstanding(generation) > 0) {
+      int copies = 0;
+      for (int i = 1; i < world_size; i++) {
+        payload_t copy;
+        if (requested[i] == slots && speculate_pick(generation, i, &copy)) {
+          mpi_payload_send(&copy, i, MPI_COMM_WORLD);
+          requested[i]--;
+          copies++;
+        }
+      }
+      if (copies == 0) {
+        // wait for a worker to finish, or for the next generation
+        nanosleep(&poll_interval, NULL);
+      }
+      continue;
+    }
+
+    payload_t *payload = (payload_t *)queue_dequeue(&payload_to_workers_queue);
+    if (payload == NULL) { // poison pill, answer held and upcoming requests
+      for (int i = 1; i < world_size; i++) {
+        for (int j = requested[i]; j < slots; j++) {
+          MPI_Recv(&worker, 1, MPI_INT, i, FRACTAL_MPI_PAYLOAD_REQUEST,
+                   MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+        for (int j = 0; j < slots; j++) {
+          mpi_payload_send(&shutdown_flag, i, MPI_COMM_WORLD);
+        }
+      }
+      free(requested);
+      pthread_exit(NULL);
+    }
+
+    // The worker with the most requests here is the least busy one
+    worker = 0;
+    for (int i = 1; i < world_size; i++) {
+      if (requested[i] > requested[worker]) worker = i;
+    }
+    if (worker == 0) {
+      MPI_Recv(&worker, 1, MPI_INT, MPI_ANY_SOURCE, FRACTAL_MPI_PAYLOAD_REQUEST,
+               MPI_COMM_WORLD, &status);
+      worker = status.MPI_SOURCE;
+      requested[worker]++;
+    }
+    split_if_running_out(payload, worker, world_size - 1);
+    mpi_payload_send(payload, worker, MPI_COMM_WORLD);
+    requested[worker]--;
+    speculate_sent(payload, worker);
+    free(payload);
+
+#if LOG_LEVEL >= LOG_BASIC
+    chunks_sent_to_workers++;
+    payloads_sent_to_workers++;
+    if (payloads_sent_to_workers == expected_payloads + split_payloads) {
+      for (int i = 1; i < world_size; i++) {
+        if (requested[i] == 0) {
+          MPI_Recv(&worker, 1, MPI_INT, i, FRACTAL_MPI_PAYLOAD_REQUEST,
+                   MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+          requested[i]++;
+        }
+        mpi_payload_send(&done_flag, i, MPI_COMM_WORLD); // Signal it to print times
+        requested[i]--;
+      }
+    }
+#endif
+  }
+  pthread_exit(NULL);
+}
+
+/*
+  main_thread_mpi_send_chunks: hierarchical dispatch. Leaders ask for
+  as many tiles as they want to hold, we answer with what is queued, up
+  to that many tiles in one message.
+*/
+void *main_thread_mpi_send_chunks ()
+{
+  payload_t shutdown_flag = {0};
+  shutdown_flag.generation = PAYLOAD_GENERATION_SHUTDOWN;
+  int leader_count;
+  const int *leaders = hierarchy_leaders(&leader_count);
+
+#if LOG_LEVEL >= LOG_BASIC
+  payload_t done_flag = {0};
+  done_flag.generation = PAYLOAD_GENERATION_DONE;
+#endif
+
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  // A leader never asks for more than two tiles per rank of its group
+  int capacity = 2 * world_size;
+  payload_t **dequeued = calloc(capacity, sizeof(payload_t*));
+  payload_t *chunk = calloc(capacity, sizeof(payload_t));
+  if (dequeued == NULL || chunk == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  while(1) {
+    int wanted, leader;
+    MPI_Status status;
+
+    // check which leader is running low
+    MPI_Recv(&wanted, 1, MPI_INT, MPI_ANY_SOURCE,
+             FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, &status);
+    leader = status.MPI_SOURCE;
+    if (wanted > capacity) wanted = capacity;
+
+    // Get at least one payload (blocks this thread), plus what is already queued
+    int count = queue_dequeue_many(&payload_to_workers_queue, (void **)dequeued, wanted);
+    if (dequeued[0] == NULL) { // poison pill, every leader keeps one request outstanding
+      mpi_payload_chunk_send(&shutdown_flag, 1, leader, MPI_COMM_WORLD);
+      for (int i = 0; i < leader_count; i++) {
+        if (leaders[i] == leader) continue;
+        MPI_Recv(&wanted, 1, MPI_INT, leaders[i],
+                 FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        mpi_payload_chunk_send(&shutdown_flag, 1, leaders[i], MPI_COMM_WORLD);
+      }
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      chunk[i] = *dequeued[i];
+      free(dequeued[i]);
+      dequeued[i] = NULL;
+    }
+    mpi_payload_chunk_send(chunk, count, leader, MPI_COMM_WORLD);
+
+#if LOG_LEVEL >= LOG_BASIC
+    chunks_sent_to_workers++;
+    payloads_sent_to_workers += count;
+    if (payloads_sent_to_workers == expected_payloads) {
+      // Leaders hand the flag to each of their workers after the tiles
+      for (int i = 0; i < leader_count; i++) {
+        MPI_Recv(&wanted, 1, MPI_INT, leaders[i],
+                 FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        mpi_payload_chunk_send(&done_flag, 1, leaders[i], MPI_COMM_WORLD);
+      }
+    }
+#endif
+  }
+
+  free(dequeued);
+  free(chunk);
+  pthread_exit(NULL);
+}
+
+/*
+  main_thread_mpi_publish_generations: with the rma and steal
+  dispatches, workers get tiles by themselves. We only expose every new
+  generation in the RMA windows and wake up the workers that wait for one.
+*/
+void *main_thread_mpi_publish_generations ()
+{
+  payload_t shutdown_flag = {0};
+  shutdown_flag.generation = PAYLOAD_GENERATION_SHUTDOWN;
+
+  while(1) {
+    payload_t *payload = (payload_t *)queue_dequeue(&payload_to_workers_queue);
+    if (options.dispatch == DISPATCH_STEAL) {
+      steal_dispatch_publish(payload != NULL ? payload : &shutdown_flag);
+    } else if (payload != NULL) {
+      rma_dispatch_publish(payload);
+      rma_dispatch_notify(payload->generation);
+    } else {
+      rma_dispatch_notify(PAYLOAD_GENERATION_SHUTDOWN);
+    }
+    if (payload == NULL) { // poison pill
+      pthread_exit(NULL);
+    }
+    free(payload);
+  }
+  pthread_exit(NULL);
+}
+
+/* count response, whose values took bytes, among those sent to the client */
+static void log_response_sent(const response_t *response, size_t bytes)
+{
+#if LOG_LEVEL >= LOG_BASIC
+  responses_sent_to_client++;
+  bytes_sent_to_client += bytes;
+  pixels_sent_to_client += response->payload.granularity * response->payload.granularity;
+  if (responses_sent_to_client == 1) {
+    clock_gettime(CLOCK_MONOTONIC, &first_response_sent_time);
+    fprintf(coordinator_log, "[NET_SEND_FIRST]: %.9f\n", 
+      timespec_to_double(timespec_diff(payload_received_time, first_response_sent_time)));
+  } else if (responses_sent_to_client ==
+             expected_payloads + cached_responses + reused_responses + stored_responses -
+             superseded_responses) {
+    clock_gettime(CLOCK_MONOTONIC, &last_response_sent_time);
+    fprintf(coordinator_log, "[NET_SEND_ALL]: %.9f\n", 
+      timespec_to_double(timespec_diff(payload_received_time, last_response_sent_time)));
+    fprintf(coordinator_log, "[NET_BYTES_PER_PIXEL]: %.3f\n",
+      (double)bytes_sent_to_client / pixels_sent_to_client);
+  }
+  fflush(coordinator_log); // Final log for a payload, write it immediately
+#else
+  (void)response;
+  (void)bytes;
+#endif
+}
+
+/* --clients: a payload of one of the clients, renumbered by clients.h */
+static void submit_client_payload(payload_t *payload)
+{
+#if LOG_LEVEL >= LOG_BASIC
+  clock_gettime(CLOCK_MONOTONIC, &payload_received_time);
+#endif
+  atomic_store(&latest_generation, payload->generation);
+  queue_enqueue(&client_payload_queue, payload);
+}
 
 void *net_thread_send_response(void *arg)
 {
@@ -325,45 +1397,41 @@ void *net_thread_send_response(void *arg)
     response_print(__func__, "preparating for sending the response", response);
 #endif
 
-    size_t buffer_size = response->payload.granularity * response->payload.granularity;
-    buffer_size *= sizeof(int);
+    // Values travel as the workers sent them, encoded or plain ints
+    // (straight from the shared framebuffer for co-located workers)
+    response_t header = *response;
+    size_t buffer_size;
+    const void *buffer;
+    if (response->encoded_size > 0) {
+      buffer_size = response->encoded_size;
+      buffer = response->encoded;
+    } else {
+      header.encoded_size = 0;
+      buffer_size = response->payload.granularity * response->payload.granularity * sizeof(int);
+      buffer = response->values;
+    }
 
     // First, send response
-    if (send(connection, response, sizeof(response_t), 0) <= 0) {
+    if (send(connection, &header, sizeof(response_t), 0) <= 0) {
       fprintf(stderr, "Send failed. Killing thread...\n");
-      free(response->values);
-      free(response);
+      framebuffer_free_response(response);
       pthread_exit(NULL);
     }
 
     // Then, send response values
-    if (send(connection, response->values, buffer_size, 0) <= 0) {
+    if (send(connection, buffer, buffer_size, 0) <= 0) {
       fprintf(stderr, "Send failed. Killing thread...\n");
-      free(response->values);
-      free(response);
+      framebuffer_free_response(response);
       pthread_exit(NULL);
     }
   
-#if LOG_LEVEL >= LOG_BASIC
-    responses_sent_to_client++;
-    if (responses_sent_to_client == 1) {
-      clock_gettime(CLOCK_MONOTONIC, &first_response_sent_time);
-      fprintf(coordinator_log, "[NET_SEND_FIRST]: %.9f\n", 
-        timespec_to_double(timespec_diff(payload_received_time, first_response_sent_time)));
-    } else if (responses_sent_to_client == expected_payloads) {
-      clock_gettime(CLOCK_MONOTONIC, &last_response_sent_time);
-      fprintf(coordinator_log, "[NET_SEND_ALL]: %.9f\n", 
-        timespec_to_double(timespec_diff(payload_received_time, last_response_sent_time)));
-    }
-    fflush(coordinator_log); // Final log for a payload, write it immediately
-#endif
+    log_response_sent(response, buffer_size);
 
 #ifdef RESPONSE_DEBUG
     response_print(__func__, "response sent", response);
 #endif
 
-    free(response->values);
-    free(response);
+    framebuffer_free_response(response);
   }
 
   pthread_exit(NULL);
@@ -375,12 +1443,56 @@ int main_coordinator(int argc, char* argv[])
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   int size;
   MPI_Comm_size(MPI_COMM_WORLD, &size);
-  if (argc == 1) {
-    printf("Missing arguments. Format: %s <port>\n", argv[0]);
-    return 1;
-  }
   printf("%s: Coordinator (rank %d) with %d arguments\n", argv[0], rank, argc);
   printf("%s: \t There are %d workers\n", argv[0], size-1);
+  printf("%s: \t Dispatch mode: %s\n", argv[0], options_dispatch_name(options.dispatch));
+  printf("%s: \t Workers prefetch %d tile(s)\n", argv[0], options.prefetch);
+  printf("%s: \t Scheduling policy: %s\n", argv[0], options_schedule_name(options.schedule));
+  printf("%s: \t Response encoding: %s\n", argv[0], options_encoding_name(options.encoding));
+  if (options.speculate) {
+    printf("%s: \t Speculative copies of straggler tiles\n", argv[0]);
+  }
+  if (options.split) {
+    printf("%s: \t Splitting of the last tiles of a generation\n", argv[0]);
+  }
+  if (options.throughput) {
+    printf("%s: \t Last tiles sized by worker throughput\n", argv[0]);
+  }
+  bool local_compute = options.local_compute && options.dispatch == DISPATCH_QUEUE &&
+    !options.speculate;
+  if (local_compute) {
+    printf("%s: \t Rank 0 computes tiles while the dispatch keeps up\n", argv[0]);
+  }
+  if (options.auto_granularity) {
+    printf("%s: \t Granularity chosen for every generation\n", argv[0]);
+  }
+  if (options.clients > 1) {
+    printf("%s: \t Up to %d clients at once\n", argv[0], options.clients);
+  }
+  if (options.tile_cache > 0) {
+    printf("%s: \t Tile cache of %d MB\n", argv[0], options.tile_cache);
+  }
+  if (options.worker_cache > 0) {
+    printf("%s: \t Tile cache of %d MB on every worker\n", argv[0], options.worker_cache);
+  }
+  if (options.reuse) {
+    printf("%s: \t Pixels of the previous frame reused after a pan or a zoom out\n", argv[0]);
+  }
+  if (options.tile_store[0] != '\0') {
+    printf("%s: \t Tile store %s, up to %d MB\n", argv[0], options.tile_store, options.tile_store_size);
+  }
+  if (options.framebuffer > 0) {
+    printf("%s: \t Shared framebuffer: %d million pixels per generation\n", argv[0], options.framebuffer);
+  }
+  if (options.dispatch == DISPATCH_HIERARCHICAL) {
+    int leader_count;
+    const int *leaders = hierarchy_leaders(&leader_count);
+    printf("%s: \t %d leader(s):", argv[0], leader_count);
+    for (int i = 0; i < leader_count; i++) {
+      printf(" %d", leaders[i]);
+    }
+    printf("\n");
+  }
 
   signal(SIGPIPE, SIG_IGN); // ignoring SIGPIPE (failed send)
 
@@ -397,20 +1509,62 @@ int main_coordinator(int argc, char* argv[])
   
   struct sockaddr_in client_addr; // client ip address after connect
   socklen_t client_len = sizeof(client_addr);
-  int socket = open_server_socket(atoi(argv[1]));
-
-  queue_init(&response_queue, 65536, free_response);
+  int socket = open_server_socket(options.port);
+
+  speculate_init();
+  split_init();
+  reuse_init();
+  throughput_init();
+  if (options.tile_cache > 0) {
+    tilecache_init((size_t)options.tile_cache << 20);
+  }
+  if (options.worker_cache > 0) {
+    tiledir_init(size, (size_t)options.worker_cache << 20);
+  }
+  if (options.tile_store[0] != '\0' &&
+      tilestore_open(options.tile_store, (size_t)options.tile_store_size << 20) < 0) {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  queue_init(&response_queue, 65536, framebuffer_free_response);
   queue_init(&payload_to_workers_queue, 65536, free);
+  queue_init(&client_payload_queue, 256, free);
   
   pthread_t compute_thread = 0;
   pthread_t mpi_send = 0;
   pthread_t mpi_recv = 0;
   pthread_t payload_receive_thread = 0;
   pthread_t response_send_thread = 0;
+  pthread_t local_thread = 0;
 
   pthread_create(&compute_thread, NULL, compute_create_blocks, NULL);
-  pthread_create(&mpi_send, NULL, main_thread_mpi_send_payloads, NULL);
+  switch (options.dispatch) {
+  case DISPATCH_RMA:
+  case DISPATCH_STEAL:
+    pthread_create(&mpi_send, NULL, main_thread_mpi_publish_generations, NULL);
+    break;
+  case DISPATCH_HIERARCHICAL:
+    pthread_create(&mpi_send, NULL, main_thread_mpi_send_chunks, NULL);
+    break;
+  case DISPATCH_QUEUE:
+  default:
+    if (options.speculate) {
+      pthread_create(&mpi_send, NULL, main_thread_mpi_send_speculative, NULL);
+      break;
+    }
+    pthread_create(&mpi_send, NULL, main_thread_mpi_send_payloads, NULL);
+    break;
+  }
   pthread_create(&mpi_recv, NULL, main_thread_mpi_recv_responses, NULL);
+  if (local_compute) {
+    pthread_create(&local_thread, NULL, main_thread_local_compute, NULL);
+  }
+
+  if (options.clients > 1) {
+    // this thread serves every connection, responses go out as clients_deliver queues them
+    clients_init(options.clients);
+    clients_serve(socket, submit_client_payload, log_response_sent);
+    request_shutdown(socket);
+  }
 
   while(!atomic_load(&shutdown_requested)) {
     int connection = accept(socket, (struct sockaddr *)&client_addr, &client_len);
@@ -419,6 +1573,7 @@ int main_coordinator(int argc, char* argv[])
     queue_clear(&response_queue);
     queue_clear(&payload_to_workers_queue);
     atomic_store(&latest_generation, -1);
+    cancel_publish(-1);
 
     pthread_create(&payload_receive_thread, NULL, net_thread_receive_payload, &connection);
     pthread_create(&response_send_thread, NULL, net_thread_send_response, &connection);
@@ -436,114 +1591,36 @@ int main_coordinator(int argc, char* argv[])
   pthread_join(compute_thread, NULL);
   pthread_join(mpi_recv, NULL);
   pthread_join(mpi_send, NULL);
+  if (local_compute) {
+    pthread_join(local_thread, NULL);
+  }
 
   shutdown(socket, SHUT_RDWR);
   close(socket);
   
   queue_destroy(&response_queue);
   queue_destroy(&payload_to_workers_queue);
-
-#if LOG_LEVEL >= LOG_BASIC
-  fclose(coordinator_log);
-#endif
-
-  return 0;
-}
-
-int main_worker(int argc, char* argv[])
-{
-  int rank, size;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &size);
-  //printf("%s: Worker (rank %d) with %d arguments\n", argv[0], rank, argc);
-
-  response_t shutdown_response = {0};
-  shutdown_response.payload.generation = PAYLOAD_GENERATION_SHUTDOWN;
-
-#if LOG_LEVEL >= LOG_BASIC
-  if (mkdir("worker_logs", 0777) == -1 && errno != EEXIST) {
-    fprintf(stderr, "Failed to create worker logs directory.\n");
-    exit(1);
+  queue_destroy(&client_payload_queue);
+  if (options.clients > 1) {
+    clients_finalize();
   }
-  char log_filename[64];
-  snprintf(log_filename, sizeof(log_filename), "worker_logs/worker_%d.txt", rank);
-  FILE *worker_log = fopen(log_filename, "w");
-  if (worker_log == NULL) {
-    fprintf(stderr, "Failed to create worker log file.\n");
-    exit(1);
+  if (options.tile_cache > 0) {
+    tilecache_finalize();
   }
-  long long total_iterations = 0;
-  long long total_pixels = 0;
-  struct timespec total_compute_time = {0};
-  struct timespec compute_start_time, compute_end_time;
-#endif
-
-  MPI_Barrier(MPI_COMM_WORLD); // Sync with coordinator before starting
-
-  while (1) {    
-    MPI_Ssend(&rank, 1, MPI_INT, 0, FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD);
-    payload_t *payload = mpi_payload_receive(0);
-
-    if (payload->generation == PAYLOAD_GENERATION_SHUTDOWN) {
-      free(payload);
-      MPI_Ssend(&rank, 1, MPI_INT, 0, FRACTAL_MPI_RESPONSE_REQUEST, MPI_COMM_WORLD);
-      mpi_response_send(&shutdown_response);
-      break; // Exit the loop and terminate the worker
-    }
-
-#if LOG_LEVEL >= LOG_BASIC
-    if (payload->generation == PAYLOAD_GENERATION_DONE) {
-      fprintf(worker_log, "[WORKER_%d_TOTAL]: %.9f, %lld, %lld\n", 
-              rank, 
-              timespec_to_double(total_compute_time),
-              total_pixels,
-              total_iterations);
-      fflush(worker_log);
-      free(payload);
-      total_iterations = 0;
-      total_pixels = 0;
-      total_compute_time = (struct timespec) {0};
-      continue;
-    }
-    clock_gettime(CLOCK_MONOTONIC, &compute_start_time);
-#endif
-    create_response_return_t response_result = create_response_for_payload(payload);
-
-#if LOG_LEVEL >= LOG_BASIC
-    clock_gettime(CLOCK_MONOTONIC, &compute_end_time);
-#endif
-
-    response_t *response = response_result.response;
-
-#if LOG_LEVEL >= LOG_BASIC
-#if LOG_LEVEL >= LOG_FULL
-      fprintf(worker_log, "[WORKER_%d_PAYLOAD]: %.9f, %d, %lld\n", 
-              rank,
-              timespec_to_double(timespec_diff(compute_start_time, compute_end_time)),
-              response->payload.granularity * response->payload.granularity,
-              response_result.total_iterations);
-#endif // LOG_FULL
-
-    total_compute_time = timespec_add(total_compute_time, 
-                                      timespec_diff(compute_start_time, compute_end_time));
-    total_iterations += response_result.total_iterations;
-    total_pixels += response->payload.granularity * response->payload.granularity;
-
-#endif // LOG_BASIC
-
-    response->max_worker_id = size;
-    response->worker_id = rank;
-
-    MPI_Ssend(&rank, 1, MPI_INT, 0, FRACTAL_MPI_RESPONSE_REQUEST, MPI_COMM_WORLD);
-    mpi_response_send(response);
-
-    free(response->values);
-    free(response);
-    free(payload);
+  if (options.worker_cache > 0) {
+    tiledir_finalize();
+  }
+  if (options.tile_store[0] != '\0') {
+    tilestore_close();
   }
+  speculate_finalize();
+  split_finalize();
+  reuse_finalize();
+  throughput_finalize();
+  deadline_finalize();
 
 #if LOG_LEVEL >= LOG_BASIC
-  fclose(worker_log);
+  fclose(coordinator_log);
 #endif
 
   return 0;
@@ -563,11 +1640,52 @@ int main(int argc, char* argv[])
   int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  if (rank == 0){
+  // Every rank parses the same command line, so workers see the same options
+  if (options_parse(argc, argv, &options) < 0) {
+    if (rank == 0) {
+      options_usage(argv[0]);
+    }
+    MPI_Finalize();
+    return 1;
+  }
+  if (options.pin != PIN_NONE) {
+    placement_init(options.pin); // before the buffers of every module
+  }
+  mpi_comm_init();
+  cancel_init();
+  if (options.framebuffer > 0) {
+    framebuffer_init(options.framebuffer);
+  }
+  if (options.dispatch == DISPATCH_RMA) {
+    rma_dispatch_init();
+  } else if (options.dispatch == DISPATCH_HIERARCHICAL) {
+    hierarchy_init(options.group_size);
+  } else if (options.dispatch == DISPATCH_STEAL) {
+    steal_dispatch_init();
+  }
+
+  if (options.batch && options.animate[0] != '\0') {
+    main_animate(&options);
+  } else if (options.batch) {
+    main_batch(&options);
+  } else if (rank == 0){
     main_coordinator(argc, argv);
   }else{
-    main_worker(argc, argv);
+    main_worker(&options);
+  }
+
+  if (options.dispatch == DISPATCH_RMA) {
+    rma_dispatch_finalize();
+  } else if (options.dispatch == DISPATCH_HIERARCHICAL) {
+    hierarchy_finalize();
+  } else if (options.dispatch == DISPATCH_STEAL) {
+    steal_dispatch_finalize();
+  }
+  if (options.framebuffer > 0) {
+    framebuffer_finalize();
   }
+  cancel_finalize();
+  mpi_comm_finalize();
   MPI_Finalize();
   return 0;
 }
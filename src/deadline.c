@@ -0,0 +1,210 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "deadline.h"
+#include "granularity.h"
+#include "timing.h"
+
+typedef struct {
+  int stride;     // one pixel per stride x stride block
+  int depth_cut;  // the depth is divided by it
+} deadline_level_t;
+
+static const deadline_level_t ladder[DEADLINE_LEVELS] = {
+  {1, 1}, {2, 1}, {2, 4}, {4, 4}, {4, 16}, {8, 16},
+};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static payload_t origin = {.generation = -1};
+static int length = 0;        // tiles per pass
+static int *best = NULL;      // by discretization index, best level forwarded
+static int passes = 0;
+static int first_level = 0;   // the pass queued first
+static int planned[DEADLINE_LEVELS];
+static int received[DEADLINE_LEVELS];
+static double completed[DEADLINE_LEVELS]; // monotonic seconds, 0 while incomplete
+static double deadline = 0;               // monotonic seconds
+static bool reported = false;
+static double start = 0;                  // of the plan, monotonic seconds
+static double estimate = 0;               // seconds of the first pass
+static double calibration = 1;            // measured over estimated first pass
+
+static double now (void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return timespec_to_double(time);
+}
+
+void deadline_finalize (void)
+{
+  free(best);
+  best = NULL;
+  length = 0;
+}
+
+void deadline_pass (const payload_t *origin, int level, payload_t *pass)
+{
+  *pass = *origin;
+  if (level == 0) {
+    return; // the payload as the client sent it
+  }
+  pass->stride = ladder[level].stride;
+  pass->fractal_depth = origin->fractal_depth / ladder[level].depth_cut;
+  if (pass->fractal_depth < 1) pass->fractal_depth = 1;
+}
+
+/* true if level computes the same pass as the level above it, which
+   happens at shallow depths once the depth cut reaches 1 */
+static bool duplicate (const payload_t *origin, int level)
+{
+  if (level == 0) {
+    return false;
+  }
+  payload_t pass, above;
+  deadline_pass(origin, level, &pass);
+  deadline_pass(origin, level - 1, &above);
+  return pass.stride == above.stride && pass.fractal_depth == above.fractal_depth;
+}
+
+int deadline_plan (const payload_t *new_origin, int workers, int levels[DEADLINE_LEVELS])
+{
+  double plan_start = now();
+  double budget = new_origin->budget_ms / 1000.0;
+  if (workers < 1) workers = 1;
+
+  // the probe runs once per depth of the ladder, from the full quality down
+  pthread_mutex_lock(&mutex);
+  double factor = calibration;
+  pthread_mutex_unlock(&mutex);
+  int first = DEADLINE_LEVELS - 1;
+  double cost = 0, skew, seconds = 0;
+  int probed_cut = 0;
+  for (int level = 0; level < DEADLINE_LEVELS; level++) {
+    if (ladder[level].depth_cut != probed_cut) {
+      payload_t pass;
+      deadline_pass(new_origin, level, &pass);
+      pass.stride = 0;
+      cost = granularity_cost(&pass, &skew);
+      probed_cut = ladder[level].depth_cut;
+    }
+    int stride = ladder[level].stride;
+    seconds = factor * cost / (stride * stride) / workers;
+    if (now() - plan_start + seconds <= DEADLINE_MARGIN * budget) {
+      first = level;
+      break;
+    }
+  }
+  while (duplicate(new_origin, first)) {
+    first--; // same pass, the level above is the one its tiles count for
+  }
+
+  pthread_mutex_lock(&mutex);
+  int new_length = discretize_length(new_origin);
+  if (new_length > length) {
+    free(best);
+    best = malloc(new_length * sizeof(int));
+    if (best == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  origin = *new_origin;
+  length = new_length;
+  for (int i = 0; i < length; i++) {
+    best[i] = DEADLINE_LEVELS;
+  }
+  passes = 0;
+  for (int level = first; level >= 0; level--) {
+    if (!duplicate(new_origin, level)) {
+      levels[passes++] = level;
+    }
+  }
+  for (int level = 0; level < DEADLINE_LEVELS; level++) {
+    planned[level] = level <= first && !duplicate(new_origin, level) ? length : 0;
+    received[level] = 0;
+    completed[level] = 0;
+  }
+  first_level = first;
+  deadline = plan_start + budget;
+  reported = false;
+  start = plan_start;
+  estimate = seconds / factor;
+  pthread_mutex_unlock(&mutex);
+  return passes;
+}
+
+/* level of the pass tile belongs to, -1 if none. The first match, the
+   one planned when levels collide */
+static int tile_level (const payload_t *tile)
+{
+  for (int level = 0; level < DEADLINE_LEVELS; level++) {
+    payload_t pass;
+    deadline_pass(&origin, level, &pass);
+    if (tile->stride == pass.stride && tile->fractal_depth == pass.fractal_depth) {
+      return level;
+    }
+  }
+  return -1;
+}
+
+bool deadline_received (const response_t *response, int *reached)
+{
+  *reached = DEADLINE_PENDING;
+  pthread_mutex_lock(&mutex);
+  const payload_t *tile = &response->payload;
+  int level = tile_level(tile);
+  if (tile->generation != origin.generation || level < 0) {
+    pthread_mutex_unlock(&mutex);
+    return true;
+  }
+
+  double arrival = now();
+  if (++received[level] == planned[level]) {
+    completed[level] = arrival;
+    if (level == first_level && estimate > 0) { // the first pass, how far off was it
+      double ratio = (arrival - start) / estimate;
+      if (ratio < DEADLINE_MIN_CALIBRATION) ratio = DEADLINE_MIN_CALIBRATION;
+      if (ratio > DEADLINE_MAX_CALIBRATION) ratio = DEADLINE_MAX_CALIBRATION;
+      calibration = (1 - DEADLINE_WEIGHT) * calibration + DEADLINE_WEIGHT * ratio;
+    }
+  }
+
+  int g = origin.granularity;
+  int amount_y = (origin.s_ur.y - origin.s_ll.y + g - 1) / g;
+  int index = (tile->s_ll.x - origin.s_ll.x) / g * amount_y + (tile->s_ll.y - origin.s_ll.y) / g;
+  bool forward = true;
+  if (index >= 0 && index < length) {
+    forward = level < best[index];
+    if (forward) best[index] = level;
+  }
+
+  bool finished = completed[0] > 0;
+  if (!reported && (arrival >= deadline || finished)) {
+    reported = true;
+    *reached = DEADLINE_NONE;
+    for (int l = DEADLINE_LEVELS - 1; l >= 0; l--) {
+      if (completed[l] > 0 && completed[l] <= deadline) *reached = l;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return forward;
+}
@@ -0,0 +1,137 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dispatch_rma.h"
+#include "mpi_comm.h"
+
+/* memory exposed by rank 0 */
+typedef struct {
+  int64_t counter; // publish in the upper half, next tile index in the lower half
+  int publish; // of the descriptor
+  payload_t descriptor; // the payload of the generation being claimed
+} rma_dispatch_window_t;
+
+static MPI_Win window = MPI_WIN_NULL;
+static rma_dispatch_window_t *window_base = NULL;
+// Publishes are numbered by rank 0, clients may send a generation again
+// (every textual run starts at 1, grafica at 0 after a reconnect)
+static int published = -1; // rank 0: the last publish
+static int fetched = -1;   // workers: publish of the payload cached by rma_dispatch_claim
+
+static int64_t ticket_pack (int publish, int index)
+{
+  return (int64_t)(((uint64_t)(uint32_t)publish << 32) | (uint32_t)index);
+}
+
+void rma_dispatch_init (void)
+{
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Aint size = (rank == 0) ? sizeof(rma_dispatch_window_t) : 0;
+  MPI_Win_allocate(size, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &window_base, &window);
+  if (rank == 0) {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+    memset(&window_base->descriptor, 0, sizeof(payload_t));
+    window_base->descriptor.generation = -1; // nothing to claim yet
+    window_base->publish = -1;
+    window_base->counter = ticket_pack(-1, 0);
+    MPI_Win_unlock(0, window);
+  }
+  MPI_Barrier(MPI_COMM_WORLD); // no claim before the window is initialized
+}
+
+void rma_dispatch_finalize (void)
+{
+  MPI_Win_free(&window);
+  window_base = NULL;
+}
+
+void rma_dispatch_publish (const payload_t *origin)
+{
+  // Descriptor and counter change in the same exclusive epoch, so a
+  // worker that sees the new publish in the counter also sees its payload
+  published++;
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+  window_base->descriptor = *origin;
+  window_base->publish = published;
+  window_base->counter = ticket_pack(published, 0);
+  MPI_Win_unlock(0, window);
+}
+
+void rma_dispatch_notify (int generation)
+{
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  for (int i = 1; i < world_size; i++) {
+    MPI_Send(&generation, 1, MPI_INT, i,
+	     FRACTAL_MPI_GENERATION_NOTICE, MPI_COMM_WORLD);
+  }
+}
+
+int rma_dispatch_wait_notice (void)
+{
+  int generation, pending = 0;
+  MPI_Recv(&generation, 1, MPI_INT, 0,
+	   FRACTAL_MPI_GENERATION_NOTICE, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  // Notices that piled up while we computed are superseded by the last one
+  while (generation != PAYLOAD_GENERATION_SHUTDOWN) {
+    MPI_Iprobe(0, FRACTAL_MPI_GENERATION_NOTICE, MPI_COMM_WORLD, &pending, MPI_STATUS_IGNORE);
+    if (!pending) break;
+    MPI_Recv(&generation, 1, MPI_INT, 0,
+	     FRACTAL_MPI_GENERATION_NOTICE, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  }
+  return generation;
+}
+
+int rma_dispatch_claim (payload_t *generation, payload_t *tile)
+{
+  const int64_t one = 1;
+  while (1) {
+    int64_t ticket;
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+    MPI_Fetch_and_op(&one, &ticket, MPI_INT64_T, 0,
+		     offsetof(rma_dispatch_window_t, counter), MPI_SUM, window);
+    MPI_Win_unlock(0, window);
+
+    int ticket_publish = (int)(uint32_t)((uint64_t)ticket >> 32);
+    int index = (int)(uint32_t)ticket;
+
+    if (ticket_publish != fetched) {
+      // First tile we claim from this publish, fetch its payload
+      MPI_Datatype payload_type = mpi_payload_datatype();
+      MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+      MPI_Get(&fetched, 1, MPI_INT, 0,
+	      offsetof(rma_dispatch_window_t, publish), 1, MPI_INT, window);
+      MPI_Get(generation, 1, payload_type, 0,
+	      offsetof(rma_dispatch_window_t, descriptor), 1, payload_type, window);
+      MPI_Win_unlock(0, window);
+      if (fetched != ticket_publish) {
+	continue; // a newer payload was published meanwhile, claim again
+      }
+    }
+
+    if (index >= discretize_length(generation)) {
+      return 0;
+    }
+    discretize_tile(generation, index, tile);
+    return 1;
+  }
+}
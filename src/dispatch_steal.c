@@ -0,0 +1,208 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "dispatch_steal.h"
+#include "mpi_comm.h"
+
+/* memory exposed by every worker */
+typedef struct {
+  int publish;    // publish of rank 0 the range belongs to
+  int head;       // next tile index the owner computes
+  int tail;       // one past the last tile index, thieves take from here
+} steal_range_t;
+
+static MPI_Win window = MPI_WIN_NULL;
+static steal_range_t *range = NULL;
+static int rank, world_size;
+static unsigned int seed;
+static steal_stats_t stats;
+// Publishes are numbered, clients may send a generation again (every
+// textual run starts at 1, grafica at 0 after a reconnect). Rank 0 sends
+// one payload per publish to every worker, in order, so the payloads a
+// worker received tell which publish the last one is.
+static int published = -1; // rank 0: the last publish
+static int received = -1;  // workers: publish of the last payload received
+
+void steal_dispatch_init (void)
+{
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  MPI_Aint size = (rank == 0) ? 0 : sizeof(steal_range_t);
+  MPI_Win_allocate(size, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &range, &window);
+  if (rank != 0) {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, window);
+    range->publish = -1; // nothing to compute yet
+    range->head = 0;
+    range->tail = 0;
+    MPI_Win_unlock(rank, window);
+  }
+  seed = (unsigned int)rank;
+  MPI_Barrier(MPI_COMM_WORLD); // no steal before every window is initialized
+}
+
+void steal_dispatch_finalize (void)
+{
+  MPI_Win_free(&window);
+  range = NULL;
+}
+
+void steal_dispatch_publish (const payload_t *origin)
+{
+  int workers = world_size - 1;
+  int length = discretize_length(origin);
+  published++;
+  for (int i = 1; i < world_size; i++) {
+    // Static block of consecutive tiles (a vertical strip of the screen)
+    steal_range_t block;
+    block.publish = published;
+    block.head = (int)((long long)length * (i - 1) / workers);
+    block.tail = (int)((long long)length * i / workers);
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, i, 0, window);
+    MPI_Put(&block, 3, MPI_INT, i, 0, 3, MPI_INT, window);
+    MPI_Win_unlock(i, window);
+  }
+  // The range is in place before the payload it refers to arrives
+  for (int i = 1; i < world_size; i++) {
+    mpi_generation_send(origin, i, MPI_COMM_WORLD);
+  }
+}
+
+/* the payload of the next publish into generation */
+static void receive_publish (payload_t *generation)
+{
+  mpi_generation_receive(generation, 0, MPI_COMM_WORLD);
+  received++;
+}
+
+int steal_dispatch_wait (payload_t *generation)
+{
+  int pending = 0;
+  receive_publish(generation);
+  // Payloads that piled up while we computed are superseded by the last one
+  while (generation->generation != PAYLOAD_GENERATION_SHUTDOWN) {
+    MPI_Iprobe(0, FRACTAL_MPI_GENERATION_NOTICE, MPI_COMM_WORLD, &pending, MPI_STATUS_IGNORE);
+    if (!pending) break;
+    receive_publish(generation);
+  }
+  return generation->generation;
+}
+
+/* take the first tile of our own range if it belongs to publish,
+   returns its index or -1. *current tells which publish the range
+   belongs to. */
+static int own_pop (int publish, int *current)
+{
+  int index = -1;
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, window);
+  *current = range->publish;
+  if (range->publish == publish && range->head < range->tail) {
+    index = range->head++;
+  }
+  MPI_Win_unlock(rank, window);
+  return index;
+}
+
+/* steal the back half of the range of victim into our own range */
+static int steal_from (int victim, int publish)
+{
+  steal_range_t remote;
+  int first = 0, last = 0;
+
+  stats.attempts++;
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, victim, 0, window);
+  MPI_Get(&remote, 3, MPI_INT, victim, 0, 3, MPI_INT, window);
+  MPI_Win_flush(victim, window);
+  if (remote.publish == publish && remote.tail > remote.head) {
+    int stolen = (remote.tail - remote.head + 1) / 2;
+    last = remote.tail;
+    first = remote.tail - stolen;
+    MPI_Put(&first, 1, MPI_INT, victim, offsetof(steal_range_t, tail), 1, MPI_INT, window);
+  }
+  MPI_Win_unlock(victim, window);
+
+  if (first == last) {
+    return 0;
+  }
+
+  int kept = 0;
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, window);
+  if (range->publish == publish) { // else rank 0 moved on, the tiles are obsolete
+    range->head = first;
+    range->tail = last;
+    kept = 1;
+  }
+  MPI_Win_unlock(rank, window);
+
+  stats.steals++;
+  stats.tiles += last - first;
+  return kept;
+}
+
+/* try every other worker once, in random order */
+static int steal (int publish)
+{
+  int victims = world_size - 2; // neither rank 0 nor us
+  if (victims <= 0) return 0;
+  int *order = malloc(victims * sizeof(int));
+  for (int i = 1, v = 0; i < world_size; i++) {
+    if (i != rank) order[v++] = i;
+  }
+  int ret = 0;
+  for (int i = 0; i < victims && !ret; i++) {
+    int j = i + rand_r(&seed) % (victims - i);
+    int victim = order[j];
+    order[j] = order[i];
+    order[i] = victim;
+    ret = steal_from(victim, publish);
+  }
+  free(order);
+  return ret;
+}
+
+int steal_dispatch_claim (payload_t *generation, payload_t *tile)
+{
+  while (generation->generation != PAYLOAD_GENERATION_SHUTDOWN) {
+    int current;
+    int index = own_pop(received, &current);
+    if (current != received) {
+      // Rank 0 replaced our range, its payload is on the way
+      while (received < current &&
+	     generation->generation != PAYLOAD_GENERATION_SHUTDOWN) {
+	receive_publish(generation);
+      }
+      continue;
+    }
+    if (index >= 0) {
+      discretize_tile(generation, index, tile);
+      return 1;
+    }
+    if (!steal(received)) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+steal_stats_t steal_dispatch_take_stats (void)
+{
+  steal_stats_t ret = stats;
+  stats = (steal_stats_t) {0};
+  return ret;
+}
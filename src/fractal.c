@@ -23,7 +23,10 @@ along with "Fractal @ PCAD". If not, see
 
 void free_response(void* ptr) {
   response_t *response = (response_t*) ptr; 
-  free(response->values);
+  if (response->encoded_size != RESPONSE_IN_FRAMEBUFFER) {
+    free(response->values);
+  }
+  free(response->encoded);
   free(response);
 }
 
@@ -40,18 +43,27 @@ static void embaralhar(payload_t **vetor, int tamanho) {
 }
 #endif
 
-payload_t **discretize_payload (payload_t *origin, int *length)
+int discretize_length (const payload_t *origin)
 {
-  if (!origin || !length){
-    return NULL;
-  }
   int screen_width = origin->s_ur.x - origin->s_ll.x;
   int screen_height = origin->s_ur.y - origin->s_ll.y;
-
+  if (origin->granularity <= 0 || screen_width <= 0 || screen_height <= 0){
+    return 0;
+  }
   int amount_x = (screen_width  + origin->granularity-1) / origin->granularity;
   int amount_y = (screen_height + origin->granularity-1) / origin->granularity;
-  // This is the number of squared blocks we need to create
-  *length = amount_x * amount_y;
+  return amount_x * amount_y;
+}
+
+void discretize_tile (const payload_t *origin, int index, payload_t *tile)
+{
+  int screen_width = origin->s_ur.x - origin->s_ll.x;
+  int screen_height = origin->s_ur.y - origin->s_ll.y;
+  int amount_y = (screen_height + origin->granularity-1) / origin->granularity;
+
+  /* Blocks are numbered column by column */
+  int i = index / amount_y;
+  int j = index % amount_y;
 
   /* Define the fractal space we need to cover */
   double x_ratio = (origin->ur.real - origin->ll.real) / screen_width;
@@ -63,40 +75,51 @@ payload_t **discretize_payload (payload_t *origin, int *length)
   int x_step = origin->granularity;
   int y_step = origin->granularity;
 
+  fractal_coord_t fractal_current = origin->ll;
+  fractal_current.real += real_step * i;
+  fractal_current.imag += imag_step * j;
+
+  screen_coord_t screen_current = origin->s_ll;
+  screen_current.x += x_step * i;
+  screen_current.y += y_step * j;
+
+  memset(tile, 0, sizeof(*tile));
+  tile->generation = origin->generation;
+  tile->granularity = origin->granularity;
+  tile->fractal_depth = origin->fractal_depth;
+  tile->palette = origin->palette;
+  tile->schedule = origin->schedule;
+  tile->budget_ms = origin->budget_ms;
+  tile->stride = origin->stride;
+  tile->hint = origin->hint;
+
+  tile->ll = fractal_current;
+  tile->ur = fractal_current;
+  tile->ur.real += real_step;
+  tile->ur.imag += imag_step;
+
+  tile->s_ll = screen_current;
+  tile->s_ur = screen_current;
+  tile->s_ur.x += x_step;
+  tile->s_ur.y += y_step;
+}
+
+payload_t **discretize_payload (payload_t *origin, int *length)
+{
+  if (!origin || !length){
+    return NULL;
+  }
+  // This is the number of squared blocks we need to create
+  *length = discretize_length(origin);
+
   payload_t **ret = (payload_t**)calloc(*length, sizeof(payload_t*));
-  int i, j, p = 0;
-  for (i = 0; i < amount_x; i++){
-    for (j = 0; j < amount_y; j++){
-      fractal_coord_t fractal_current = origin->ll;
-      fractal_current.real += real_step * i;
-      fractal_current.imag += imag_step * j;
-
-      screen_coord_t screen_current = origin->s_ll;
-      screen_current.x += x_step * i;
-      screen_current.y += y_step * j;
-
-      ret[p] = (payload_t*) calloc(1, sizeof(payload_t));
-      ret[p]->generation = origin->generation;
-      ret[p]->granularity = origin->granularity;
-      ret[p]->fractal_depth = origin->fractal_depth;
-
-      ret[p]->ll = fractal_current;
-      ret[p]->ur = fractal_current;
-      ret[p]->ur.real += real_step;
-      ret[p]->ur.imag += imag_step;
-
-      ret[p]->s_ll = screen_current;
-      ret[p]->s_ur = screen_current;
-      ret[p]->s_ur.x += x_step;
-      ret[p]->s_ur.y += y_step;
+  for (int p = 0; p < *length; p++){
+    ret[p] = (payload_t*) calloc(1, sizeof(payload_t));
+    discretize_tile(origin, p, ret[p]);
 
 #ifdef PAYLOAD_DEBUG
-      payload_print(__func__, "discretized payload", ret[p]);
+    payload_print(__func__, "discretized payload", ret[p]);
 #endif
-
-      //next discretized payload
-      p++;
-    }
   }
 #ifdef EMBARALHAR
   embaralhar(ret, *length);
@@ -105,6 +128,19 @@ payload_t **discretize_payload (payload_t *origin, int *length)
 }
 
 create_response_return_t create_response_for_payload (payload_t *payload)
+{
+  return create_response_for_payload_cancellable(payload, NULL);
+}
+
+create_response_return_t create_response_for_payload_cancellable (payload_t *payload,
+								   fractal_cancel_t cancelled)
+{
+  return create_response_in_place(payload, cancelled, NULL);
+}
+
+create_response_return_t create_response_in_place (payload_t *payload,
+						    fractal_cancel_t cancelled,
+						    int *values)
 {
   if (!payload) return (create_response_return_t) {0};
   response_t *ret = calloc(1, sizeof(response_t));
@@ -119,15 +155,39 @@ create_response_return_t create_response_for_payload (payload_t *payload)
   double real_step = (payload->ur.real - payload->ll.real) / screen_width;
   double imag_step = (payload->ur.imag - payload->ll.imag) / screen_height;
 
-  ret->values = calloc((screen_width * screen_height), // payload size
-		       sizeof(int)); // space required for each signal
+  if (values != NULL) {
+    ret->values = values;
+    ret->encoded_size = RESPONSE_IN_FRAMEBUFFER;
+  } else {
+    ret->values = calloc((screen_width * screen_height), // payload size
+			 sizeof(int)); // space required for each signal
+  }
 
   // TODO: sequencial solution for now
   //  payload_print(__func__, "compute", payload);
   long long total_iterations = 0;
+  long long next_check = 0; // check before the first row
+  int stride = payload->stride > 1 ? payload->stride : 1;
   int r = 0;
   for (int y = 0; y < screen_height; y++){
+    if (cancelled != NULL && total_iterations >= next_check) {
+      if (cancelled(payload)) {
+	free_response(ret);
+	return (create_response_return_t) {
+	  .response = NULL,
+	  .total_iterations = total_iterations,
+	  .cancelled = true
+	};
+      }
+      next_check = total_iterations + FRACTAL_CANCEL_CHECK_ITERATIONS;
+    }
     for (int x = 0; x < screen_width; x++){
+      if (stride > 1 && (x % stride != 0 || y % stride != 0)) {
+        // the pixel of the top-left corner of its block, already computed
+        ret->values[r] = ret->values[(y - y % stride) * screen_width + (x - x % stride)];
+        r++;
+        continue;
+      }
       fractal_coord_t fractal_current = payload->ll;
       fractal_current.imag += imag_step * y;
       fractal_current.real += real_step * x;
@@ -140,6 +200,7 @@ create_response_return_t create_response_for_payload (payload_t *payload)
       r++;
     }
   }
+  ret->iterations = total_iterations;
   return (create_response_return_t) {
     .response = ret,
     .total_iterations = total_iterations
@@ -160,6 +221,7 @@ void payload_print (const char *func, const char *message, const payload_t *p)
 
 long long compute_total_load (const response_t *r)
 {
+  if (r->values == NULL) return 0; // still encoded, see codec.h
   int number_of_values = r->payload.granularity * r->payload.granularity;
   long long total_cost = 0;
   for (int i = 0; i < number_of_values; i++){
@@ -0,0 +1,213 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <mpi.h>
+#include "framebuffer.h"
+#include "timing.h"
+
+/* the shared window, owned by rank 0 */
+typedef struct {
+  payload_t origin[FRAMEBUFFER_BUFFERS]; // generation each buffer belongs to
+  atomic_int writers[FRAMEBUFFER_BUFFERS]; // workers writing a tile into it
+  int values[]; // FRAMEBUFFER_BUFFERS * capacity values
+} framebuffer_t;
+
+static MPI_Comm node_comm = MPI_COMM_NULL;
+static MPI_Win window = MPI_WIN_NULL;
+static framebuffer_t *framebuffer = NULL;
+static long long capacity = 0; // values per buffer
+// rank 0: responses whose values are still on their way to a client
+static pthread_mutex_t lent_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t returned = PTHREAD_COND_INITIALIZER;
+static int lent[FRAMEBUFFER_BUFFERS];
+
+void framebuffer_init (int megapixels)
+{
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // Only ranks that share memory with rank 0 take part
+  MPI_Comm shared;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shared);
+  int node_root;
+  MPI_Allreduce(&rank, &node_root, 1, MPI_INT, MPI_MIN, shared);
+  if (node_root != 0) {
+    MPI_Comm_free(&shared);
+    return;
+  }
+  node_comm = shared;
+
+  capacity = (long long)megapixels * 1000000;
+  MPI_Aint size = 0;
+  if (rank == 0) {
+    size = sizeof(framebuffer_t) + FRAMEBUFFER_BUFFERS * capacity * sizeof(int);
+  }
+  framebuffer_t *base;
+  MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, node_comm, &base, &window);
+  MPI_Aint owner_size;
+  int disp_unit;
+  MPI_Win_shared_query(window, 0, &owner_size, &disp_unit, &framebuffer);
+  if (rank == 0) {
+    for (int i = 0; i < FRAMEBUFFER_BUFFERS; i++) {
+      memset(&framebuffer->origin[i], 0, sizeof(payload_t));
+      framebuffer->origin[i].generation = -1; // holds nothing yet
+      atomic_init(&framebuffer->writers[i], 0);
+    }
+  }
+  // One passive epoch for the whole run, MPI_Win_sync orders accesses
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+  MPI_Win_sync(window);
+  MPI_Barrier(node_comm);
+  MPI_Win_sync(window);
+}
+
+void framebuffer_finalize (void)
+{
+  if (node_comm == MPI_COMM_NULL) return;
+  MPI_Win_unlock_all(window);
+  MPI_Win_free(&window);
+  MPI_Comm_free(&node_comm);
+  framebuffer = NULL;
+}
+
+bool framebuffer_attached (void)
+{
+  return framebuffer != NULL;
+}
+
+void framebuffer_publish (const payload_t *origin)
+{
+  if (framebuffer == NULL || origin->generation < 0) return;
+  int buffer = origin->generation % FRAMEBUFFER_BUFFERS;
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pthread_mutex_lock(&lent_mutex);
+  // No tile of the old generation gets a place from now on. A worker
+  // takes its hold before it looks at the origin, so either it sees the
+  // buffer closed or we see its hold (framebuffer_write).
+  framebuffer->origin[buffer].generation = -1;
+  atomic_thread_fence(memory_order_seq_cst);
+  MPI_Win_sync(window);
+  while (lent[buffer] > 0 || atomic_load(&framebuffer->writers[buffer]) > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_to_double(timespec_diff(start, now)) * 1000 >= FRAMEBUFFER_LENT_WAIT_MS) {
+      break;
+    }
+    // Workers do not signal, look at their holds again every millisecond
+    struct timespec slice;
+    clock_gettime(CLOCK_REALTIME, &slice);
+    slice.tv_nsec += 1000000L;
+    slice.tv_sec += slice.tv_nsec / 1000000000L;
+    slice.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&returned, &lent_mutex, &slice);
+  }
+  if (lent[buffer] == 0 && atomic_load(&framebuffer->writers[buffer]) == 0) {
+    framebuffer->origin[buffer] = *origin;
+    MPI_Win_sync(window); // visible before any tile of origin is handed out
+  }
+  // else the buffer stays closed, tiles of origin travel as messages
+  pthread_mutex_unlock(&lent_mutex);
+}
+
+int *framebuffer_tile (const payload_t *tile)
+{
+  if (framebuffer == NULL || tile->generation < 0) return NULL;
+  MPI_Win_sync(window);
+  int buffer = tile->generation % FRAMEBUFFER_BUFFERS;
+  const payload_t *origin = &framebuffer->origin[buffer];
+  if (origin->generation != tile->generation || origin->granularity != tile->granularity) {
+    return NULL;
+  }
+  // The rougher passes of a latency budget (deadline.h) share the
+  // generation and the screen positions, only the full quality has a place
+  int stride = tile->stride > 1 ? tile->stride : 1;
+  int origin_stride = origin->stride > 1 ? origin->stride : 1;
+  if (origin->fractal_depth != tile->fractal_depth || origin_stride != stride) {
+    return NULL;
+  }
+
+  // Same numbering as discretize_tile, column by column
+  int g = origin->granularity;
+  int screen_height = origin->s_ur.y - origin->s_ll.y;
+  int amount_y = (screen_height + g - 1) / g;
+  int i = (tile->s_ll.x - origin->s_ll.x) / g;
+  int j = (tile->s_ll.y - origin->s_ll.y) / g;
+  long long offset = ((long long)i * amount_y + j) * g * g;
+  if (i < 0 || j < 0 || j >= amount_y || offset + (long long)g * g > capacity) {
+    return NULL;
+  }
+  return framebuffer->values + buffer * capacity + offset;
+}
+
+int *framebuffer_write (const payload_t *tile)
+{
+  if (framebuffer == NULL || tile->generation < 0) return NULL;
+  atomic_int *writers = &framebuffer->writers[tile->generation % FRAMEBUFFER_BUFFERS];
+  atomic_fetch_add(writers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  int *values = framebuffer_tile(tile);
+  if (values == NULL) {
+    atomic_fetch_sub(writers, 1);
+  }
+  return values;
+}
+
+void framebuffer_written (const payload_t *tile)
+{
+  MPI_Win_sync(window); // values land before the header that announces them
+  atomic_fetch_sub(&framebuffer->writers[tile->generation % FRAMEBUFFER_BUFFERS], 1);
+}
+
+int *framebuffer_lend (const payload_t *tile)
+{
+  if (tile->generation < 0) return NULL;
+  pthread_mutex_lock(&lent_mutex);
+  int *values = framebuffer_tile(tile);
+  if (values != NULL) {
+    lent[tile->generation % FRAMEBUFFER_BUFFERS]++;
+  }
+  pthread_mutex_unlock(&lent_mutex);
+  return values;
+}
+
+void framebuffer_free_response (void *ptr)
+{
+  response_t *response = (response_t *)ptr;
+  const int *values = response->values;
+  if (framebuffer != NULL && response->encoded_size == RESPONSE_IN_FRAMEBUFFER &&
+      values >= framebuffer->values &&
+      values < framebuffer->values + FRAMEBUFFER_BUFFERS * capacity) {
+    pthread_mutex_lock(&lent_mutex);
+    lent[(values - framebuffer->values) / capacity]--;
+    pthread_cond_broadcast(&returned);
+    pthread_mutex_unlock(&lent_mutex);
+  }
+  free_response(response);
+}
+
+void framebuffer_sync (void)
+{
+  if (framebuffer == NULL) return;
+  MPI_Win_sync(window);
+}
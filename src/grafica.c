@@ -28,11 +28,14 @@ along with "Fractal @ PCAD". If not, see
 #include <sys/types.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <math.h>
 
 #include "fractal.h"
 #include "connection.h"
+#include "codec.h"
 #include "queue.h"
 #include "colors.h"
+#include "normalize.h"
 
 #define max(a,b)				\
 ({ __typeof__ (a) _a = (a);			\
@@ -58,11 +61,18 @@ Color *g_worker_pixels = NULL; // Stores worker texture in RAM
 bool g_pixels_changed = false;
 bool g_show_workers = false;
 int g_current_color = 0;
+bool g_indexed = false; // ask for 8-bit palette indexes instead of depths
+int g_budget_ms = 0; // latency budget of every generation, 0 for none
+bool g_hints = false; // hint at a still selection box, see HINT_DELAY
+Color g_lut[256]; // colors of the palette indexes for g_lut_color
+int g_lut_color = -1;
 
 #define MAX_DEPTH 256*256*256
 // Using float for smooth granularity and depth input, cast to int when actually used
 float g_granularity = 10;
 bool g_gchanged = false;
+bool g_auto_granularity = false; // the coordinator chooses, G 0 toggles it
+int g_chosen_granularity = 0; // of the last response, under pixelMutex
 
 float g_depth = 256;
 bool g_dchanged = false;
@@ -72,6 +82,7 @@ float g_show_changes_timer = 0;
 /* Selection box (blue box) related globals */
 bool g_selecting = false;
 Rectangle g_box = {0, 0, 0, 0};
+#define HINT_DELAY 0.3f // seconds a selection box stays still before it is hinted at
 
 static queue_t payload_queue = {0};
 static queue_t response_queue = {0};
@@ -91,6 +102,14 @@ void request_shutdown(int connection){
   queue_enqueue(&response_queue, NULL);
 }
 
+/* rebuild the palette index colors if the palette changed, under pixelMutex */
+static void update_lut() {
+  if (g_lut_color != g_current_color) {
+    get_pallette_lut(g_current_color, g_lut);
+    g_lut_color = g_current_color;
+  }
+}
+
 void update_pixels(response_t *response) {
   int screen_width = GetScreenWidth();
   int screen_height = GetScreenHeight();
@@ -104,12 +123,17 @@ void update_pixels(response_t *response) {
   int y_offset = y0 - response->payload.s_ll.y;
   int p = y_offset * response->payload.granularity + x_offset;
 
+  bool indexed = response->payload.palette != NORMALIZE_NONE;
+
   pthread_mutex_lock(&pixelMutex); //lock
+  update_lut();
+  g_chosen_granularity = response->payload.granularity;
   for (int y = y0; y < y1; y++) {
     for (int x = x0; x < x1; x++) {
       g_pixel_depth[y * screen_width + x] = response->values[p];
 
-      Color color = get_current_pallette_color(g_current_color, response->values[p], response->payload.fractal_depth);
+      Color color = indexed ? g_lut[response->values[p] & 0xff] :
+        get_current_pallette_color(g_current_color, response->values[p], response->payload.fractal_depth);
 	    g_pixels[y * screen_width + x] = color;
 
       color = get_current_pallette_color(0, response->worker_id, response->max_worker_id);
@@ -128,11 +152,16 @@ void swap_pallete() {
 
   int screen_width = GetScreenWidth();
   int screen_height = GetScreenHeight();
+  // Indexes keep the normalization of their generation, only colors change
+  bool indexed = payload_history[payload_count-1].palette != NORMALIZE_NONE;
+
   pthread_mutex_lock(&pixelMutex);
+  update_lut();
   for (int y = 0; y < screen_height; y++) {
     for (int x = 0; x < screen_width; x++) {
       int max_depth = payload_history[payload_count-1].fractal_depth;
-      Color color = get_current_pallette_color(g_current_color, g_pixel_depth[y * screen_width + x], max_depth);
+      Color color = indexed ? g_lut[g_pixel_depth[y * screen_width + x] & 0xff] :
+        get_current_pallette_color(g_current_color, g_pixel_depth[y * screen_width + x], max_depth);
 	    g_pixels[y * screen_width + x] = color;
     }
   }
@@ -140,6 +169,47 @@ void swap_pallete() {
   pthread_mutex_unlock(&pixelMutex);
 }
 
+/*
+  box_payload: the payload of the screen box over the viewport from
+  ll to ur, with the current depth, granularity and palette.
+*/
+static void box_payload(Rectangle box, fractal_coord_t ll, fractal_coord_t ur,
+                        long double screen_width, long double screen_height,
+                        payload_t *payload)
+{
+  /* A pan by whole pixels lets the coordinator reuse the rest of the
+     screen (--reuse) */
+  if (box.width == screen_width && box.height == screen_height) {
+    box.x = roundf(box.x);
+    box.y = roundf(box.y);
+  }
+
+  /* ratio from pixels to coordinates based on the x axis */
+  long double pixel_coord_ratio = (ur.real - ll.real)/screen_width;
+
+  /* Transforming from screen coordinates to fractal coordinates */
+  fractal_coord_t first_point_fractal, second_point_fractal;
+  first_point_fractal.real = (box.x)*pixel_coord_ratio + ll.real;
+  first_point_fractal.imag = (box.y)*pixel_coord_ratio + ll.imag;
+
+  second_point_fractal.real = (box.x + box.width)*pixel_coord_ratio + ll.real;
+  second_point_fractal.imag = (box.y + box.height)*pixel_coord_ratio + ll.imag;
+
+  payload->granularity = g_auto_granularity ? PAYLOAD_GRANULARITY_AUTO : (int) g_granularity;
+  payload->fractal_depth = (int) g_depth;
+  payload->palette = g_indexed ? get_pallette_normalizer(g_current_color) : NORMALIZE_NONE;
+  payload->budget_ms = g_budget_ms; // rougher passes first, refined afterwards
+  payload->ll.real = min(first_point_fractal.real, second_point_fractal.real);
+  payload->ll.imag = min(first_point_fractal.imag, second_point_fractal.imag);
+  payload->ur.real = max(first_point_fractal.real, second_point_fractal.real);
+  payload->ur.imag = max(first_point_fractal.imag, second_point_fractal.imag);
+
+  payload->s_ll.x = 0;
+  payload->s_ll.y = 0;
+  payload->s_ur.x = screen_width;
+  payload->s_ur.y = screen_height;
+}
+
 /*
   handle_input: Handles user input. Every time a user selects
   a new area to compute, a payload must be created with a
@@ -154,8 +224,9 @@ void handle_input() {
 
   static float zoom = 0.0f;
 
-  static fractal_coord_t first_point_fractal = {0, 0};
-  static fractal_coord_t second_point_fractal = {0, 0};
+  static Rectangle still_box = {0, 0, 0, 0};
+  static Rectangle hinted_box = {0, 0, 0, 0};
+  static float still_time = 0;
 
   static bool interaction = false;
   static bool initial = true;
@@ -163,7 +234,6 @@ void handle_input() {
 
   long double screen_width = (long double) GetScreenWidth();
   long double screen_height = (long double) GetScreenHeight();
-  long double pixel_coord_ratio = (actual_ur.real - actual_ll.real) / screen_width;
 
   float dt = GetFrameTime();
 
@@ -227,6 +297,11 @@ void handle_input() {
 	    g_show_changes_timer = 1.0f;
       g_granularity += change;
     }
+    if(IsKeyPressed(KEY_ZERO)){
+	    g_gchanged = true;
+	    g_show_changes_timer = 1.0f;
+	    g_auto_granularity = !g_auto_granularity;
+    }
     g_granularity = min(g_granularity, 500);
     g_granularity = max(g_granularity, 1);
   }
@@ -314,6 +389,29 @@ void handle_input() {
     g_box.y = min(g_box.y, screen_height - g_box.height + g_box.height/4);
   }
 
+  /* A selection box left still is hinted at, the coordinator computes
+     it while its workers are idle and answers it at once on ENTER */
+  if (g_hints && g_selecting && !interaction) {
+    if (memcmp(&still_box, &g_box, sizeof(Rectangle)) != 0) {
+      still_box = g_box;
+      still_time = 0;
+    } else {
+      still_time += dt;
+    }
+    if (still_time >= HINT_DELAY && memcmp(&hinted_box, &g_box, sizeof(Rectangle)) != 0) {
+      hinted_box = g_box;
+      payload_t *hint = calloc(1, sizeof(payload_t));
+      if (hint == NULL) {
+        fprintf(stderr, "malloc failed.\n");
+        exit(1);
+      }
+      box_payload(g_box, actual_ll, actual_ur, screen_width, screen_height, hint);
+      hint->generation = generation - 1; // no new generation, the coordinator keeps its own
+      hint->hint = 1;
+      queue_enqueue(&payload_queue, hint);
+    }
+  }
+
   /* Colors related keys */
   if(IsKeyPressed(KEY_SPACE)){
     swap_pallete();
@@ -331,15 +429,8 @@ void handle_input() {
       exit(1);
     }
 
-    /* ratio from pixels to coordinates based on the x axis */
-    pixel_coord_ratio = (actual_ur.real - actual_ll.real)/screen_width;
-
-    /* Transforming from screen coordinates to fractal coordinates */
-    first_point_fractal.real = (g_box.x)*pixel_coord_ratio + actual_ll.real;
-    first_point_fractal.imag = (g_box.y)*pixel_coord_ratio + actual_ll.imag;
-
-    second_point_fractal.real = (g_box.x + g_box.width)*pixel_coord_ratio + actual_ll.real;
-    second_point_fractal.imag = (g_box.y + g_box.height)*pixel_coord_ratio + actual_ll.imag;
+    /* the same box on the next screen is another viewport */
+    hinted_box = (Rectangle){0, 0, 0, 0};
 
     if(back == true){
 	    back = false;
@@ -359,21 +450,11 @@ void handle_input() {
     } else {
       /* Generating the payload */
       payload->generation = generation++; /* The generation is always increasing */
-      payload->granularity = (int) g_granularity;
-      payload->fractal_depth = (int) g_depth;
-      payload->ll.real = min(first_point_fractal.real, second_point_fractal.real);
-      payload->ll.imag = min(first_point_fractal.imag, second_point_fractal.imag);
-      payload->ur.real = max(first_point_fractal.real, second_point_fractal.real);
-      payload->ur.imag = max(first_point_fractal.imag, second_point_fractal.imag);
+      box_payload(g_box, actual_ll, actual_ur, screen_width, screen_height, payload);
 
       actual_ll = payload->ll;
       actual_ur = payload->ur;
 
-      payload->s_ll.x = 0;
-      payload->s_ll.y = 0;
-      payload->s_ur.x = screen_width;
-      payload->s_ur.y = screen_height;
-
       payload_history = realloc(payload_history, (payload_count + 1)*sizeof(payload_t));
       if(payload_history == NULL){
 	      fprintf(stderr, "malloc failed.\n");
@@ -470,9 +551,11 @@ void *net_thread_receive_response (void *arg)
       pthread_exit(NULL);
     }
 
-    size_t buffer_size = response->payload.granularity * response->payload.granularity;
-    buffer_size *= sizeof(int);
-    int *buffer = malloc(buffer_size);
+    // Values come as plain ints or, when encoded_size is set, compact
+    response->values = NULL;
+    response->encoded = NULL;
+    size_t buffer_size = response_values_size(response);
+    void *buffer = malloc(buffer_size);
 
     if (buffer == NULL) {
       fprintf(stderr, "malloc failed.\n");
@@ -488,7 +571,16 @@ void *net_thread_receive_response (void *arg)
       pthread_exit(NULL);
     }
 
-    response->values = buffer;
+    if (response->encoded_size > 0) {
+      response->encoded = buffer;
+      if (response_decode(response) < 0) {
+        fprintf(stderr, "Malformed response. Killing thread...\n");
+        free_response(response);
+        pthread_exit(NULL);
+      }
+    } else {
+      response->values = buffer;
+    }
 
     /* printf("(%d) %s: received response.\n", response->generation, __func__); */
     /* printf("\t[%d, %d]\n", */
@@ -502,8 +594,21 @@ void *net_thread_receive_response (void *arg)
 
 int main(int argc, char* argv[])
 {
-  if (argc != 3) {
-    printf("Missing arguments. Format:\n%s <host> <port>\n", argv[0]);
+  bool usage = argc < 3;
+  for (int i = 3; i < argc && !usage; i++) {
+    if (strcmp(argv[i], "--indexed") == 0) {
+      g_indexed = true; // display only, no depths needed
+    } else if (strcmp(argv[i], "--hints") == 0) {
+      g_hints = true;
+    } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+      g_budget_ms = atoi(argv[++i]);
+      usage = g_budget_ms <= 0;
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    printf("Missing arguments. Format:\n%s <host> <port> [--indexed] [--budget <ms>] [--hints]\n", argv[0]);
     return 1;
   }
 
@@ -566,9 +671,16 @@ int main(int argc, char* argv[])
     // If overlaying workers on top, draw with alpha
     if(g_show_workers) DrawTexture(texture_worker, 0, 0, (Color){ 255, 255, 255, 128 });
 
+    // With the automatic granularity, show the one of the last response
+    pthread_mutex_lock(&pixelMutex);
+    const char *granularity = g_auto_granularity ?
+      TextFormat("Granularity:  auto (%d)", g_chosen_granularity) :
+      TextFormat("Granularity:  %d", (int)g_granularity);
+    pthread_mutex_unlock(&pixelMutex);
+
     if(!g_selecting && g_show_changes_timer > 0.0f){
       if(g_gchanged == true){
-	      DrawText(TextFormat("Granularity:  %d", (int)g_granularity), screen_width/4, screen_height/2 - 50, 100, WHITE);
+	      DrawText(granularity, screen_width/4, screen_height/2 - 50, 100, WHITE);
       }
       if(g_dchanged == true){
 	      DrawText(TextFormat("Depth:  %d", (int)g_depth), screen_width/4, screen_height/2 + 50, 100, WHITE);
@@ -581,7 +693,7 @@ int main(int argc, char* argv[])
     
     if(g_selecting){
       DrawRectangleRec(g_box, (Color){1.0f, 1.0f, 255.0f, 100.0f});
-      DrawText(TextFormat("Granularity:  %d", (int)g_granularity), 10, 10, 20, DARKGRAY);
+      DrawText(granularity, 10, 10, 20, DARKGRAY);
       DrawText(TextFormat("Depth:  %d", (int)g_depth), 10, 30, 20, DARKGRAY);
     }
 
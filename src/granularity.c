@@ -0,0 +1,118 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include "granularity.h"
+#include "schedule.h"
+#include "timing.h"
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static double overhead = GRANULARITY_DEFAULT_OVERHEAD;
+// the generation whose granularity was chosen last
+static int generation = -1;
+static int workers = 1;
+static int tiles = 0;
+static int received = 0;
+static double skew = 1;
+static double compute = 0; // seconds, sum over the received responses
+static struct timespec start_time;
+
+double granularity_cost (const payload_t *origin, double *cell_skew)
+{
+  long double width = (origin->ur.real - origin->ll.real) / GRANULARITY_PROBE_CELLS;
+  long double height = (origin->ur.imag - origin->ll.imag) / GRANULARITY_PROBE_CELLS;
+  long long total = 0, highest = 0;
+  struct timespec probe_start, probe_end;
+  clock_gettime(CLOCK_MONOTONIC, &probe_start);
+  for (int i = 0; i < GRANULARITY_PROBE_CELLS; i++) {
+    for (int j = 0; j < GRANULARITY_PROBE_CELLS; j++) {
+      payload_t cell = *origin;
+      cell.ll.real = origin->ll.real + width * i;
+      cell.ll.imag = origin->ll.imag + height * j;
+      cell.ur.real = cell.ll.real + width;
+      cell.ur.imag = cell.ll.imag + height;
+      long long cost = schedule_probe(&cell);
+      total += cost;
+      if (cost > highest) highest = cost;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &probe_end);
+  double seconds = timespec_to_double(timespec_diff(probe_start, probe_end));
+
+  int cells = GRANULARITY_PROBE_CELLS * GRANULARITY_PROBE_CELLS;
+  *cell_skew = total > 0 ? (double)highest * cells / total : 1;
+  // the probe computed cells * SCHEDULE_PROBE_POINTS pixels
+  double pixels = (double)(origin->s_ur.x - origin->s_ll.x) * (origin->s_ur.y - origin->s_ll.y);
+  return seconds * pixels / (cells * SCHEDULE_PROBE_POINTS);
+}
+
+int granularity_choose (const payload_t *origin, int worker_count)
+{
+  double cell_skew;
+  double cost = granularity_cost(origin, &cell_skew);
+  int width = origin->s_ur.x - origin->s_ll.x;
+  int height = origin->s_ur.y - origin->s_ll.y;
+
+  pthread_mutex_lock(&mutex);
+  double count = sqrt(cell_skew * cost / overhead);
+  int fewest = GRANULARITY_TILES_PER_WORKER * worker_count;
+  if (count < fewest) count = fewest;
+  int granularity = (int)lround(sqrt((double)width * height / count));
+  if (granularity > GRANULARITY_MAX) granularity = GRANULARITY_MAX;
+  if (granularity < GRANULARITY_MIN) granularity = GRANULARITY_MIN;
+
+  generation = origin->generation;
+  workers = worker_count > 0 ? worker_count : 1;
+  tiles = ((width + granularity - 1) / granularity) * ((height + granularity - 1) / granularity);
+  received = 0;
+  skew = cell_skew;
+  compute = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  pthread_mutex_unlock(&mutex);
+  return granularity;
+}
+
+void granularity_received (const response_t *response)
+{
+  pthread_mutex_lock(&mutex);
+  if (response->payload.generation != generation || received == tiles) {
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+  compute += response->compute_time;
+  if (++received == tiles) {
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double elapsed = timespec_to_double(timespec_diff(start_time, end_time));
+    // T = C/P + N o + k C/N, solved for o; off by 100 times is noise
+    double measured = (elapsed - compute / workers - skew * compute / tiles) / tiles;
+    if (measured < GRANULARITY_DEFAULT_OVERHEAD / 100) measured = GRANULARITY_DEFAULT_OVERHEAD / 100;
+    if (measured > GRANULARITY_DEFAULT_OVERHEAD * 100) measured = GRANULARITY_DEFAULT_OVERHEAD * 100;
+    overhead = (1 - GRANULARITY_WEIGHT) * overhead + GRANULARITY_WEIGHT * measured;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+double granularity_overhead (void)
+{
+  pthread_mutex_lock(&mutex);
+  double seconds = overhead;
+  pthread_mutex_unlock(&mutex);
+  return seconds;
+}
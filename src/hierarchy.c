@@ -0,0 +1,85 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "hierarchy.h"
+
+static MPI_Comm workers_comm = MPI_COMM_NULL;
+static MPI_Comm group_comm = MPI_COMM_NULL;
+static bool is_leader = false;
+static int *leaders = NULL;
+static int leader_count = 0;
+
+void hierarchy_init (int group_size)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  // Rank 0 coordinates, it belongs to no group
+  MPI_Comm_split(MPI_COMM_WORLD, rank == 0 ? MPI_UNDEFINED : 0, rank, &workers_comm);
+  if (workers_comm != MPI_COMM_NULL) {
+    if (group_size > 0) {
+      int workers_rank;
+      MPI_Comm_rank(workers_comm, &workers_rank);
+      MPI_Comm_split(workers_comm, workers_rank / group_size, workers_rank, &group_comm);
+    } else {
+      MPI_Comm_split_type(workers_comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &group_comm);
+    }
+    int group_rank;
+    MPI_Comm_rank(group_comm, &group_rank);
+    is_leader = (group_rank == 0);
+  }
+
+  // Everybody learns who the leaders are
+  int *flags = calloc(size, sizeof(int));
+  int flag = is_leader;
+  MPI_Allgather(&flag, 1, MPI_INT, flags, 1, MPI_INT, MPI_COMM_WORLD);
+  leaders = calloc(size, sizeof(int));
+  for (int i = 0; i < size; i++) {
+    if (flags[i]) {
+      leaders[leader_count++] = i;
+    }
+  }
+  free(flags);
+}
+
+void hierarchy_finalize (void)
+{
+  if (group_comm != MPI_COMM_NULL) MPI_Comm_free(&group_comm);
+  if (workers_comm != MPI_COMM_NULL) MPI_Comm_free(&workers_comm);
+  free(leaders);
+  leaders = NULL;
+  leader_count = 0;
+}
+
+MPI_Comm hierarchy_group_comm (void)
+{
+  return group_comm;
+}
+
+bool hierarchy_is_leader (void)
+{
+  return is_leader;
+}
+
+const int *hierarchy_leaders (int *count)
+{
+  *count = leader_count;
+  return leaders;
+}
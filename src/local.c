@@ -0,0 +1,92 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "timing.h"
+#include "local.h"
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool computing = false;
+static double idle_latency = 0;  // moving average while rank 0 does not compute
+static double busy_latency = 0;  // moving average during the current tile
+static double backoff = 0;       // seconds of the current pause
+static double resume_time = 0;   // monotonic seconds, end of the current pause
+
+static double average (double current, double sample)
+{
+  return current == 0 ? sample : (1 - LOCAL_WEIGHT) * current + LOCAL_WEIGHT * sample;
+}
+
+void local_lower_priority (void)
+{
+  // niceness is per thread on Linux, the dispatch threads keep theirs
+  pid_t tid = (pid_t) syscall(SYS_gettid);
+  if (setpriority(PRIO_PROCESS, tid, 19) < 0) {
+    perror("setpriority");
+  }
+}
+
+void local_computing (bool busy)
+{
+  pthread_mutex_lock(&mutex);
+  computing = busy;
+  pthread_mutex_unlock(&mutex);
+}
+
+void local_dispatch_sample (double seconds)
+{
+  pthread_mutex_lock(&mutex);
+  if (computing) {
+    busy_latency = average(busy_latency, seconds);
+  } else {
+    idle_latency = average(idle_latency, seconds);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+bool local_may_compute (void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock(&mutex);
+  bool may = idle_latency > 0 && timespec_to_double(now) >= resume_time;
+  pthread_mutex_unlock(&mutex);
+  return may;
+}
+
+bool local_tile_done (void)
+{
+  pthread_mutex_lock(&mutex);
+  bool slow = busy_latency > LOCAL_LATENCY_FACTOR * idle_latency;
+  if (slow) {
+    backoff = backoff == 0 ? LOCAL_MIN_BACKOFF : 2 * backoff;
+    if (backoff > LOCAL_MAX_BACKOFF) backoff = LOCAL_MAX_BACKOFF;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    resume_time = timespec_to_double(now) + backoff;
+  } else {
+    backoff = 0; // the dispatch kept up, or no worker waited for it
+  }
+  busy_latency = 0; // every tile is measured on its own
+  pthread_mutex_unlock(&mutex);
+  return slow;
+}
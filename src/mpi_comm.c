@@ -16,118 +16,318 @@ along with "Fractal @ PCAD". If not, see
 <https://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include "mpi_comm.h"
+#include "codec.h"
 
-static payload_t *_mpi_payload_receive (int source, int tag)
+/* one message per payload and one header message per response,
+   instead of a message per field */
+static MPI_Datatype mpi_payload_type = MPI_DATATYPE_NULL;
+static MPI_Datatype mpi_response_header_type = MPI_DATATYPE_NULL;
+
+static MPI_Datatype create_resized_struct (int count, int lengths[],
+					   MPI_Aint displacements[],
+					   MPI_Datatype types[],
+					   MPI_Aint extent)
+{
+  MPI_Datatype tmp, ret;
+  MPI_Type_create_struct(count, lengths, displacements, types, &tmp);
+  // resize so arrays of the C struct line up with arrays of the datatype
+  MPI_Type_create_resized(tmp, 0, extent, &ret);
+  MPI_Type_free(&tmp);
+  MPI_Type_commit(&ret);
+  return ret;
+}
+
+void mpi_comm_init (void)
+{
+  int payload_lengths[] = {1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2};
+  MPI_Aint payload_displacements[] = {
+    offsetof(payload_t, generation),
+    offsetof(payload_t, granularity),
+    offsetof(payload_t, fractal_depth),
+    offsetof(payload_t, palette),
+    offsetof(payload_t, schedule),
+    offsetof(payload_t, budget_ms),
+    offsetof(payload_t, stride),
+    offsetof(payload_t, hint),
+    offsetof(payload_t, ll), //coord lower-left
+    offsetof(payload_t, ur), //coord upper-right
+    offsetof(payload_t, s_ll), //screen coord lower-left
+    offsetof(payload_t, s_ur), //screeen coord upper-right
+  };
+  MPI_Datatype payload_types[] = {
+    MPI_INT, MPI_INT, MPI_INT, MPI_INT, MPI_INT, MPI_INT, MPI_INT, MPI_INT,
+    MPI_LONG_DOUBLE, MPI_LONG_DOUBLE,
+    MPI_INT, MPI_INT,
+  };
+  mpi_payload_type = create_resized_struct(12, payload_lengths,
+					   payload_displacements,
+					   payload_types, sizeof(payload_t));
+
+  int response_lengths[] = {1, 1, 1, 1, 1, 1};
+  MPI_Aint response_displacements[] = {
+    offsetof(response_t, payload),
+    offsetof(response_t, worker_id),
+    offsetof(response_t, max_worker_id),
+    offsetof(response_t, encoded_size),
+    offsetof(response_t, iterations),
+    offsetof(response_t, compute_time),
+  };
+  MPI_Datatype response_types[] = {
+    mpi_payload_type, MPI_INT, MPI_INT, MPI_INT,
+    MPI_LONG_LONG, MPI_DOUBLE,
+  };
+  mpi_response_header_type = create_resized_struct(6, response_lengths,
+						   response_displacements,
+						   response_types, sizeof(response_t));
+}
+
+void mpi_comm_finalize (void)
+{
+  MPI_Type_free(&mpi_response_header_type);
+  MPI_Type_free(&mpi_payload_type);
+}
+
+MPI_Datatype mpi_payload_datatype (void)
+{
+  return mpi_payload_type;
+}
+
+payload_t *mpi_payload_receive (int source, MPI_Comm comm)
 {
   payload_t *payload = calloc(1, sizeof(payload_t));
-  MPI_Recv(&payload->generation, 1, MPI_INT,
-	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  MPI_Recv(&payload->granularity, 1, MPI_INT,
-	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  MPI_Recv(&payload->fractal_depth, 1, MPI_INT,
-	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  //coord lower-left
-  MPI_Recv(&payload->ll, 2, MPI_LONG_DOUBLE,
-	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  //coord upper-right
-  MPI_Recv(&payload->ur, 2, MPI_LONG_DOUBLE,
+  MPI_Recv(payload, 1, mpi_payload_type,
 	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  //screen coord lower-left
-  MPI_Recv(&payload->s_ll, 2, MPI_INT,
-	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  //screeen coord upper-right
-  MPI_Recv(&payload->s_ur, 2, MPI_INT,
-	   source,
-	   tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	   FRACTAL_MPI_PAYLOAD_DATA, comm, MPI_STATUS_IGNORE);
   return payload;
 }
 
-static void _mpi_payload_send (payload_t *payload, int target, int tag)
+void mpi_payload_send (payload_t *payload, int target, MPI_Comm comm)
 {
-  MPI_Send(&payload->generation, 1, MPI_INT,
-	   target,
-	   tag, MPI_COMM_WORLD);
-  MPI_Send(&payload->granularity, 1, MPI_INT,
-	   target,
-	   tag, MPI_COMM_WORLD);
-  MPI_Send(&payload->fractal_depth, 1, MPI_INT,
-	   target,
-	   tag, MPI_COMM_WORLD);
-  //coord lower-left
-  MPI_Send(&payload->ll, 2, MPI_LONG_DOUBLE,
+  MPI_Send(payload, 1, mpi_payload_type,
 	   target,
-	   tag, MPI_COMM_WORLD);
-  //coord upper-right
-  MPI_Send(&payload->ur, 2, MPI_LONG_DOUBLE,
+	   FRACTAL_MPI_PAYLOAD_DATA, comm);
+}
+
+void mpi_payload_irecv (payload_t *payload, int source, MPI_Comm comm, MPI_Request *request)
+{
+  MPI_Irecv(payload, 1, mpi_payload_type,
+	    source,
+	    FRACTAL_MPI_PAYLOAD_DATA, comm, request);
+}
+
+void mpi_generation_send (const payload_t *payload, int target, MPI_Comm comm)
+{
+  MPI_Send(payload, 1, mpi_payload_type,
 	   target,
-	   tag, MPI_COMM_WORLD);
-  //screen coord lower-left
-  MPI_Send(&payload->s_ll, 2, MPI_INT,
+	   FRACTAL_MPI_GENERATION_NOTICE, comm);
+}
+
+void mpi_generation_receive (payload_t *payload, int source, MPI_Comm comm)
+{
+  MPI_Recv(payload, 1, mpi_payload_type,
+	   source,
+	   FRACTAL_MPI_GENERATION_NOTICE, comm, MPI_STATUS_IGNORE);
+}
+
+void mpi_payload_chunk_send (payload_t *payloads, int count, int target, MPI_Comm comm)
+{
+  MPI_Send(payloads, count, mpi_payload_type,
 	   target,
-	   tag, MPI_COMM_WORLD);
-  //screeen coord upper-right
-  MPI_Send(&payload->s_ur, 2, MPI_INT,
+	   FRACTAL_MPI_PAYLOAD_DATA, comm);
+}
+
+void mpi_payload_chunk_irecv (payload_t *payloads, int max, int source, MPI_Comm comm,
+			      MPI_Request *request)
+{
+  MPI_Irecv(payloads, max, mpi_payload_type,
+	    source,
+	    FRACTAL_MPI_PAYLOAD_DATA, comm, request);
+}
+
+void mpi_cache_fetch_send (payload_t *payloads, int count, int target, MPI_Comm comm)
+{
+  MPI_Send(payloads, count, mpi_payload_type,
 	   target,
-	   tag, MPI_COMM_WORLD);
+	   FRACTAL_MPI_CACHE_FETCH, comm);
 }
 
-payload_t *mpi_payload_receive (int source)
+void mpi_cache_fetch_irecv (payload_t *payloads, int max, int source, MPI_Comm comm,
+			    MPI_Request *request)
 {
-  return _mpi_payload_receive (source, FRACTAL_MPI_PAYLOAD_DATA);
+  MPI_Irecv(payloads, max, mpi_payload_type,
+	    source,
+	    FRACTAL_MPI_CACHE_FETCH, comm, request);
 }
 
-void mpi_payload_send (payload_t *payload, int target)
+int mpi_payload_count (MPI_Status *status)
 {
-  _mpi_payload_send (payload, target, FRACTAL_MPI_PAYLOAD_DATA);
+  int count;
+  MPI_Get_count(status, mpi_payload_type, &count);
+  return count;
 }
 
-response_t *mpi_response_receive (int worker_source)
+void mpi_response_header_irecv (response_t *header, int source, MPI_Comm comm,
+				MPI_Request *request)
 {
-  //receive the payload from that worker
-  //(the payload that corresponds to the response)
-  payload_t *payload = _mpi_payload_receive (worker_source,
-					     FRACTAL_MPI_RESPONSE_DATA);
-  response_t *response = calloc(1, sizeof(response_t));
-  response->payload = *payload;
+  MPI_Irecv(header, 1, mpi_response_header_type,
+	    source,
+	    FRACTAL_MPI_RESPONSE_DATA, comm, request);
+}
+
+void mpi_response_values_receive (response_t *response, int source, MPI_Comm comm)
+{
+  //messages from the same source are not overtaken, so values follow the header
+  if (response->encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+    response->values = NULL; // the receiver finds them in the framebuffer
+    response->encoded = NULL;
+    return;
+  }
+  if (response->encoded_size > 0) {
+    response->values = NULL;
+    response->encoded = malloc(response->encoded_size);
+    MPI_Recv(response->encoded, response->encoded_size, MPI_BYTE,
+	     source,
+	     FRACTAL_MPI_RESPONSE_DATA, comm, MPI_STATUS_IGNORE);
+    return;
+  }
   int n_values;
   n_values = response->payload.granularity * response->payload.granularity;
-  free(payload);
-  payload = NULL;
-  MPI_Recv(&response->worker_id, 1, MPI_INT,
-	   worker_source,
-	   FRACTAL_MPI_RESPONSE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-  MPI_Recv(&response->max_worker_id, 1, MPI_INT,
-	   worker_source,
-	   FRACTAL_MPI_RESPONSE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  response->encoded = NULL;
   response->values = (int*)calloc(n_values, sizeof(int));
   MPI_Recv(response->values, n_values, MPI_INT,
-	   worker_source,
-	   FRACTAL_MPI_RESPONSE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	   source,
+	   FRACTAL_MPI_RESPONSE_DATA, comm, MPI_STATUS_IGNORE);
+}
+
+response_t *mpi_response_receive (int source, MPI_Comm comm)
+{
+  MPI_Status status;
+  response_t *response = calloc(1, sizeof(response_t));
+  //receive the payload that corresponds to the response, and who computed it
+  MPI_Recv(response, 1, mpi_response_header_type,
+	   source,
+	   FRACTAL_MPI_RESPONSE_DATA, comm, &status);
+  mpi_response_values_receive(response, status.MPI_SOURCE, comm);
   return response;
 }
 
-void mpi_response_send (response_t *response)
+void mpi_response_send (response_t *response, int target, MPI_Comm comm)
 {
   if (!response) return;
-  int target = 0; // rank 0 is always our target here
-  _mpi_payload_send (&response->payload, target, FRACTAL_MPI_RESPONSE_DATA);
-  MPI_Send(&response->worker_id, 1, MPI_INT,
+  MPI_Send(response, 1, mpi_response_header_type,
 	   target,
-	   FRACTAL_MPI_RESPONSE_DATA, MPI_COMM_WORLD);
-  MPI_Send(&response->max_worker_id, 1, MPI_INT,
-	   target,
-	   FRACTAL_MPI_RESPONSE_DATA, MPI_COMM_WORLD);
+	   FRACTAL_MPI_RESPONSE_DATA, comm);
+  if (response->encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+    return;
+  }
+  if (response->encoded_size > 0) {
+    MPI_Send(response->encoded, response->encoded_size, MPI_BYTE,
+	     target,
+	     FRACTAL_MPI_RESPONSE_DATA, comm);
+    return;
+  }
   int n_values;
   n_values = response->payload.granularity * response->payload.granularity;
   MPI_Send(response->values, n_values, MPI_INT,
 	   target,
-	   FRACTAL_MPI_RESPONSE_DATA, MPI_COMM_WORLD);
+	   FRACTAL_MPI_RESPONSE_DATA, comm);
 }
 
+void mpi_response_isend (response_t *response, int target, MPI_Comm comm,
+			 MPI_Request requests[2])
+{
+  MPI_Isend(response, 1, mpi_response_header_type,
+	    target,
+	    FRACTAL_MPI_RESPONSE_DATA, comm, &requests[0]);
+  if (response->encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+    requests[1] = MPI_REQUEST_NULL;
+    return;
+  }
+  if (response->encoded_size > 0) {
+    MPI_Isend(response->encoded, response->encoded_size, MPI_BYTE,
+	      target,
+	      FRACTAL_MPI_RESPONSE_DATA, comm, &requests[1]);
+    return;
+  }
+  int n_values;
+  n_values = response->payload.granularity * response->payload.granularity;
+  MPI_Isend(response->values, n_values, MPI_INT,
+	    target,
+	    FRACTAL_MPI_RESPONSE_DATA, comm, &requests[1]);
+}
+
+void mpi_response_batch_send (response_t **responses, int count, int target, MPI_Comm comm)
+{
+  response_t *headers = calloc(count, sizeof(response_t));
+  int n_bytes = 0;
+  for (int i = 0; i < count; i++) {
+    headers[i] = *responses[i];
+    n_bytes += response_values_size(responses[i]);
+  }
+  // Values of every response back to back, plain or encoded
+  unsigned char *values = malloc(n_bytes);
+  int offset = 0;
+  for (int i = 0; i < count; i++) {
+    int n = response_values_size(responses[i]);
+    const void *data = responses[i]->encoded_size > 0 ?
+      (const void *)responses[i]->encoded : (const void *)responses[i]->values;
+    memcpy(values + offset, data, n);
+    offset += n;
+  }
+  MPI_Send(headers, count, mpi_response_header_type,
+	   target,
+	   FRACTAL_MPI_RESPONSE_BATCH, comm);
+  MPI_Send(values, n_bytes, MPI_BYTE,
+	   target,
+	   FRACTAL_MPI_RESPONSE_BATCH, comm);
+  free(headers);
+  free(values);
+}
+
+response_t **mpi_response_batch_receive (int source, MPI_Comm comm, int *count)
+{
+  MPI_Status status;
+  MPI_Probe(source, FRACTAL_MPI_RESPONSE_BATCH, comm, &status);
+  MPI_Get_count(&status, mpi_response_header_type, count);
+  source = status.MPI_SOURCE;
+
+  response_t *headers = calloc(*count, sizeof(response_t));
+  MPI_Recv(headers, *count, mpi_response_header_type,
+	   source,
+	   FRACTAL_MPI_RESPONSE_BATCH, comm, MPI_STATUS_IGNORE);
+  int n_bytes = 0;
+  for (int i = 0; i < *count; i++) {
+    n_bytes += response_values_size(&headers[i]);
+  }
+  unsigned char *values = malloc(n_bytes);
+  MPI_Recv(values, n_bytes, MPI_BYTE,
+	   source,
+	   FRACTAL_MPI_RESPONSE_BATCH, comm, MPI_STATUS_IGNORE);
+
+  // Split in individual responses, each owning its values
+  response_t **ret = calloc(*count, sizeof(response_t*));
+  int offset = 0;
+  for (int i = 0; i < *count; i++) {
+    int n = response_values_size(&headers[i]);
+    ret[i] = calloc(1, sizeof(response_t));
+    *ret[i] = headers[i];
+    ret[i]->values = NULL;
+    ret[i]->encoded = NULL;
+    if (headers[i].encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+      // nothing travelled, the receiver finds them in the framebuffer
+    } else if (headers[i].encoded_size > 0) {
+      ret[i]->encoded = malloc(n);
+      memcpy(ret[i]->encoded, values + offset, n);
+    } else {
+      ret[i]->values = malloc(n);
+      memcpy(ret[i]->values, values + offset, n);
+    }
+    offset += n;
+  }
+  free(headers);
+  free(values);
+  return ret;
+}
@@ -0,0 +1,68 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <math.h>
+#include "normalize.h"
+
+// Normalizes depth to [0, 1] range linearly
+double norm_linear(int depth, int max_depth){
+  return (double)depth / max_depth;
+}
+
+// Normalizes depth to [0, 1] range scaled with a power function (depth/k)^n
+// 256 and 1/e were chosen as balanced values, adjustment is possible
+// First full cycle happens at depth 256, then slows down gradually so that colors
+// keep stably looping as depth increases. The effect of this is as the depth increases, 
+// the color palette loops, more often initially then tapering off.
+double norm_power_cycle(int depth, int max_depth) {
+  ++max_depth; // unused
+  return fmod(pow(depth / 256.0, (1.0 / 2.71828)), 1.0);
+}
+
+double norm_log_cycle(int depth, int max_depth) {
+  ++max_depth; // unused
+  return fmod(log(depth / 256.0 + 1), 1.0);
+}
+
+normalize_fn normalize_get(int normalizer)
+{
+  switch (normalizer) {
+    case NORMALIZE_POWER_CYCLE: return norm_power_cycle;
+    case NORMALIZE_LOG_CYCLE:   return norm_log_cycle;
+    case NORMALIZE_LINEAR:
+    default:                    return norm_linear;
+  }
+}
+
+unsigned char normalize_palette_index(int depth, int max_depth, int normalizer)
+{
+  if (depth >= max_depth) return PALETTE_INSIDE;
+  double t = normalize_get(normalizer)(depth, max_depth);
+  t = t - floor(t);
+  int index = (int)(t * PALETTE_INSIDE);
+  return (unsigned char)(index < PALETTE_INSIDE ? index : PALETTE_INSIDE - 1);
+}
+
+void response_to_palette(response_t *response)
+{
+  int n = response->payload.granularity * response->payload.granularity;
+  int max_depth = response->payload.fractal_depth;
+  int normalizer = response->payload.palette;
+  for (int i = 0; i < n; i++) {
+    response->values[i] = normalize_palette_index(response->values[i], max_depth, normalizer);
+  }
+}
@@ -0,0 +1,416 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "options.h"
+
+enum {
+  OPTION_PREFETCH = 256,
+  OPTION_DISPATCH,
+  OPTION_GROUP_SIZE,
+  OPTION_ENCODING,
+  OPTION_SHARED_FRAMEBUFFER,
+  OPTION_BATCH,
+  OPTION_BATCH_BLOCK,
+  OPTION_SPECULATE,
+  OPTION_SPLIT,
+  OPTION_THROUGHPUT,
+  OPTION_SCHEDULE,
+  OPTION_LOCAL_COMPUTE,
+  OPTION_PIN,
+  OPTION_AUTO_GRANULARITY,
+  OPTION_CLIENTS,
+  OPTION_TILE_CACHE,
+  OPTION_WORKER_CACHE,
+  OPTION_REUSE,
+  OPTION_TILE_STORE,
+  OPTION_TILE_STORE_SIZE,
+  OPTION_BATCH_OUTPUT,
+  OPTION_ANIMATE,
+  OPTION_HINTS,
+};
+
+static const char *dispatch_names[] = {
+  [DISPATCH_QUEUE] = "queue",
+  [DISPATCH_RMA] = "rma",
+  [DISPATCH_HIERARCHICAL] = "hierarchical",
+  [DISPATCH_STEAL] = "steal",
+};
+#define DISPATCH_COUNT (int)(sizeof(dispatch_names) / sizeof(dispatch_names[0]))
+
+static const char *encoding_names[] = {
+  [ENCODING_RAW] = "raw",
+  [ENCODING_COMPACT] = "compact",
+};
+#define ENCODING_COUNT (int)(sizeof(encoding_names) / sizeof(encoding_names[0]))
+
+static const char *schedule_names[] = {
+  [SCHEDULE_DEFAULT] = NULL, // payloads only
+  [SCHEDULE_FIFO] = "fifo",
+  [SCHEDULE_GUIDED] = "guided",
+  [SCHEDULE_FACTORING] = "factoring",
+  [SCHEDULE_LARGEST_FIRST] = "largest-first",
+  [SCHEDULE_LOCALITY] = "locality",
+};
+#define SCHEDULE_COUNT (int)(sizeof(schedule_names) / sizeof(schedule_names[0]))
+
+static const char *pin_names[] = {
+  [PIN_NONE] = "none",
+  [PIN_CORE] = "core",
+  [PIN_SOCKET] = "socket",
+};
+#define PIN_COUNT (int)(sizeof(pin_names) / sizeof(pin_names[0]))
+
+static const struct option long_options[] = {
+  {"prefetch", required_argument, NULL, OPTION_PREFETCH},
+  {"dispatch", required_argument, NULL, OPTION_DISPATCH},
+  {"group-size", required_argument, NULL, OPTION_GROUP_SIZE},
+  {"encoding", required_argument, NULL, OPTION_ENCODING},
+  {"shared-framebuffer", required_argument, NULL, OPTION_SHARED_FRAMEBUFFER},
+  {"batch", required_argument, NULL, OPTION_BATCH},
+  {"batch-block", required_argument, NULL, OPTION_BATCH_BLOCK},
+  {"speculate", no_argument, NULL, OPTION_SPECULATE},
+  {"split", no_argument, NULL, OPTION_SPLIT},
+  {"throughput", no_argument, NULL, OPTION_THROUGHPUT},
+  {"schedule", required_argument, NULL, OPTION_SCHEDULE},
+  {"local-compute", no_argument, NULL, OPTION_LOCAL_COMPUTE},
+  {"pin", required_argument, NULL, OPTION_PIN},
+  {"auto-granularity", no_argument, NULL, OPTION_AUTO_GRANULARITY},
+  {"clients", required_argument, NULL, OPTION_CLIENTS},
+  {"tile-cache", required_argument, NULL, OPTION_TILE_CACHE},
+  {"worker-cache", required_argument, NULL, OPTION_WORKER_CACHE},
+  {"reuse", no_argument, NULL, OPTION_REUSE},
+  {"tile-store", required_argument, NULL, OPTION_TILE_STORE},
+  {"tile-store-size", required_argument, NULL, OPTION_TILE_STORE_SIZE},
+  {"batch-output", required_argument, NULL, OPTION_BATCH_OUTPUT},
+  {"animate", required_argument, NULL, OPTION_ANIMATE},
+  {"hints", no_argument, NULL, OPTION_HINTS},
+  {"help",     no_argument,       NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+/* strtol wrapper accepting only a full integer within [min, max] */
+static int parse_int(const char *str, int min, int max, int *value)
+{
+  char *end = NULL;
+  long v = strtol(str, &end, 10);
+  if (end == str || *end != '\0' || v < min || v > max) {
+    return -1;
+  }
+  *value = (int)v;
+  return 0;
+}
+
+/* index of str in names, or -1 */
+static int parse_name(const char *str, const char *names[], int count)
+{
+  for (int i = 0; i < count; i++) {
+    if (names[i] != NULL && strcmp(str, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* granularity,depth,width,height,ll_real,ll_imag,ur_real,ur_imag,
+   the arguments of the textual client separated by commas */
+static int parse_viewport(const char *str, payload_t *viewport)
+{
+  int consumed = 0;
+  memset(viewport, 0, sizeof(*viewport));
+  if (sscanf(str, "%d,%d,%d,%d,%Lf,%Lf,%Lf,%Lf%n",
+             &viewport->granularity, &viewport->fractal_depth,
+             &viewport->s_ur.x, &viewport->s_ur.y,
+             &viewport->ll.real, &viewport->ll.imag,
+             &viewport->ur.real, &viewport->ur.imag, &consumed) != 8 ||
+      str[consumed] != '\0') {
+    return -1;
+  }
+  if (viewport->granularity <= 0 || viewport->fractal_depth <= 0 ||
+      viewport->s_ur.x <= 0 || viewport->s_ur.y <= 0) {
+    return -1;
+  }
+  return 0;
+}
+
+const char *options_dispatch_name(dispatch_mode_t dispatch)
+{
+  return dispatch_names[dispatch];
+}
+
+const char *options_schedule_name(schedule_policy_t schedule)
+{
+  return schedule_names[schedule];
+}
+
+const char *options_pin_name(pin_mode_t pin)
+{
+  return pin_names[pin];
+}
+
+const char *options_encoding_name(encoding_mode_t encoding)
+{
+  return encoding_names[encoding];
+}
+
+void options_usage(const char *program)
+{
+  printf("Format: %s <port> [options]\n"
+         "        %s --batch <viewport> [options]\n"
+         "Options:\n"
+         "  --prefetch <n>       tiles each worker keeps requested while computing (default %d, max %d)\n"
+         "  --dispatch <mode>    queue (default): workers ask the coordinator for each tile\n"
+         "                       rma: workers claim tiles from a shared counter\n"
+         "                       hierarchical: one leader per node relays tiles and responses\n"
+         "                       steal: static blocks per worker, idle workers steal tiles\n"
+         "  --group-size <n>     hierarchical: ranks per leader instead of one leader per node\n"
+         "  --encoding <e>       raw (default): 4 bytes per pixel\n"
+         "                       compact: 1, 2 or 4 bytes per pixel, run-length rows, solid tiles\n"
+         "  --shared-framebuffer <m>\n"
+         "                       workers on the node of rank 0 write into a shared framebuffer\n"
+         "                       of m million pixels per generation (max %d)\n"
+         "  --schedule <p>       queue: order of the tiles and tiles per request (hierarchical:\n"
+         "                       order only), fifo (default), guided, factoring,\n"
+         "                       largest-first or locality\n"
+         "  --speculate          queue: once no tile is left, idle workers recompute the oldest\n"
+         "                       outstanding tiles, the first answer wins\n"
+         "  --split              queue: once fewer tiles than workers are left, cut the next\n"
+         "                       tiles in four pieces\n"
+         "  --throughput         queue: cut the last tiles further for workers slower than the\n"
+         "                       fastest one, from their measured iterations per second\n"
+         "  --local-compute      queue: rank 0 computes tiles too, at low priority, backing off\n"
+         "                       while it slows down the dispatch (not with --speculate)\n"
+         "  --pin <mode>         none (default): placement left to mpirun\n"
+         "                       core: one core per worker, one for the threads of rank 0\n"
+         "                       socket: workers spread over the sockets, one core for rank 0\n"
+         "  --auto-granularity   the coordinator picks the granularity of every generation,\n"
+         "                       clients may also ask for it with a granularity of 0\n"
+         "  --clients <n>        serve up to n clients at once, sharing the workers tile by tile\n"
+         "                       (default 1, max %d; queue or hierarchical, not with --speculate,\n"
+         "                       --split, --throughput or --shared-framebuffer)\n"
+         "  --tile-cache <m>     queue or hierarchical: rank 0 answers the tiles it already sent\n"
+         "                       from up to m megabytes of responses (max %d)\n"
+         "  --worker-cache <m>   queue: every worker keeps up to m megabytes of the tiles it\n"
+         "                       computed, rank 0 sends a tile to its holder (not with --speculate)\n"
+         "  --reuse              queue or hierarchical: after a pan by whole pixels or an integer\n"
+         "                       zoom out, only the uncovered strips go to the workers (not with\n"
+         "                       --speculate, --split, --throughput, --shared-framebuffer or --clients)\n"
+         "  --tile-store <path>  keep the tiles in <path>.data and <path>.index across restarts,\n"
+         "                       rank 0 answers them from there (queue or hierarchical), --batch fills it\n"
+         "  --tile-store-size <m> megabytes of values the tile store may hold (default %d)\n"
+         "  --hints              queue: compute the selection box the client hints at while the\n"
+         "                       workers are idle, into the tile cache (needs --tile-cache, not\n"
+         "                       with --speculate, --split, --throughput, --local-compute,\n"
+         "                       --worker-cache, --shared-framebuffer or --clients)\n"
+         "  --batch <g>,<depth>,<width>,<height>,<ll_real>,<ll_imag>,<ur_real>,<ur_imag>\n"
+         "                       render one frame with a static partition and exit, no client\n"
+         "  --batch-block <n>    batch: consecutive tiles per rank and round (default %d)\n"
+         "  --batch-output <file> batch: the workers write a raw image of ints to <file> with\n"
+         "                       MPI-IO instead of gathering it, a rerun skips the written tiles\n"
+         "  --animate <keyframes> batch: render the frames of a zoom path, from the --batch viewport\n"
+         "                       to those of <keyframes>, to <file>_<frame>.raw of --batch-output\n",
+         program, program, OPTIONS_DEFAULT_PREFETCH, OPTIONS_MAX_PREFETCH, OPTIONS_MAX_FRAMEBUFFER,
+         OPTIONS_MAX_CLIENTS, OPTIONS_MAX_TILE_CACHE, OPTIONS_DEFAULT_TILE_STORE_SIZE,
+         OPTIONS_DEFAULT_BATCH_BLOCK);
+}
+
+int options_parse(int argc, char *argv[], options_t *options)
+{
+  options->port = 0;
+  options->prefetch = OPTIONS_DEFAULT_PREFETCH;
+  options->dispatch = DISPATCH_QUEUE;
+  options->group_size = 0;
+  options->encoding = ENCODING_RAW;
+  options->framebuffer = 0;
+  options->batch = 0;
+  memset(&options->batch_viewport, 0, sizeof(options->batch_viewport));
+  options->batch_block = OPTIONS_DEFAULT_BATCH_BLOCK;
+  options->batch_output[0] = '\0';
+  options->animate[0] = '\0';
+  options->speculate = 0;
+  options->split = 0;
+  options->throughput = 0;
+  options->schedule = SCHEDULE_FIFO;
+  options->local_compute = 0;
+  options->pin = PIN_NONE;
+  options->auto_granularity = 0;
+  options->clients = 1;
+  options->tile_cache = 0;
+  options->worker_cache = 0;
+  options->reuse = 0;
+  options->tile_store[0] = '\0';
+  options->tile_store_size = OPTIONS_DEFAULT_TILE_STORE_SIZE;
+  options->hints = 0;
+
+  optind = 1;
+  opterr = 0; // every rank parses argv, let the caller report errors once
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+    case OPTION_PREFETCH:
+      if (parse_int(optarg, 0, OPTIONS_MAX_PREFETCH, &options->prefetch) < 0) return -1;
+      break;
+    case OPTION_DISPATCH: {
+      int dispatch = parse_name(optarg, dispatch_names, DISPATCH_COUNT);
+      if (dispatch < 0) return -1;
+      options->dispatch = (dispatch_mode_t)dispatch;
+      break;
+    }
+    case OPTION_GROUP_SIZE:
+      if (parse_int(optarg, 1, 1 << 20, &options->group_size) < 0) return -1;
+      break;
+    case OPTION_ENCODING: {
+      int encoding = parse_name(optarg, encoding_names, ENCODING_COUNT);
+      if (encoding < 0) return -1;
+      options->encoding = (encoding_mode_t)encoding;
+      break;
+    }
+    case OPTION_SHARED_FRAMEBUFFER:
+      if (parse_int(optarg, 1, OPTIONS_MAX_FRAMEBUFFER, &options->framebuffer) < 0) return -1;
+      break;
+    case OPTION_BATCH:
+      if (parse_viewport(optarg, &options->batch_viewport) < 0) return -1;
+      options->batch = 1;
+      break;
+    case OPTION_BATCH_BLOCK:
+      if (parse_int(optarg, 1, 1 << 20, &options->batch_block) < 0) return -1;
+      break;
+    case OPTION_SPECULATE:
+      options->speculate = 1;
+      break;
+    case OPTION_SPLIT:
+      options->split = 1;
+      break;
+    case OPTION_THROUGHPUT:
+      options->throughput = 1;
+      break;
+    case OPTION_SCHEDULE: {
+      int schedule = parse_name(optarg, schedule_names, SCHEDULE_COUNT);
+      if (schedule < 0) return -1;
+      options->schedule = (schedule_policy_t)schedule;
+      break;
+    }
+    case OPTION_LOCAL_COMPUTE:
+      options->local_compute = 1;
+      break;
+    case OPTION_PIN: {
+      int pin = parse_name(optarg, pin_names, PIN_COUNT);
+      if (pin < 0) return -1;
+      options->pin = (pin_mode_t)pin;
+      break;
+    }
+    case OPTION_AUTO_GRANULARITY:
+      options->auto_granularity = 1;
+      break;
+    case OPTION_CLIENTS:
+      if (parse_int(optarg, 1, OPTIONS_MAX_CLIENTS, &options->clients) < 0) return -1;
+      break;
+    case OPTION_TILE_CACHE:
+      if (parse_int(optarg, 1, OPTIONS_MAX_TILE_CACHE, &options->tile_cache) < 0) return -1;
+      break;
+    case OPTION_WORKER_CACHE:
+      if (parse_int(optarg, 1, OPTIONS_MAX_TILE_CACHE, &options->worker_cache) < 0) return -1;
+      break;
+    case OPTION_REUSE:
+      options->reuse = 1;
+      break;
+    case OPTION_TILE_STORE:
+      if (optarg[0] == '\0' || strlen(optarg) >= OPTIONS_MAX_PATH) return -1;
+      strcpy(options->tile_store, optarg);
+      break;
+    case OPTION_TILE_STORE_SIZE:
+      if (parse_int(optarg, 1, OPTIONS_MAX_TILE_CACHE, &options->tile_store_size) < 0) return -1;
+      break;
+    case OPTION_HINTS:
+      options->hints = 1;
+      break;
+    case OPTION_BATCH_OUTPUT:
+      if (optarg[0] == '\0' || strlen(optarg) >= OPTIONS_MAX_PATH) return -1;
+      strcpy(options->batch_output, optarg);
+      break;
+    case OPTION_ANIMATE:
+      if (optarg[0] == '\0' || strlen(optarg) >= OPTIONS_MAX_PATH) return -1;
+      strcpy(options->animate, optarg);
+      break;
+    case 'h':
+    default:
+      return -1;
+    }
+  }
+
+  // the modules that follow a single generation at a time cannot be shared
+  if (options->clients > 1 &&
+      (options->dispatch == DISPATCH_RMA || options->dispatch == DISPATCH_STEAL ||
+       options->speculate || options->split || options->throughput || options->framebuffer > 0)) {
+    return -1;
+  }
+
+  // cached tiles are answered when rank 0 discretizes the payload, which
+  // the workers do themselves with the rma and steal dispatches
+  if (options->tile_cache > 0 &&
+      (options->dispatch == DISPATCH_RMA || options->dispatch == DISPATCH_STEAL)) {
+    return -1;
+  }
+
+  // held tiles are sent aside from the tile requests of the queue dispatch
+  if (options->worker_cache > 0 && (options->dispatch != DISPATCH_QUEUE || options->speculate)) {
+    return -1;
+  }
+
+  // pieces of the previous frame are put together by rank 0 alone, once per tile
+  if (options->reuse &&
+      (options->dispatch == DISPATCH_RMA || options->dispatch == DISPATCH_STEAL ||
+       options->speculate || options->split || options->throughput ||
+       options->framebuffer > 0 || options->clients > 1)) {
+    return -1;
+  }
+
+  // hint tiles travel among the real ones and only end up in the tile cache
+  if (options->hints &&
+      (options->tile_cache == 0 || options->dispatch != DISPATCH_QUEUE ||
+       options->speculate || options->split || options->throughput || options->local_compute ||
+       options->worker_cache > 0 || options->framebuffer > 0 || options->clients > 1)) {
+    return -1;
+  }
+
+  // the image goes to the file tile by tile, rank 0 never holds it for the tile store
+  if (options->batch_output[0] != '\0' && (!options->batch || options->tile_store[0] != '\0')) {
+    return -1;
+  }
+
+  // the frames of an animation are numbered files named after the output
+  if (options->animate[0] != '\0' && options->batch_output[0] == '\0') {
+    return -1;
+  }
+
+  // the only positional argument is the port, batch runs need none
+  if (options->batch && argc == optind) {
+    return 0;
+  }
+  if (argc - optind != 1) {
+    return -1;
+  }
+  int port;
+  if (parse_int(argv[optind], 1, 65535, &port) < 0) {
+    return -1;
+  }
+  options->port = (uint16_t)port;
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+#include "placement.h"
+
+#define PLACEMENT_REPORT 256 // characters of the mapping of one rank
+
+typedef struct {
+  int cpu;
+  int package; // socket
+  int core;    // core id, hardware threads of a core share it
+} cpu_t;
+
+/* integer in the sysfs topology of cpu, fallback if there is none */
+static int topology_read (int cpu, const char *name, int fallback)
+{
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return fallback;
+  }
+  int value;
+  if (fscanf(file, "%d", &value) != 1) {
+    value = fallback;
+  }
+  fclose(file);
+  return value;
+}
+
+static int cpu_compare (const void *a, const void *b)
+{
+  const cpu_t *x = a, *y = b;
+  if (x->package != y->package) return x->package - y->package;
+  if (x->core != y->core) return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+/* set as "0-3,8" */
+static void cpu_list (const cpu_set_t *set, char *buffer, size_t size)
+{
+  size_t used = 0;
+  buffer[0] = '\0';
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, set)) continue;
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+    int n = last == cpu ?
+      snprintf(buffer + used, size - used, "%s%d", used ? "," : "", cpu) :
+      snprintf(buffer + used, size - used, "%s%d-%d", used ? "," : "", cpu, last);
+    if (n < 0 || (size_t)n >= size - used) break;
+    used += n;
+    cpu = last;
+  }
+}
+
+/* sockets of the CPUs in set, as "0,1" */
+static void package_list (const cpu_set_t *set, char *buffer, size_t size)
+{
+  cpu_set_t packages; // reused as a set of package ids
+  CPU_ZERO(&packages);
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, set)) {
+      int package = topology_read(cpu, "physical_package_id", 0);
+      if (package >= 0 && package < CPU_SETSIZE) CPU_SET(package, &packages);
+    }
+  }
+  cpu_list(&packages, buffer, size);
+}
+
+/* CPUs of the worker at index worker among the workers of a node, or
+   of rank 0 when worker is -1. coordinator_node if rank 0 is on it. */
+static void placement_choose (pin_mode_t mode, const cpu_set_t *usable, bool coordinator_node,
+                              int worker, cpu_set_t *chosen)
+{
+  static cpu_t cpus[CPU_SETSIZE];
+  static int core_first[CPU_SETSIZE + 1]; // cpus of core c: [core_first[c], core_first[c+1])
+  int count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, usable)) continue;
+    cpus[count].cpu = cpu;
+    cpus[count].package = topology_read(cpu, "physical_package_id", 0);
+    cpus[count].core = topology_read(cpu, "core_id", cpu);
+    count++;
+  }
+  qsort(cpus, count, sizeof(cpu_t), cpu_compare);
+
+  int cores = 0;
+  for (int i = 0; i < count; i++) {
+    if (i == 0 || cpus[i].package != cpus[i-1].package || cpus[i].core != cpus[i-1].core) {
+      core_first[cores++] = i;
+    }
+  }
+  core_first[cores] = count;
+
+  // The last core goes to rank 0, unless it is the only one
+  int worker_cores = coordinator_node && cores > 1 ? cores - 1 : cores;
+  int first, last; // cores to pin to
+  if (worker < 0) {
+    first = last = cores - 1;
+  } else if (mode == PIN_CORE) {
+    first = last = worker % worker_cores;
+  } else {
+    // PIN_SOCKET: workers take the sockets in turn
+    int sockets = 0;
+    for (int c = 0; c < worker_cores; c++) {
+      if (c == 0 || cpus[core_first[c]].package != cpus[core_first[c-1]].package) sockets++;
+    }
+    int socket = worker % sockets, seen = -1;
+    first = last = -1;
+    for (int c = 0; c < worker_cores; c++) {
+      if (c == 0 || cpus[core_first[c]].package != cpus[core_first[c-1]].package) seen++;
+      if (seen == socket) {
+        if (first < 0) first = c;
+        last = c;
+      }
+    }
+  }
+
+  CPU_ZERO(chosen);
+  for (int i = core_first[first]; i < core_first[last + 1]; i++) {
+    CPU_SET(cpus[i].cpu, chosen);
+  }
+}
+
+void placement_init (pin_mode_t mode)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  MPI_Comm node;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+  int node_rank, node_root;
+  MPI_Comm_rank(node, &node_rank);
+  MPI_Allreduce(&rank, &node_root, 1, MPI_INT, MPI_MIN, node);
+
+  // What mpirun left to the ranks of this node, together
+  cpu_set_t mine, usable;
+  CPU_ZERO(&mine);
+  if (sched_getaffinity(0, sizeof(mine), &mine) < 0) {
+    perror("sched_getaffinity");
+  }
+  MPI_Allreduce(&mine, &usable, sizeof(cpu_set_t), MPI_BYTE, MPI_BOR, node);
+  MPI_Comm_free(&node);
+
+  if (mode != PIN_NONE) {
+    // rank 0 comes first on its node, its workers are numbered after it
+    int worker = rank == 0 ? -1 : node_rank - (node_root == 0 ? 1 : 0);
+    cpu_set_t chosen;
+    placement_choose(mode, &usable, node_root == 0, worker, &chosen);
+    // threads created afterwards inherit it, those of rank 0 included
+    if (sched_setaffinity(0, sizeof(chosen), &chosen) < 0) {
+      perror("sched_setaffinity");
+    } else {
+      mine = chosen;
+    }
+  }
+
+  char host[MPI_MAX_PROCESSOR_NAME];
+  int length;
+  MPI_Get_processor_name(host, &length);
+  char cpus[128], packages[32];
+  cpu_list(&mine, cpus, sizeof(cpus));
+  package_list(&mine, packages, sizeof(packages));
+  char report[PLACEMENT_REPORT];
+  snprintf(report, sizeof(report), "%.64s: cpus %s, socket %s", host, cpus, packages);
+
+  char *reports = NULL;
+  if (rank == 0) {
+    reports = malloc((size_t)size * PLACEMENT_REPORT);
+    if (reports == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  MPI_Gather(report, PLACEMENT_REPORT, MPI_CHAR, reports, PLACEMENT_REPORT, MPI_CHAR, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("Placement: %s\n", options_pin_name(mode));
+    for (int i = 0; i < size; i++) {
+      printf("\t rank %d%s on %s\n", i, i == 0 ? " (coordinator threads)" : "",
+             reports + (size_t)i * PLACEMENT_REPORT);
+    }
+    free(reports);
+  }
+}
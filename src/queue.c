@@ -103,6 +103,46 @@ void* queue_try_dequeue(queue_t *q) {
     return item;
 }
 
+void* queue_try_dequeue_keep(queue_t *q, size_t keep) {
+    pthread_mutex_lock(&q->mutex);
+
+    size_t size = (q->back - q->front + q->buffer_size) % q->buffer_size;
+    if (size <= keep || q->queue[q->front] == NULL) {
+        pthread_mutex_unlock(&q->mutex);
+        return NULL;
+    }
+
+    void *item = q->queue[q->front];
+    q->front = (q->front + 1) % q->buffer_size;
+    pthread_mutex_unlock(&q->mutex);
+
+    return item;
+}
+
+size_t queue_dequeue_many(queue_t *q, void **items, size_t max) {
+    pthread_mutex_lock(&q->mutex);
+
+    while (q->front == q->back) { // Queue empty, wait for enqueue
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+
+    size_t count = 0;
+    while (count < max && q->front != q->back) {
+        void *item = q->queue[q->front];
+        if (item == NULL && count > 0) {
+            break; // leave the poison pill for the next call
+        }
+        items[count++] = item;
+        q->front = (q->front + 1) % q->buffer_size;
+        if (item == NULL) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return count;
+}
+
 size_t queue_size(queue_t *q) {
     pthread_mutex_lock(&q->mutex);
     size_t size = (q->back - q->front + q->buffer_size) % q->buffer_size;
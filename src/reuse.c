@@ -0,0 +1,413 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include "reuse.h"
+#include "codec.h"
+
+/* the pixels of the screen of a generation, row after row */
+typedef struct {
+  payload_t origin;
+  int width;
+  int height;
+  int *values;
+  long long filled; // pixels in so far
+} reuse_frame_t;
+
+/* a tile whose pieces are coming back */
+typedef struct {
+  response_t *response; // the copied pixels and the pieces in so far
+  int missing;          // pieces still to come
+} reuse_parent_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static reuse_frame_t current;  // of the generation being sent
+static reuse_frame_t previous; // the last complete one
+// pixel (x, y) of current is pixel (shift_x + ratio * x, shift_y + ratio * y) of previous
+static bool mapped = false;
+static int ratio, shift_x, shift_y;
+static int length = 0;
+static reuse_parent_t *parents = NULL; // by discretization index
+static reuse_stats_t stats;
+
+void reuse_init (void)
+{
+  memset(&current, 0, sizeof(current));
+  memset(&previous, 0, sizeof(previous));
+  current.origin.generation = -1;
+  previous.origin.generation = -1;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void reuse_clear (void)
+{
+  for (int i = 0; i < length; i++) {
+    if (parents[i].response != NULL) {
+      free_response(parents[i].response);
+      parents[i].response = NULL;
+    }
+  }
+}
+
+void reuse_finalize (void)
+{
+  reuse_clear();
+  free(parents);
+  free(current.values);
+  free(previous.values);
+  parents = NULL;
+  length = 0;
+  current.values = previous.values = NULL;
+}
+
+static int stride_of (const payload_t *tile)
+{
+  return tile->stride > 1 ? tile->stride : 1;
+}
+
+static int floor_div (int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static bool frame_complete (const reuse_frame_t *frame)
+{
+  return frame->values != NULL && frame->filled == (long long)frame->width * frame->height;
+}
+
+bool reuse_map (const payload_t *from, const payload_t *to,
+                int *ratio_out, int *shift_x_out, int *shift_y_out)
+{
+  const payload_t *f = from;
+  int from_width = f->s_ur.x - f->s_ll.x;
+  int from_height = f->s_ur.y - f->s_ll.y;
+  int width = to->s_ur.x - to->s_ll.x;
+  int height = to->s_ur.y - to->s_ll.y;
+  if (from_width <= 0 || from_height <= 0 || width <= 0 || height <= 0 ||
+      f->fractal_depth != to->fractal_depth || f->palette != to->palette ||
+      stride_of(f) != stride_of(to)) {
+    return false;
+  }
+
+  // Fractal size of a pixel, before and now
+  long double from_x = (f->ur.real - f->ll.real) / from_width;
+  long double from_y = (f->ur.imag - f->ll.imag) / from_height;
+  long double to_x = (to->ur.real - to->ll.real) / width;
+  long double to_y = (to->ur.imag - to->ll.imag) / height;
+  if (from_x <= 0 || from_y <= 0) {
+    return false;
+  }
+  long double r = roundl(to_x / from_x);
+  if (r < 1 || r > from_width ||
+      fabsl(to_x / from_x - r) * width > REUSE_TOLERANCE ||
+      fabsl(to_y / from_y - r) * height > REUSE_TOLERANCE) {
+    return false;
+  }
+  long double sx = (to->ll.real - f->ll.real) / from_x;
+  long double sy = (to->ll.imag - f->ll.imag) / from_y;
+  if (fabsl(sx) > INT_MAX / 2 || fabsl(sy) > INT_MAX / 2 ||
+      fabsl(sx - roundl(sx)) > REUSE_TOLERANCE ||
+      fabsl(sy - roundl(sy)) > REUSE_TOLERANCE) {
+    return false;
+  }
+  *ratio_out = (int)r;
+  *shift_x_out = (int)roundl(sx);
+  *shift_y_out = (int)roundl(sy);
+  return true;
+}
+
+/* whether the pixels of to fall on those of from, sets the mapping */
+static bool map_frame (const reuse_frame_t *from, const payload_t *to)
+{
+  return frame_complete(from) && reuse_map(&from->origin, to, &ratio, &shift_x, &shift_y);
+}
+
+/* discretization index of the tile that contains tile, or -1. Mutex held. */
+static int parent_index (const payload_t *tile)
+{
+  const payload_t *origin = &current.origin;
+  int g = origin->granularity;
+  if (tile->generation != origin->generation || g <= 0 ||
+      tile->fractal_depth != origin->fractal_depth || stride_of(tile) != stride_of(origin)) {
+    return -1; // only the full quality pass of a latency budget is reused
+  }
+  int amount_y = (origin->s_ur.y - origin->s_ll.y + g - 1) / g;
+  int i = (tile->s_ll.x - origin->s_ll.x) / g;
+  int j = (tile->s_ll.y - origin->s_ll.y) / g;
+  int index = i * amount_y + j;
+  return (i >= 0 && j >= 0 && j < amount_y && index < length) ? index : -1;
+}
+
+void reuse_begin (const payload_t *origin)
+{
+  pthread_mutex_lock(&mutex);
+  reuse_clear();
+  int new_length = discretize_length(origin);
+  if (new_length > length) {
+    free(parents);
+    parents = calloc(new_length, sizeof(reuse_parent_t));
+    if (parents == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  length = new_length;
+
+  // An incomplete frame is dropped, the one before stays
+  if (frame_complete(&current)) {
+    reuse_frame_t frame = previous;
+    previous = current;
+    current = frame;
+  }
+  mapped = map_frame(&previous, origin);
+
+  int width = origin->s_ur.x - origin->s_ll.x;
+  int height = origin->s_ur.y - origin->s_ll.y;
+  if (width < 0) width = 0;
+  if (height < 0) height = 0;
+  if ((long long)width * height != (long long)current.width * current.height) {
+    free(current.values);
+    current.values = width * height > 0 ? malloc((size_t)width * height * sizeof(int)) : NULL;
+    if (width * height > 0 && current.values == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  current.origin = *origin;
+  current.width = width;
+  current.height = height;
+  current.filled = 0;
+  memset(&stats, 0, sizeof(stats));
+  pthread_mutex_unlock(&mutex);
+}
+
+/* square pieces of tile over what [ix0, ix1) x [iy0, iy1) of its pixels
+   leaves uncovered, returns their number, 0 if the tile had better be
+   computed whole */
+static int cut_strips (const payload_t *tile, int ix0, int ix1, int iy0, int iy1,
+                       payload_t *pieces)
+{
+  int g = tile->granularity;
+  int strips[4][4] = { // x, y, width and height of each strip
+    {0, 0, ix0, g},                 // left
+    {ix1, 0, g - ix1, g},           // right
+    {ix0, 0, ix1 - ix0, iy0},       // below
+    {ix0, iy1, ix1 - ix0, g - iy1}, // above
+  };
+
+  // Same fractal step per pixel as the tile, pieces stay inside of it
+  double real_step = (tile->ur.real - tile->ll.real) / g;
+  double imag_step = (tile->ur.imag - tile->ll.imag) / g;
+  int count = 0;
+  for (int s = 0; s < 4; s++) {
+    int x = strips[s][0], y = strips[s][1], w = strips[s][2], h = strips[s][3];
+    if (w <= 0 || h <= 0) {
+      continue;
+    }
+    int side = w < h ? w : h;
+    if (side < REUSE_MIN_PIECE) side = REUSE_MIN_PIECE;
+    if (side >= g) {
+      return 0;
+    }
+    for (int py = y; py < y + h; py += side) {
+      for (int px = x; px < x + w; px += side) {
+        if (count == REUSE_MAX_PIECES) {
+          return 0;
+        }
+        int qx = px < g - side ? px : g - side;
+        int qy = py < g - side ? py : g - side;
+        payload_t *piece = &pieces[count++];
+        *piece = *tile;
+        piece->granularity = side;
+        piece->s_ll.x = tile->s_ll.x + qx;
+        piece->s_ll.y = tile->s_ll.y + qy;
+        piece->s_ur.x = piece->s_ll.x + side;
+        piece->s_ur.y = piece->s_ll.y + side;
+        piece->ll.real = tile->ll.real + real_step * qx;
+        piece->ll.imag = tile->ll.imag + imag_step * qy;
+        piece->ur.real = piece->ll.real + real_step * side;
+        piece->ur.imag = piece->ll.imag + imag_step * side;
+      }
+    }
+  }
+  return count;
+}
+
+response_t *reuse_tile (const payload_t *tile, payload_t *pieces, int *count)
+{
+  *count = 0;
+  pthread_mutex_lock(&mutex);
+  int index = mapped ? parent_index(tile) : -1;
+  if (index < 0 || tile->granularity != current.origin.granularity) {
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+  }
+
+  // The tile and the pixels that fall on the previous frame, on the screen
+  int g = tile->granularity;
+  int x0 = tile->s_ll.x - current.origin.s_ll.x;
+  int y0 = tile->s_ll.y - current.origin.s_ll.y;
+  int cx0 = -floor_div(shift_x, ratio);
+  int cy0 = -floor_div(shift_y, ratio);
+  int cx1 = floor_div(previous.width - 1 - shift_x, ratio) + 1;
+  int cy1 = floor_div(previous.height - 1 - shift_y, ratio) + 1;
+  if (cx0 < x0) cx0 = x0;
+  if (cy0 < y0) cy0 = y0;
+  if (cx1 > x0 + g) cx1 = x0 + g;
+  if (cy1 > y0 + g) cy1 = y0 + g;
+  if (cx0 >= cx1 || cy0 >= cy1) {
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+  }
+
+  bool whole = cx0 == x0 && cy0 == y0 && cx1 == x0 + g && cy1 == y0 + g;
+  if (!whole) {
+    *count = cut_strips(tile, cx0 - x0, cx1 - x0, cy0 - y0, cy1 - y0, pieces);
+    if (*count == 0) {
+      pthread_mutex_unlock(&mutex);
+      return NULL;
+    }
+  }
+
+  response_t *response = calloc(1, sizeof(response_t));
+  if (response == NULL || (response->values = calloc(g * g, sizeof(int))) == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  response->payload = *tile;
+  for (int y = cy0; y < cy1; y++) {
+    const int *row = previous.values + (size_t)(shift_y + ratio * y) * previous.width;
+    for (int x = cx0; x < cx1; x++) {
+      response->values[(y - y0) * g + (x - x0)] = row[shift_x + ratio * x];
+    }
+  }
+  stats.pixels += (long long)(cx1 - cx0) * (cy1 - cy0);
+
+  if (whole) {
+    stats.answered++;
+    pthread_mutex_unlock(&mutex);
+    return response;
+  }
+  if (parents[index].response != NULL) {
+    free_response(parents[index].response);
+  }
+  parents[index].response = response;
+  parents[index].missing = *count;
+  stats.partial++;
+  stats.pieces += *count;
+  pthread_mutex_unlock(&mutex);
+  return NULL;
+}
+
+bool reuse_is_piece (const response_t *response)
+{
+  pthread_mutex_lock(&mutex);
+  bool ret = response->payload.generation == current.origin.generation &&
+             response->payload.granularity != current.origin.granularity;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+response_t *reuse_collect (response_t *piece)
+{
+  response_t *ret = NULL;
+  if (piece->encoded_size > 0 && response_decode(piece) < 0) {
+    fprintf(stderr, "Malformed piece, dropping it.\n");
+    free_response(piece);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mutex);
+  int index = parent_index(&piece->payload);
+  if (index >= 0 && parents[index].response != NULL) {
+    reuse_parent_t *entry = &parents[index];
+    response_t *parent = entry->response;
+    int g = parent->payload.granularity;
+    int h = piece->payload.granularity;
+    int x0 = piece->payload.s_ll.x - parent->payload.s_ll.x;
+    int y0 = piece->payload.s_ll.y - parent->payload.s_ll.y;
+    for (int y = 0; y < h; y++) {
+      memcpy(parent->values + (y0 + y) * g + x0, piece->values + y * h, h * sizeof(int));
+    }
+    parent->worker_id = piece->worker_id;
+    parent->max_worker_id = piece->max_worker_id;
+    parent->iterations += piece->iterations;
+    parent->compute_time += piece->compute_time;
+    entry->missing--;
+    if (entry->missing == 0) {
+      ret = parent;
+      entry->response = NULL;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+
+  free_response(piece);
+  return ret;
+}
+
+void reuse_record (const response_t *response)
+{
+  const payload_t *tile = &response->payload;
+  int g = tile->granularity;
+  const int *values = response->values;
+  int *decoded = NULL;
+  if (response->encoded_size > 0) { // as it goes to the client
+    decoded = malloc((size_t)g * g * sizeof(int));
+    if (decoded == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    if (codec_decode(response->encoded, response->encoded_size, decoded, g, g) < 0) {
+      free(decoded);
+      return;
+    }
+    values = decoded;
+  }
+
+  pthread_mutex_lock(&mutex);
+  const payload_t *origin = &current.origin;
+  int x0 = tile->s_ll.x - origin->s_ll.x;
+  int y0 = tile->s_ll.y - origin->s_ll.y;
+  if (values != NULL && current.values != NULL &&
+      tile->generation == origin->generation && g == origin->granularity &&
+      tile->fractal_depth == origin->fractal_depth && stride_of(tile) == stride_of(origin) &&
+      x0 >= 0 && y0 >= 0 && x0 < current.width && y0 < current.height) {
+    // Tiles of the last column and row go past the screen
+    int columns = x0 + g > current.width ? current.width - x0 : g;
+    int rows = y0 + g > current.height ? current.height - y0 : g;
+    for (int y = 0; y < rows; y++) {
+      memcpy(current.values + (size_t)(y0 + y) * current.width + x0, values + y * g,
+             columns * sizeof(int));
+    }
+    current.filled += (long long)rows * columns;
+  }
+  pthread_mutex_unlock(&mutex);
+  free(decoded);
+}
+
+reuse_stats_t reuse_stats (void)
+{
+  pthread_mutex_lock(&mutex);
+  reuse_stats_t ret = stats;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
@@ -0,0 +1,190 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "schedule.h"
+#include "mandelbrot.h"
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static schedule_policy_t current = SCHEDULE_FIFO;
+// factoring: chunks left in the current round, and their size
+static int round_left = 0;
+static int round_chunk = 1;
+
+/* a tile and the key it is sorted by */
+typedef struct {
+  long long key;
+  int index; // discretization order, between equal keys
+  payload_t *tile;
+} schedule_key_t;
+
+static int compare_index (const schedule_key_t *a, const schedule_key_t *b)
+{
+  return (a->index > b->index) - (a->index < b->index);
+}
+
+static int compare_descending (const void *a, const void *b)
+{
+  const schedule_key_t *ka = a, *kb = b;
+  if (ka->key != kb->key) return (ka->key < kb->key) ? 1 : -1;
+  return compare_index(ka, kb);
+}
+
+static int compare_ascending (const void *a, const void *b)
+{
+  const schedule_key_t *ka = a, *kb = b;
+  if (ka->key != kb->key) return (ka->key > kb->key) ? 1 : -1;
+  return compare_index(ka, kb);
+}
+
+/* sort tiles by key(origin, tile) with compare */
+static void sort_tiles (const payload_t *origin, payload_t **tiles, int length,
+                        long long (*key) (const payload_t *, const payload_t *),
+                        int (*compare) (const void *, const void *))
+{
+  schedule_key_t *keys = malloc(length * sizeof(schedule_key_t));
+  if (keys == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  for (int i = 0; i < length; i++) {
+    keys[i].key = key(origin, tiles[i]);
+    keys[i].index = i;
+    keys[i].tile = tiles[i];
+  }
+  qsort(keys, length, sizeof(schedule_key_t), compare);
+  for (int i = 0; i < length; i++) {
+    tiles[i] = keys[i].tile;
+  }
+  free(keys);
+}
+
+long long schedule_probe (const payload_t *tile)
+{
+  // the center and the centers of the four quarters
+  static const double fractions[SCHEDULE_PROBE_POINTS][2] = {
+    {0.5, 0.5}, {0.25, 0.25}, {0.75, 0.25}, {0.25, 0.75}, {0.75, 0.75},
+  };
+  long double width = tile->ur.real - tile->ll.real;
+  long double height = tile->ur.imag - tile->ll.imag;
+  long long cost = 0;
+  for (int i = 0; i < SCHEDULE_PROBE_POINTS; i++) {
+    cost += mandelbrot(tile->ll.real + width * fractions[i][0],
+                       tile->ll.imag + height * fractions[i][1],
+                       tile->fractal_depth);
+  }
+  return cost;
+}
+
+static long long probe_key (const payload_t *origin, const payload_t *tile)
+{
+  (void)origin;
+  return schedule_probe(tile);
+}
+
+/* position of tile on a Z-order curve over the tile grid */
+static long long morton_key (const payload_t *origin, const payload_t *tile)
+{
+  uint32_t i = (uint32_t)(tile->s_ll.x - origin->s_ll.x) / origin->granularity;
+  uint32_t j = (uint32_t)(tile->s_ll.y - origin->s_ll.y) / origin->granularity;
+  long long key = 0;
+  for (int bit = 0; bit < 16; bit++) {
+    key |= (long long)((i >> bit) & 1) << (2 * bit);
+    key |= (long long)((j >> bit) & 1) << (2 * bit + 1);
+  }
+  return key;
+}
+
+static void order_largest_first (const payload_t *origin, payload_t **tiles, int length)
+{
+  sort_tiles(origin, tiles, length, probe_key, compare_descending);
+}
+
+static void order_locality (const payload_t *origin, payload_t **tiles, int length)
+{
+  sort_tiles(origin, tiles, length, morton_key, compare_ascending);
+}
+
+static int chunk_one (int remaining, int workers)
+{
+  (void)remaining;
+  (void)workers;
+  return 1;
+}
+
+static int chunk_guided (int remaining, int workers)
+{
+  return (remaining + workers - 1) / workers;
+}
+
+/* called with mutex held */
+static int chunk_factoring (int remaining, int workers)
+{
+  if (round_left == 0) {
+    round_chunk = (remaining + 2 * workers - 1) / (2 * workers);
+    round_left = workers;
+  }
+  round_left--;
+  return round_chunk;
+}
+
+static const schedule_t policies[] = {
+  [SCHEDULE_FIFO] = {NULL, chunk_one},
+  [SCHEDULE_GUIDED] = {NULL, chunk_guided},
+  [SCHEDULE_FACTORING] = {NULL, chunk_factoring},
+  [SCHEDULE_LARGEST_FIRST] = {order_largest_first, chunk_one},
+  [SCHEDULE_LOCALITY] = {order_locality, chunk_factoring},
+};
+#define POLICY_COUNT (int)(sizeof(policies) / sizeof(policies[0]))
+
+schedule_policy_t schedule_policy (const payload_t *origin, schedule_policy_t fallback)
+{
+  if (origin->schedule > SCHEDULE_DEFAULT && origin->schedule < POLICY_COUNT) {
+    return (schedule_policy_t)origin->schedule;
+  }
+  return fallback;
+}
+
+void schedule_generation (schedule_policy_t policy, const payload_t *origin,
+                          payload_t **tiles, int length)
+{
+  if (policy <= SCHEDULE_DEFAULT || policy >= POLICY_COUNT) {
+    policy = SCHEDULE_FIFO;
+  }
+  if (policies[policy].order != NULL && length > 1) {
+    policies[policy].order(origin, tiles, length);
+  }
+  pthread_mutex_lock(&mutex);
+  current = policy;
+  round_left = 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+int schedule_chunk (int remaining, int workers)
+{
+  if (remaining < 1) remaining = 1;
+  if (workers < 1) workers = 1;
+  pthread_mutex_lock(&mutex);
+  int chunk = policies[current].chunk(remaining, workers);
+  pthread_mutex_unlock(&mutex);
+  if (chunk < 1) chunk = 1;
+  if (chunk > SCHEDULE_MAX_CHUNK) chunk = SCHEDULE_MAX_CHUNK;
+  return chunk;
+}
@@ -0,0 +1,179 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "speculate.h"
+
+typedef enum {
+  TILE_QUEUED = 0, // not sent yet
+  TILE_SENT,       // on a worker, maybe with a copy on another one
+  TILE_ANSWERED,
+} tile_state_t;
+
+typedef struct {
+  tile_state_t state;
+  int holder; // worker computing the original
+  int copy;   // worker computing the copy, 0 if none
+} tile_track_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static payload_t origin;
+static int length = 0;
+static tile_track_t *tiles = NULL;
+static int *order = NULL; // tile indices in the order they were sent
+static int sent = 0;      // entries of order
+static int oldest = 0;    // order before this entry is answered
+static int outstanding = 0;
+static speculate_stats_t stats;
+
+void speculate_init (void)
+{
+  memset(&origin, 0, sizeof(origin));
+  origin.generation = -1;
+}
+
+void speculate_finalize (void)
+{
+  free(tiles);
+  free(order);
+  tiles = NULL;
+  order = NULL;
+  length = 0;
+}
+
+/* discretization index of tile, -1 if it is not a tile of origin */
+static int tile_index (const payload_t *tile)
+{
+  if (tile->generation != origin.generation || origin.granularity <= 0 ||
+      tile->granularity != origin.granularity) { // pieces of split tiles are not tracked
+    return -1;
+  }
+  if (tile->fractal_depth != origin.fractal_depth || tile->stride != origin.stride) {
+    return -1; // nor the rougher passes of a latency budget
+  }
+  int amount_y = (origin.s_ur.y - origin.s_ll.y + origin.granularity - 1) / origin.granularity;
+  int i = (tile->s_ll.x - origin.s_ll.x) / origin.granularity;
+  int j = (tile->s_ll.y - origin.s_ll.y) / origin.granularity;
+  int index = i * amount_y + j;
+  return (index >= 0 && index < length) ? index : -1;
+}
+
+void speculate_reset (const payload_t *new_origin)
+{
+  pthread_mutex_lock(&mutex);
+  int new_length = discretize_length(new_origin);
+  if (new_length > length) {
+    free(tiles);
+    free(order);
+    tiles = malloc(new_length * sizeof(tile_track_t));
+    order = malloc(new_length * sizeof(int));
+    if (tiles == NULL || order == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  origin = *new_origin;
+  length = new_length;
+  if (length > 0) {
+    memset(tiles, 0, length * sizeof(tile_track_t));
+  }
+  sent = 0;
+  oldest = 0;
+  outstanding = 0;
+  stats = (speculate_stats_t) {0};
+  pthread_mutex_unlock(&mutex);
+}
+
+void speculate_sent (const payload_t *tile, int worker)
+{
+  pthread_mutex_lock(&mutex);
+  int index = tile_index(tile);
+  // The answer may already be here if the worker was fast
+  if (index >= 0 && tiles[index].state == TILE_QUEUED) {
+    tiles[index].state = TILE_SENT;
+    tiles[index].holder = worker;
+    order[sent++] = index;
+    outstanding++;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+int speculate_outstanding (int generation)
+{
+  pthread_mutex_lock(&mutex);
+  int ret = (generation == origin.generation) ? outstanding : 0;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+bool speculate_pick (int generation, int worker, payload_t *tile)
+{
+  bool ret = false;
+  pthread_mutex_lock(&mutex);
+  if (generation == origin.generation) {
+    while (oldest < sent && tiles[order[oldest]].state == TILE_ANSWERED) {
+      oldest++;
+    }
+    for (int i = oldest; i < sent; i++) {
+      tile_track_t *track = &tiles[order[i]];
+      if (track->state == TILE_SENT && track->copy == 0 && track->holder != worker) {
+        track->copy = worker;
+        stats.copies++;
+        discretize_tile(&origin, order[i], tile);
+        ret = true;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+bool speculate_received (const response_t *response)
+{
+  bool ret = true;
+  pthread_mutex_lock(&mutex);
+  int index = tile_index(&response->payload);
+  if (index >= 0) {
+    tile_track_t *track = &tiles[index];
+    if (track->state == TILE_ANSWERED) {
+      stats.dropped++;
+      ret = false;
+    } else {
+      if (track->state == TILE_SENT) {
+        outstanding--;
+      }
+      if (track->copy != 0 && response->worker_id == track->copy) {
+        stats.wins++;
+      }
+      track->state = TILE_ANSWERED;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+speculate_stats_t speculate_stats (void)
+{
+  pthread_mutex_lock(&mutex);
+  speculate_stats_t ret = stats;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
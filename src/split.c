@@ -0,0 +1,217 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "split.h"
+#include "codec.h"
+
+/* an original tile whose pieces are coming back */
+typedef struct {
+  response_t *response; // the values of the pieces in so far
+  char *covered;        // by pixel of the tile, pieces cut again may overlap
+  long long missing;    // pixels of the tile still to come
+} split_parent_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static payload_t origin;
+static int length = 0;
+static split_parent_t *parents = NULL; // by discretization index
+
+void split_init (void)
+{
+  memset(&origin, 0, sizeof(origin));
+  origin.generation = -1;
+}
+
+static void split_clear (void)
+{
+  for (int i = 0; i < length; i++) {
+    if (parents[i].response != NULL) {
+      free_response(parents[i].response);
+      parents[i].response = NULL;
+    }
+    free(parents[i].covered);
+    parents[i].covered = NULL;
+  }
+}
+
+void split_finalize (void)
+{
+  split_clear();
+  free(parents);
+  parents = NULL;
+  length = 0;
+}
+
+/* discretization index of the original tile that contains tile, or -1 */
+static int parent_index (const payload_t *tile)
+{
+  int g = origin.granularity;
+  if (tile->generation != origin.generation || g <= 0 ||
+      tile->fractal_depth != origin.fractal_depth || tile->stride != origin.stride) {
+    return -1; // only the full quality pass of a latency budget is cut
+  }
+  int amount_y = (origin.s_ur.y - origin.s_ll.y + g - 1) / g;
+  int i = (tile->s_ll.x - origin.s_ll.x) / g;
+  int j = (tile->s_ll.y - origin.s_ll.y) / g;
+  int index = i * amount_y + j;
+  return (i >= 0 && j >= 0 && j < amount_y && index < length) ? index : -1;
+}
+
+void split_reset (const payload_t *new_origin)
+{
+  pthread_mutex_lock(&mutex);
+  split_clear();
+  int new_length = discretize_length(new_origin);
+  if (new_length > length) {
+    free(parents);
+    parents = calloc(new_length, sizeof(split_parent_t));
+    if (parents == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  origin = *new_origin;
+  length = new_length;
+  pthread_mutex_unlock(&mutex);
+}
+
+int split_tile (const payload_t *tile, payload_t *pieces)
+{
+  int h = (tile->granularity + 1) / 2;
+  if (h < SPLIT_MIN_GRANULARITY) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&mutex);
+  int index = parent_index(tile);
+  if (index < 0) {
+    pthread_mutex_unlock(&mutex);
+    return 0;
+  }
+  payload_t parent;
+  discretize_tile(&origin, index, &parent);
+  split_parent_t *entry = &parents[index];
+  if (entry->response == NULL) { // first cut of this tile
+    int g = parent.granularity;
+    entry->response = calloc(1, sizeof(response_t));
+    if (entry->response == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    entry->response->payload = parent;
+    entry->response->values = calloc(g * g, sizeof(int));
+    if (entry->response->values == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    entry->covered = calloc(g * g, sizeof(char));
+    if (entry->covered == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    entry->missing = (long long)g * g;
+  }
+
+  // Same fractal step per pixel as the tile, pieces past the border of
+  // the original tile (odd granularities) are left out. A piece of an odd
+  // piece reaches one pixel into its neighbour, split_collect counts
+  // every pixel once.
+  double real_step = (tile->ur.real - tile->ll.real) / tile->granularity;
+  double imag_step = (tile->ur.imag - tile->ll.imag) / tile->granularity;
+  int count = 0;
+  for (int dx = 0; dx < 2; dx++) {
+    for (int dy = 0; dy < 2; dy++) {
+      payload_t *piece = &pieces[count];
+      *piece = *tile;
+      piece->granularity = h;
+      piece->s_ll.x = tile->s_ll.x + dx * h;
+      piece->s_ll.y = tile->s_ll.y + dy * h;
+      if (piece->s_ll.x >= parent.s_ur.x || piece->s_ll.y >= parent.s_ur.y) {
+        continue;
+      }
+      piece->s_ur.x = piece->s_ll.x + h;
+      piece->s_ur.y = piece->s_ll.y + h;
+      piece->ll.real = tile->ll.real + real_step * dx * h;
+      piece->ll.imag = tile->ll.imag + imag_step * dy * h;
+      piece->ur.real = piece->ll.real + real_step * h;
+      piece->ur.imag = piece->ll.imag + imag_step * h;
+      count++;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return count;
+}
+
+bool split_is_piece (const response_t *response)
+{
+  pthread_mutex_lock(&mutex);
+  bool ret = response->payload.generation == origin.generation &&
+             response->payload.granularity != origin.granularity;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+response_t *split_collect (response_t *piece)
+{
+  response_t *ret = NULL;
+  if (piece->encoded_size > 0 && response_decode(piece) < 0) {
+    fprintf(stderr, "Malformed piece, dropping it.\n");
+    free_response(piece);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mutex);
+  int index = parent_index(&piece->payload);
+  if (index >= 0 && parents[index].response != NULL) {
+    split_parent_t *entry = &parents[index];
+    response_t *parent = entry->response;
+    int g = parent->payload.granularity;
+    int h = piece->payload.granularity;
+    int x0 = piece->payload.s_ll.x - parent->payload.s_ll.x;
+    int y0 = piece->payload.s_ll.y - parent->payload.s_ll.y;
+    int columns = (x0 + h > g) ? g - x0 : h;
+    int rows = (y0 + h > g) ? g - y0 : h;
+    for (int y = 0; y < rows; y++) {
+      memcpy(parent->values + (y0 + y) * g + x0, piece->values + y * h, columns * sizeof(int));
+      char *covered = entry->covered + (y0 + y) * g + x0;
+      for (int x = 0; x < columns; x++) {
+        if (!covered[x]) {
+          covered[x] = 1;
+          entry->missing--;
+        }
+      }
+    }
+    parent->worker_id = piece->worker_id;
+    parent->max_worker_id = piece->max_worker_id;
+    parent->iterations += piece->iterations;
+    parent->compute_time += piece->compute_time;
+    if (entry->missing == 0) {
+      ret = parent;
+      entry->response = NULL;
+      free(entry->covered);
+      entry->covered = NULL;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+
+  free_response(piece);
+  return ret;
+}
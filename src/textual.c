@@ -30,6 +30,8 @@ along with "Fractal @ PCAD". If not, see
 #include "timing.h"
 #include "fractal.h"
 #include "connection.h"
+#include "codec.h"
+#include "normalize.h"
 #include "queue.h"
 #include "logging.h"
 
@@ -161,9 +163,11 @@ void *net_thread_receive_response (void *arg)
       pthread_exit(NULL);
     }
 
-    size_t buffer_size = response->payload.granularity * response->payload.granularity;
-    buffer_size *= sizeof(int);
-    int *buffer = malloc(buffer_size);
+    // Values come as plain ints or, when encoded_size is set, compact
+    response->values = NULL;
+    response->encoded = NULL;
+    size_t buffer_size = response_values_size(response);
+    void *buffer = malloc(buffer_size);
 
     if (buffer == NULL) {
       fprintf(stderr, "malloc failed.\n");
@@ -179,7 +183,16 @@ void *net_thread_receive_response (void *arg)
       pthread_exit(NULL);
     }
 
-    response->values = buffer;
+    if (response->encoded_size > 0) {
+      response->encoded = buffer;
+      if (response_decode(response) < 0) {
+        fprintf(stderr, "Malformed response. Killing thread...\n");
+        free_response(response);
+        pthread_exit(NULL);
+      }
+    } else {
+      response->values = buffer;
+    }
 
     queue_enqueue(&response_queue, response);
     response = NULL; // Transferred ownership to queue
@@ -197,14 +210,17 @@ payload_t *parse_args(int argc, char *argv[])
     exit(1);
   }
 
-  payload_t *payload = malloc(sizeof(payload_t));
+  // Zeroed, so fields added later (budget, stride, ...) default to off
+  payload_t *payload = calloc(1, sizeof(payload_t));
   if (payload == NULL) {
     fprintf(stderr, "malloc failed.\n");
     exit(1);
   }
   payload->generation = 1;
-  payload->granularity = atoi(argv[3]);
+  payload->granularity = atoi(argv[3]); // PAYLOAD_GRANULARITY_AUTO (0) lets the coordinator choose
   payload->fractal_depth = atoi(argv[4]);
+  payload->palette = NORMALIZE_NONE; // raw depths, for the measurements
+  payload->schedule = PAYLOAD_SCHEDULE_DEFAULT; // COORDINATOR_OPTIONS pick the policy
   payload->s_ll.x = 0;
   payload->s_ll.y = 0;
   payload->s_ur.x = atoi(argv[5]);
@@ -250,9 +266,8 @@ int main(int argc, char* argv[])
   // Instead of using ui_thread and render_thread, we directly
   // send payload to coordinator, wait for all responses
   // then send poison pill to coordinator and shut down
-  int amount_x = (payload->s_ur.x - 1  + payload->granularity-1) / payload->granularity;
-  int amount_y = (payload->s_ur.y - 1  + payload->granularity-1) / payload->granularity;
-  int expected_responses = amount_x * amount_y;
+  int screen_width = payload->s_ur.x;
+  int screen_height = payload->s_ur.y;
 
 #if LOG_LEVEL >= LOG_BASIC
   struct timespec enqueue_time, first_response_time, end_time;
@@ -263,6 +278,11 @@ int main(int argc, char* argv[])
   payload = NULL;
 
   response_t *response = (response_t *)queue_dequeue(&response_queue);
+  // A granularity of 0 lets the coordinator choose, every response tells which
+  int granularity = response->payload.granularity;
+  int amount_x = (screen_width - 1  + granularity-1) / granularity;
+  int amount_y = (screen_height - 1  + granularity-1) / granularity;
+  int expected_responses = amount_x * amount_y;
   free_response(response);
 
 #if LOG_LEVEL >= LOG_BASIC
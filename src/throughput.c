@@ -0,0 +1,111 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <pthread.h>
+#include <mpi.h>
+#include "throughput.h"
+
+typedef struct {
+  double pixels;     // per second
+  double iterations; // per second
+  int tiles;         // responses the averages come from
+} throughput_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static throughput_t *rates = NULL; // by world rank
+static int world_size = 0;
+
+void throughput_init (void)
+{
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  rates = calloc(world_size, sizeof(throughput_t));
+  if (rates == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+}
+
+void throughput_finalize (void)
+{
+  free(rates);
+  rates = NULL;
+}
+
+void throughput_update (const response_t *response)
+{
+  int worker = response->worker_id;
+  if (worker <= 0 || worker >= world_size || response->compute_time <= 0) {
+    return;
+  }
+  int g = response->payload.granularity;
+  double pixels = g * g / response->compute_time;
+  double iterations = response->iterations / response->compute_time;
+
+  pthread_mutex_lock(&mutex);
+  throughput_t *rate = &rates[worker];
+  if (rate->tiles == 0) {
+    rate->pixels = pixels;
+    rate->iterations = iterations;
+  } else {
+    rate->pixels += THROUGHPUT_WEIGHT * (pixels - rate->pixels);
+    rate->iterations += THROUGHPUT_WEIGHT * (iterations - rate->iterations);
+  }
+  rate->tiles++;
+  pthread_mutex_unlock(&mutex);
+}
+
+int throughput_cuts (int worker)
+{
+  if (worker <= 0 || worker >= world_size) {
+    return 0;
+  }
+  // Iterations per second do not depend on how costly the tiles were
+  pthread_mutex_lock(&mutex);
+  double fastest = 0;
+  for (int i = 1; i < world_size; i++) {
+    if (rates[i].tiles > 0 && rates[i].iterations > fastest) {
+      fastest = rates[i].iterations;
+    }
+  }
+  double own = rates[worker].tiles > 0 ? rates[worker].iterations : 0;
+  pthread_mutex_unlock(&mutex);
+  if (own <= 0 || fastest <= 0) {
+    return 0;
+  }
+
+  // A cut divides the work by four, cut once from twice as slow on
+  double ratio = fastest / own;
+  double limit = 2;
+  int cuts = 0;
+  while (ratio >= limit && cuts < THROUGHPUT_MAX_CUTS) {
+    cuts++;
+    limit *= 4;
+  }
+  return cuts;
+}
+
+void throughput_log (FILE *log)
+{
+  pthread_mutex_lock(&mutex);
+  for (int i = 1; i < world_size; i++) {
+    if (rates[i].tiles > 0) {
+      fprintf(log, "[WORKER_%d_RATE]: %.1f, %.1f\n", i, rates[i].pixels, rates[i].iterations);
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,271 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "tilecache.h"
+
+typedef struct entry {
+  payload_t key; // generation and screen position ignored
+  response_t header; // values and encoded unset
+  void *buffer; // encoded values, or plain ints if header.encoded_size is 0
+  size_t size;
+  struct entry *next; // in its bucket
+  struct entry *newer; // least recently used list
+  struct entry *older;
+} entry_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static entry_t **buckets = NULL;
+static entry_t *newest = NULL;
+static entry_t *oldest = NULL;
+static tilecache_stats_t stats;
+
+void tilecache_init (size_t limit)
+{
+  buckets = calloc(TILECACHE_BUCKETS, sizeof(entry_t*));
+  if (buckets == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  memset(&stats, 0, sizeof(stats));
+  stats.limit = limit;
+}
+
+void tilecache_finalize (void)
+{
+  for (entry_t *e = newest; e != NULL; ) {
+    entry_t *older = e->older;
+    free(e->buffer);
+    free(e);
+    e = older;
+  }
+  free(buckets);
+  buckets = NULL;
+  newest = oldest = NULL;
+}
+
+static int stride_of (const payload_t *tile)
+{
+  return tile->stride > 1 ? tile->stride : 1;
+}
+
+static uint64_t mix (uint64_t hash, uint64_t value)
+{
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+static uint64_t bits (long double value)
+{
+  // rounded to a double, keys that differ further only share a bucket
+  double d = (double)value;
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+uint64_t tilecache_key_hash (const payload_t *tile)
+{
+  uint64_t hash = 0;
+  hash = mix(hash, bits(tile->ll.real));
+  hash = mix(hash, bits(tile->ll.imag));
+  hash = mix(hash, bits(tile->ur.real));
+  hash = mix(hash, bits(tile->ur.imag));
+  hash = mix(hash, (uint64_t)tile->granularity);
+  hash = mix(hash, (uint64_t)tile->fractal_depth);
+  hash = mix(hash, (uint64_t)tile->palette);
+  hash = mix(hash, (uint64_t)stride_of(tile));
+  return hash;
+}
+
+static size_t bucket_of (const payload_t *tile)
+{
+  return tilecache_key_hash(tile) & (TILECACHE_BUCKETS - 1);
+}
+
+bool tilecache_key_equal (const payload_t *a, const payload_t *b)
+{
+  return a->ll.real == b->ll.real && a->ll.imag == b->ll.imag &&
+    a->ur.real == b->ur.real && a->ur.imag == b->ur.imag &&
+    a->granularity == b->granularity && a->fractal_depth == b->fractal_depth &&
+    a->palette == b->palette && stride_of(a) == stride_of(b);
+}
+
+/* entry of tile in its bucket, or NULL. Mutex held. */
+static entry_t *find (const payload_t *tile, size_t bucket)
+{
+  for (entry_t *e = buckets[bucket]; e != NULL; e = e->next) {
+    if (tilecache_key_equal(&e->key, tile)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void unlink_lru (entry_t *e)
+{
+  if (e->newer) e->newer->older = e->older; else newest = e->older;
+  if (e->older) e->older->newer = e->newer; else oldest = e->newer;
+  e->newer = e->older = NULL;
+}
+
+static void push_lru (entry_t *e)
+{
+  e->older = newest;
+  e->newer = NULL;
+  if (newest) newest->newer = e;
+  newest = e;
+  if (oldest == NULL) oldest = e;
+}
+
+/* drop e from the cache. Mutex held. */
+static void drop (entry_t *e)
+{
+  entry_t **link = &buckets[bucket_of(&e->key)];
+  while (*link != e) link = &(*link)->next;
+  *link = e->next;
+  unlink_lru(e);
+  stats.bytes -= e->size + sizeof(entry_t);
+  stats.tiles--;
+  free(e->buffer);
+  free(e);
+}
+
+static void evict_oldest (void)
+{
+  stats.evictions++;
+  drop(oldest);
+}
+
+void tilecache_remove (const payload_t *tile)
+{
+  pthread_mutex_lock(&mutex);
+  entry_t *e = find(tile, bucket_of(tile));
+  if (e != NULL) {
+    drop(e);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void tilecache_clear (void)
+{
+  pthread_mutex_lock(&mutex);
+  while (oldest != NULL) {
+    drop(oldest);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+response_t *tilecache_lookup (const payload_t *tile)
+{
+  pthread_mutex_lock(&mutex);
+  entry_t *e = find(tile, bucket_of(tile));
+  if (e == NULL) {
+    stats.misses++;
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+  }
+  stats.hits++;
+  unlink_lru(e);
+  push_lru(e);
+
+  response_t *response = malloc(sizeof(response_t));
+  void *buffer = malloc(e->size);
+  if (response == NULL || buffer == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  memcpy(buffer, e->buffer, e->size);
+  *response = e->header;
+  pthread_mutex_unlock(&mutex);
+
+  response->payload = *tile;
+  response->values = NULL;
+  response->encoded = NULL;
+  if (response->encoded_size > 0) {
+    response->encoded = buffer;
+  } else {
+    response->values = buffer;
+  }
+  return response;
+}
+
+void tilecache_store (const response_t *response)
+{
+  const payload_t *tile = &response->payload;
+  size_t size;
+  const void *values;
+  if (response->encoded_size > 0) {
+    size = response->encoded_size;
+    values = response->encoded;
+  } else {
+    size = (size_t)tile->granularity * tile->granularity * sizeof(int);
+    values = response->values;
+  }
+  if (values == NULL || size + sizeof(entry_t) > stats.limit) {
+    return;
+  }
+
+  pthread_mutex_lock(&mutex);
+  size_t bucket = bucket_of(tile);
+  entry_t *e = find(tile, bucket);
+  if (e != NULL) { // computed again meanwhile, the values are the same
+    unlink_lru(e);
+    push_lru(e);
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+  while (stats.bytes + size + sizeof(entry_t) > stats.limit) {
+    evict_oldest();
+  }
+
+  e = calloc(1, sizeof(entry_t));
+  void *buffer = malloc(size);
+  if (e == NULL || buffer == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  memcpy(buffer, values, size);
+  e->key = *tile;
+  e->header = *response;
+  e->header.values = NULL;
+  e->header.encoded = NULL;
+  if (response->encoded_size <= 0) {
+    e->header.encoded_size = 0; // plain ints, wherever the worker put them
+  }
+  e->buffer = buffer;
+  e->size = size;
+  e->next = buckets[bucket];
+  buckets[bucket] = e;
+  push_lru(e);
+  stats.bytes += size + sizeof(entry_t);
+  stats.tiles++;
+  pthread_mutex_unlock(&mutex);
+}
+
+tilecache_stats_t tilecache_stats (void)
+{
+  pthread_mutex_lock(&mutex);
+  tilecache_stats_t ret = stats;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
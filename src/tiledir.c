@@ -0,0 +1,257 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "queue.h"
+#include "tilecache.h"
+#include "tiledir.h"
+
+typedef struct entry {
+  payload_t key;
+  int holder;
+  size_t size; // of the values the holder keeps
+  struct entry *next; // in its bucket
+  struct entry *newer; // least recently used list of its holder
+  struct entry *older;
+} entry_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static entry_t **buckets = NULL;
+static int world_size = 0;
+static size_t limit = 0;
+// per rank, only those of the workers are used
+static entry_t **newest = NULL;
+static entry_t **oldest = NULL;
+static size_t *bytes = NULL;
+static queue_t *notices = NULL;
+static tiledir_stats_t stats;
+
+void tiledir_init (int size, size_t worker_limit)
+{
+  world_size = size;
+  limit = worker_limit;
+  buckets = calloc(TILEDIR_BUCKETS, sizeof(entry_t*));
+  newest = calloc(world_size, sizeof(entry_t*));
+  oldest = calloc(world_size, sizeof(entry_t*));
+  bytes = calloc(world_size, sizeof(size_t));
+  notices = calloc(world_size, sizeof(queue_t));
+  if (buckets == NULL || newest == NULL || oldest == NULL || bytes == NULL || notices == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  for (int i = 0; i < world_size; i++) {
+    queue_init(&notices[i], 64, free);
+  }
+  memset(&stats, 0, sizeof(stats));
+}
+
+void tiledir_finalize (void)
+{
+  for (int i = 0; i < world_size; i++) {
+    for (entry_t *e = newest[i]; e != NULL; ) {
+      entry_t *older = e->older;
+      free(e);
+      e = older;
+    }
+    queue_destroy(&notices[i]);
+  }
+  free(buckets);
+  free(newest);
+  free(oldest);
+  free(bytes);
+  free(notices);
+  buckets = NULL;
+  newest = oldest = NULL;
+  bytes = NULL;
+  notices = NULL;
+}
+
+static size_t bucket_of (const payload_t *tile)
+{
+  return tilecache_key_hash(tile) & (TILEDIR_BUCKETS - 1);
+}
+
+/* entry of tile, or NULL. Mutex held. */
+static entry_t *find (const payload_t *tile)
+{
+  for (entry_t *e = buckets[bucket_of(tile)]; e != NULL; e = e->next) {
+    if (tilecache_key_equal(&e->key, tile)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void unlink_lru (entry_t *e)
+{
+  int h = e->holder;
+  if (e->newer) e->newer->older = e->older; else newest[h] = e->older;
+  if (e->older) e->older->newer = e->newer; else oldest[h] = e->newer;
+  e->newer = e->older = NULL;
+  bytes[h] -= e->size;
+  stats.bytes -= e->size;
+}
+
+static void push_lru (entry_t *e)
+{
+  int h = e->holder;
+  e->older = newest[h];
+  e->newer = NULL;
+  if (newest[h]) newest[h]->newer = e;
+  newest[h] = e;
+  if (oldest[h] == NULL) oldest[h] = e;
+  bytes[h] += e->size;
+  stats.bytes += e->size;
+}
+
+/* the holder of e has to drop its tile. Mutex held. */
+static void notify (const entry_t *e)
+{
+  payload_t *notice = malloc(sizeof(payload_t));
+  if (notice == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  *notice = e->key;
+  notice->generation = PAYLOAD_GENERATION_EVICT;
+  queue_enqueue(&notices[e->holder], notice);
+  stats.evictions++;
+}
+
+/* forget every tile of worker, which drops its whole cache instead of
+   the notices piled up for it. Mutex held. */
+static void flush (int worker)
+{
+  while (oldest[worker] != NULL) {
+    entry_t *old = oldest[worker];
+    entry_t **link = &buckets[bucket_of(&old->key)];
+    while (*link != old) link = &(*link)->next;
+    *link = old->next;
+    unlink_lru(old);
+    stats.tiles--;
+    free(old);
+  }
+  queue_clear(&notices[worker]);
+  payload_t *notice = calloc(1, sizeof(payload_t));
+  if (notice == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  notice->generation = PAYLOAD_GENERATION_FLUSH;
+  queue_enqueue(&notices[worker], notice);
+}
+
+int tiledir_holder (const payload_t *tile)
+{
+  pthread_mutex_lock(&mutex);
+  entry_t *e = find(tile);
+  int holder = e != NULL ? e->holder : -1;
+  pthread_mutex_unlock(&mutex);
+  return holder;
+}
+
+void tiledir_routed (const payload_t *tile)
+{
+  pthread_mutex_lock(&mutex);
+  entry_t *e = find(tile);
+  if (e != NULL) {
+    unlink_lru(e);
+    push_lru(e);
+    stats.routed++;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void tiledir_received (const response_t *response)
+{
+  const payload_t *tile = &response->payload;
+  int worker = response->worker_id;
+  if (worker <= 0 || worker >= world_size) {
+    return; // computed by rank 0
+  }
+  // as the worker keeps it, see worker_compute
+  size_t size = response->encoded_size > 0 ? (size_t)response->encoded_size :
+    (size_t)tile->granularity * tile->granularity * sizeof(int);
+
+  pthread_mutex_lock(&mutex);
+  entry_t *e = find(tile);
+  if (e != NULL) {
+    unlink_lru(e);
+    if (e->holder != worker) { // computed again elsewhere, one copy is enough
+      int previous = e->holder;
+      notify(e);
+      e->holder = worker;
+      if (queue_size(&notices[previous]) > TILEDIR_MAX_NOTICES) {
+        flush(previous);
+      }
+    }
+  } else {
+    e = calloc(1, sizeof(entry_t));
+    if (e == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    e->key = *tile;
+    e->holder = worker;
+    size_t bucket = bucket_of(tile);
+    e->next = buckets[bucket];
+    buckets[bucket] = e;
+    stats.tiles++;
+  }
+  e->size = size;
+  push_lru(e);
+
+  while (bytes[worker] > limit) {
+    entry_t *old = oldest[worker];
+    entry_t **link = &buckets[bucket_of(&old->key)];
+    while (*link != old) link = &(*link)->next;
+    *link = old->next;
+    unlink_lru(old);
+    notify(old);
+    stats.tiles--;
+    free(old);
+  }
+  if (queue_size(&notices[worker]) > TILEDIR_MAX_NOTICES) {
+    flush(worker);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+int tiledir_evictions (int worker, payload_t *out, int max)
+{
+  int count = 0;
+  while (count < max) {
+    payload_t *notice = (payload_t *)queue_try_dequeue(&notices[worker]);
+    if (notice == NULL) {
+      break;
+    }
+    out[count++] = *notice;
+    free(notice);
+  }
+  return count;
+}
+
+tiledir_stats_t tiledir_stats (void)
+{
+  pthread_mutex_lock(&mutex);
+  tiledir_stats_t ret = stats;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
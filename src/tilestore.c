@@ -0,0 +1,357 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tilestore.h"
+#include "tilecache.h"
+#include "codec.h"
+
+/* the first bytes of the index file */
+typedef struct {
+  char magic[8];
+  uint32_t entry_size; // files of another build are refused
+  uint32_t value_size;
+} tilestore_header_t;
+
+/* one tile, as written in the index file */
+typedef struct {
+  uint64_t address;
+  int32_t level;
+  int32_t kernel;
+  int32_t depth;
+  int32_t granularity;
+  int32_t palette;
+  int32_t stride;
+  fractal_coord_t ll;
+  fractal_coord_t ur;
+  uint64_t offset; // of its values in the data file
+} tilestore_entry_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int index_fd = -1;
+static int data_fd = -1;
+static unsigned char *data = NULL;
+static size_t capacity = 0;
+static size_t used = 0;
+static tilestore_entry_t *entries = NULL;
+static int *chains = NULL; // next entry of the same bucket, or -1
+static int *buckets = NULL;
+static int allocated = 0;
+static tilestore_stats_t stats;
+
+static int stride_of (const payload_t *tile)
+{
+  return tile->stride > 1 ? tile->stride : 1;
+}
+
+static size_t values_size (int granularity)
+{
+  return (size_t)granularity * granularity * sizeof(int);
+}
+
+static size_t aligned (size_t offset)
+{
+  return (offset + TILESTORE_ALIGN - 1) / TILESTORE_ALIGN * TILESTORE_ALIGN;
+}
+
+uint64_t tilestore_address (const payload_t *tile, int *level)
+{
+  long double width = tile->ur.real - tile->ll.real;
+  int l = width > 0 ? (int)lroundl(log2l(TILESTORE_ROOT_SIZE / width)) : TILESTORE_MAX_LEVEL;
+  if (l < 0) l = 0;
+  if (l > TILESTORE_MAX_LEVEL) l = TILESTORE_MAX_LEVEL;
+  *level = l;
+
+  // Cell of the center at that level, clamped to the root
+  long double cells = ldexpl(1.0L, l);
+  long double cell = TILESTORE_ROOT_SIZE / cells;
+  long double x = floorl(((tile->ll.real + tile->ur.real) / 2 - TILESTORE_ROOT_LL) / cell);
+  long double y = floorl(((tile->ll.imag + tile->ur.imag) / 2 - TILESTORE_ROOT_LL) / cell);
+  if (x < 0) x = 0;
+  if (y < 0) y = 0;
+  if (x > cells - 1) x = cells - 1;
+  if (y > cells - 1) y = cells - 1;
+
+  // Quadrant after quadrant from the root, real bit then imaginary bit
+  uint64_t cx = (uint64_t)x, cy = (uint64_t)y, address = 0;
+  for (int i = l - 1; i >= 0; i--) {
+    address = (address << 2) | (((cx >> i) & 1) << 1) | ((cy >> i) & 1);
+  }
+  return address;
+}
+
+/* the entry tile would get, without its offset */
+static tilestore_entry_t entry_of (const payload_t *tile)
+{
+  tilestore_entry_t e;
+  memset(&e, 0, sizeof(e));
+  e.address = tilestore_address(tile, &e.level);
+  e.kernel = TILESTORE_KERNEL_MANDELBROT;
+  e.depth = tile->fractal_depth;
+  e.granularity = tile->granularity;
+  e.palette = tile->palette;
+  e.stride = stride_of(tile);
+  e.ll = tile->ll;
+  e.ur = tile->ur;
+  return e;
+}
+
+static bool entry_equal (const tilestore_entry_t *a, const tilestore_entry_t *b)
+{
+  return a->address == b->address && a->level == b->level && a->kernel == b->kernel &&
+    a->depth == b->depth && a->granularity == b->granularity &&
+    a->palette == b->palette && a->stride == b->stride &&
+    a->ll.real == b->ll.real && a->ll.imag == b->ll.imag &&
+    a->ur.real == b->ur.real && a->ur.imag == b->ur.imag;
+}
+
+static size_t bucket_of (const tilestore_entry_t *e)
+{
+  payload_t key;
+  memset(&key, 0, sizeof(key));
+  key.ll = e->ll;
+  key.ur = e->ur;
+  key.granularity = e->granularity;
+  key.fractal_depth = e->depth;
+  key.palette = e->palette;
+  key.stride = e->stride;
+  return (tilecache_key_hash(&key) ^ e->address) & (TILESTORE_BUCKETS - 1);
+}
+
+/* index of the entry equal to e, or -1. Mutex held. */
+static int find (const tilestore_entry_t *e)
+{
+  for (int i = buckets[bucket_of(e)]; i >= 0; i = chains[i]) {
+    if (entry_equal(&entries[i], e)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* keep e in memory. Mutex held. */
+static void insert (const tilestore_entry_t *e)
+{
+  if (stats.tiles == allocated) {
+    allocated = allocated > 0 ? allocated * 2 : 1024;
+    entries = realloc(entries, allocated * sizeof(tilestore_entry_t));
+    chains = realloc(chains, allocated * sizeof(int));
+    if (entries == NULL || chains == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+  }
+  size_t bucket = bucket_of(e);
+  entries[stats.tiles] = *e;
+  chains[stats.tiles] = buckets[bucket];
+  buckets[bucket] = stats.tiles;
+  stats.tiles++;
+  size_t end = aligned(e->offset + values_size(e->granularity));
+  if (end > used) used = end;
+}
+
+/* read the entries of the index file back, dropping a torn last one */
+static int load_index (const char *filename)
+{
+  struct stat st;
+  if (fstat(index_fd, &st) < 0) {
+    return -1;
+  }
+  tilestore_header_t header;
+  if (st.st_size == 0) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TILESTORE_MAGIC, sizeof(header.magic));
+    header.entry_size = sizeof(tilestore_entry_t);
+    header.value_size = sizeof(int);
+    return write(index_fd, &header, sizeof(header)) == sizeof(header) ? 0 : -1;
+  }
+
+  if (pread(index_fd, &header, sizeof(header), 0) != sizeof(header) ||
+      memcmp(header.magic, TILESTORE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.entry_size != sizeof(tilestore_entry_t) || header.value_size != sizeof(int)) {
+    fprintf(stderr, "%s is not a tile store of this build.\n", filename);
+    return -1;
+  }
+  long long count = (st.st_size - (long long)sizeof(header)) / sizeof(tilestore_entry_t);
+  off_t offset = sizeof(header);
+  for (long long i = 0; i < count; i++) {
+    tilestore_entry_t e;
+    if (pread(index_fd, &e, sizeof(e), offset) != sizeof(e)) {
+      return -1;
+    }
+    offset += sizeof(e);
+    if (e.granularity > 0 && e.offset + values_size(e.granularity) <= capacity && find(&e) < 0) {
+      insert(&e);
+    }
+  }
+  return ftruncate(index_fd, offset); // appends go after the last whole entry
+}
+
+int tilestore_open (const char *path, size_t reserved)
+{
+  char index_name[4096], data_name[4096];
+  snprintf(index_name, sizeof(index_name), "%s.index", path);
+  snprintf(data_name, sizeof(data_name), "%s.data", path);
+
+  pthread_mutex_lock(&mutex);
+  memset(&stats, 0, sizeof(stats));
+  buckets = malloc(TILESTORE_BUCKETS * sizeof(int));
+  if (buckets == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  for (int i = 0; i < TILESTORE_BUCKETS; i++) {
+    buckets[i] = -1;
+  }
+
+  // The whole capacity is mapped at once, lent values never move
+  struct stat st;
+  data_fd = open(data_name, O_RDWR | O_CREAT, 0644);
+  if (data_fd < 0 || fstat(data_fd, &st) < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", data_name, strerror(errno));
+    pthread_mutex_unlock(&mutex);
+    return -1;
+  }
+  capacity = (size_t)st.st_size > reserved ? (size_t)st.st_size : reserved;
+  if ((size_t)st.st_size < capacity && ftruncate(data_fd, capacity) < 0) {
+    fprintf(stderr, "Failed to reserve %s: %s\n", data_name, strerror(errno));
+    pthread_mutex_unlock(&mutex);
+    return -1;
+  }
+  data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, data_fd, 0);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Failed to map %s: %s\n", data_name, strerror(errno));
+    data = NULL;
+    pthread_mutex_unlock(&mutex);
+    return -1;
+  }
+
+  index_fd = open(index_name, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (index_fd < 0 || load_index(index_name) < 0) {
+    fprintf(stderr, "Failed to read %s\n", index_name);
+    pthread_mutex_unlock(&mutex);
+    return -1;
+  }
+  stats.capacity = capacity;
+  pthread_mutex_unlock(&mutex);
+  return 0;
+}
+
+void tilestore_close (void)
+{
+  pthread_mutex_lock(&mutex);
+  if (data != NULL) {
+    msync(data, used, MS_SYNC);
+    munmap(data, capacity);
+  }
+  if (data_fd >= 0) close(data_fd);
+  if (index_fd >= 0) close(index_fd);
+  free(entries);
+  free(chains);
+  free(buckets);
+  data = NULL;
+  data_fd = index_fd = -1;
+  entries = NULL;
+  chains = buckets = NULL;
+  allocated = 0;
+  used = capacity = 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+response_t *tilestore_lookup (const payload_t *tile)
+{
+  tilestore_entry_t key = entry_of(tile);
+  pthread_mutex_lock(&mutex);
+  int i = data != NULL ? find(&key) : -1;
+  if (i < 0) {
+    stats.misses++;
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+  }
+  stats.hits++;
+  int *values = (int *)(data + entries[i].offset);
+  pthread_mutex_unlock(&mutex);
+
+  response_t *response = calloc(1, sizeof(response_t));
+  if (response == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+  response->payload = *tile;
+  response->encoded_size = RESPONSE_IN_FRAMEBUFFER; // lent, see fractal.h
+  response->values = values;
+  return response;
+}
+
+void tilestore_store (const response_t *response)
+{
+  const payload_t *tile = &response->payload;
+  int g = tile->granularity;
+  size_t size = values_size(g);
+  const int *values = response->values;
+  int *decoded = NULL;
+  if (response->encoded_size > 0) { // kept as plain ints, to be lent as such
+    decoded = malloc(size);
+    if (decoded == NULL) {
+      fprintf(stderr, "malloc failed.\n");
+      exit(1);
+    }
+    if (codec_decode(response->encoded, response->encoded_size, decoded, g, g) < 0) {
+      free(decoded);
+      return;
+    }
+    values = decoded;
+  }
+
+  tilestore_entry_t e = entry_of(tile);
+  pthread_mutex_lock(&mutex);
+  if (data != NULL && values != NULL && g > 0 && find(&e) < 0) {
+    if (used + size > capacity) {
+      stats.refused++;
+    } else {
+      // The values first, an entry only ever points to complete ones
+      e.offset = used;
+      memcpy(data + e.offset, values, size);
+      if (write(index_fd, &e, sizeof(e)) == sizeof(e)) {
+        insert(&e);
+      } else {
+        stats.refused++;
+      }
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  free(decoded);
+}
+
+tilestore_stats_t tilestore_stats (void)
+{
+  pthread_mutex_lock(&mutex);
+  tilestore_stats_t ret = stats;
+  ret.bytes = used;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
@@ -0,0 +1,713 @@
+/*
+This file is part of "Fractal @ PCAD".
+
+"Fractal @ PCAD" is free software: you can redistribute it and/or
+modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+"Fractal @ PCAD" is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with "Fractal @ PCAD". If not, see
+<https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#include "fractal.h"
+#include "mpi_comm.h"
+#include "dispatch_rma.h"
+#include "hierarchy.h"
+#include "dispatch_steal.h"
+#include "cancel.h"
+#include "codec.h"
+#include "normalize.h"
+#include "framebuffer.h"
+#include "schedule.h"
+#include "tilecache.h"
+#include "timing.h"
+#include "logging.h"
+#include "worker.h"
+
+/* state shared by the dispatch-specific worker loops */
+typedef struct {
+  int rank;
+  int size;
+  // Where tiles come from and responses go: rank 0 of MPI_COMM_WORLD,
+  // or our leader (rank 0 of the group) in the hierarchical dispatch
+  MPI_Comm comm;
+  int upstream;
+  bool batched; // leaders talk to rank 0 in batches of responses
+  encoding_mode_t encoding;
+  bool shared; // several clients, a newer generation leaves the others current
+  bool cache;  // keep the computed tiles, rank 0 decides when to drop them (tiledir.h)
+  // Tiles of our cache that rank 0 sends outside of our requests
+  payload_t fetched[SCHEDULE_MAX_CHUNK];
+  MPI_Request fetch_request;
+  // The last response stays in flight while we compute the next tile
+  response_t *in_flight;
+  MPI_Request response_requests[2];
+#if LOG_LEVEL >= LOG_BASIC
+  FILE *log;
+  long long total_iterations;
+  long long total_pixels;
+  struct timespec total_compute_time;
+  int cancelled_tiles; // abandoned because their generation became obsolete
+  struct timespec cancelled_time;
+  int cached_tiles; // answered from our tile cache
+#endif
+} worker_t;
+
+static void worker_init(worker_t *worker, const options_t *options)
+{
+  MPI_Comm_rank(MPI_COMM_WORLD, &worker->rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &worker->size);
+  worker->comm = MPI_COMM_WORLD;
+  worker->upstream = 0;
+  worker->batched = false;
+  worker->encoding = options->encoding;
+  worker->shared = options->clients > 1;
+  worker->cache = options->worker_cache > 0;
+  if (worker->cache) {
+    tilecache_init(SIZE_MAX); // evictions come from rank 0
+  }
+  worker->in_flight = NULL;
+
+#if LOG_LEVEL >= LOG_BASIC
+  if (mkdir("worker_logs", 0777) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create worker logs directory.\n");
+    exit(1);
+  }
+  char log_filename[64];
+  snprintf(log_filename, sizeof(log_filename), "worker_logs/worker_%d.txt", worker->rank);
+  worker->log = fopen(log_filename, "w");
+  if (worker->log == NULL) {
+    fprintf(stderr, "Failed to create worker log file.\n");
+    exit(1);
+  }
+  worker->total_iterations = 0;
+  worker->total_pixels = 0;
+  worker->total_compute_time = (struct timespec) {0};
+  worker->cancelled_tiles = 0;
+  worker->cancelled_time = (struct timespec) {0};
+  worker->cached_tiles = 0;
+#endif
+}
+
+/* write the per-generation totals and start counting again */
+static void worker_log_totals(worker_t *worker)
+{
+#if LOG_LEVEL >= LOG_BASIC
+  fprintf(worker->log, "[WORKER_%d_TOTAL]: %.9f, %lld, %lld\n", 
+          worker->rank, 
+          timespec_to_double(worker->total_compute_time),
+          worker->total_pixels,
+          worker->total_iterations);
+  fprintf(worker->log, "[WORKER_%d_CANCELLED]: %.9f, %d\n",
+          worker->rank,
+          timespec_to_double(worker->cancelled_time),
+          worker->cancelled_tiles);
+  if (worker->cache) {
+    fprintf(worker->log, "[WORKER_%d_CACHED]: %d\n", worker->rank, worker->cached_tiles);
+  }
+  fflush(worker->log);
+  worker->total_iterations = 0;
+  worker->total_pixels = 0;
+  worker->total_compute_time = (struct timespec) {0};
+  worker->cancelled_tiles = 0;
+  worker->cancelled_time = (struct timespec) {0};
+  worker->cached_tiles = 0;
+#else
+  (void)worker;
+#endif
+}
+
+/* compute payload, NULL if rank 0 moved to another generation meanwhile */
+static response_t *worker_compute(worker_t *worker, payload_t *payload)
+{
+  if (worker->cache) {
+    response_t *cached = tilecache_lookup(payload);
+    if (cached != NULL) { // as sent the first time, framebuffer aside
+#if LOG_LEVEL >= LOG_BASIC
+      worker->cached_tiles++;
+#endif
+      return cached;
+    }
+  }
+
+  // Timed in every build, rank 0 estimates our throughput from it
+  struct timespec compute_start_time, compute_end_time;
+  clock_gettime(CLOCK_MONOTONIC, &compute_start_time);
+  // Raw values of co-located workers go straight to the shared framebuffer
+  int *in_place = NULL;
+  if (payload->palette == NORMALIZE_NONE && worker->encoding == ENCODING_RAW) {
+    in_place = framebuffer_write(payload);
+  }
+  create_response_return_t response_result =
+    create_response_in_place(payload, worker->shared ? NULL : cancel_is_stale, in_place);
+  if (in_place != NULL) {
+    framebuffer_written(payload);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &compute_end_time);
+
+  if (response_result.cancelled) {
+#if LOG_LEVEL >= LOG_BASIC
+    worker->cancelled_tiles++;
+    worker->cancelled_time = timespec_add(worker->cancelled_time,
+                                          timespec_diff(compute_start_time, compute_end_time));
+#endif
+    return NULL;
+  }
+
+  response_t *response = response_result.response;
+
+#if LOG_LEVEL >= LOG_BASIC
+#if LOG_LEVEL >= LOG_FULL
+  fprintf(worker->log, "[WORKER_%d_PAYLOAD]: %.9f, %d, %lld\n", 
+          worker->rank,
+          timespec_to_double(timespec_diff(compute_start_time, compute_end_time)),
+          response->payload.granularity * response->payload.granularity,
+          response_result.total_iterations);
+#endif // LOG_FULL
+
+  worker->total_compute_time = timespec_add(worker->total_compute_time, 
+                                            timespec_diff(compute_start_time, compute_end_time));
+  worker->total_iterations += response_result.total_iterations;
+  worker->total_pixels += response->payload.granularity * response->payload.granularity;
+#endif // LOG_BASIC
+
+  response->max_worker_id = worker->size;
+  response->worker_id = worker->rank;
+  response->compute_time = timespec_to_double(timespec_diff(compute_start_time, compute_end_time));
+  if (response->encoded_size == RESPONSE_IN_FRAMEBUFFER) {
+    // nothing to encode, only the header travels
+  } else if (response->payload.palette != NORMALIZE_NONE) {
+    // Display-only clients get palette indexes, at most a byte per pixel
+    response_to_palette(response);
+    response_encode(response);
+  } else if (worker->encoding == ENCODING_COMPACT) {
+    response_encode(response);
+  }
+  if (worker->cache) {
+    tilecache_store(response);
+  }
+  return response;
+}
+
+/* send response to rank 0 once the previous one has left, takes
+   ownership. A NULL (cancelled) response is not sent. */
+static void worker_send(worker_t *worker, response_t *response)
+{
+  if (response == NULL) return;
+  if (worker->in_flight != NULL) {
+    MPI_Waitall(2, worker->response_requests, MPI_STATUSES_IGNORE);
+    free_response(worker->in_flight);
+  }
+  mpi_response_isend(response, worker->upstream, worker->comm, worker->response_requests);
+  worker->in_flight = response;
+}
+
+static void worker_finalize(worker_t *worker)
+{
+  if (worker->in_flight != NULL) {
+    MPI_Waitall(2, worker->response_requests, MPI_STATUSES_IGNORE);
+    free_response(worker->in_flight);
+    worker->in_flight = NULL;
+  }
+
+  // Tell whoever collects our responses that we are gone
+  response_t shutdown_response = {0};
+  shutdown_response.payload.generation = PAYLOAD_GENERATION_SHUTDOWN;
+  if (worker->batched) {
+    response_t *batch = &shutdown_response;
+    mpi_response_batch_send(&batch, 1, worker->upstream, worker->comm);
+  } else {
+    mpi_response_send(&shutdown_response, worker->upstream, worker->comm);
+  }
+
+  if (worker->cache) {
+    tilecache_finalize();
+  }
+
+#if LOG_LEVEL >= LOG_BASIC
+  fclose(worker->log);
+#endif
+}
+
+/*
+  worker_request_payload: asks the coordinator for more tiles and posts
+  the receive that will hold them (up to SCHEDULE_MAX_CHUNK, as the
+  scheduling policy decides), without waiting for either.
+*/
+static void worker_request_payload(worker_t *worker, payload_t *slot,
+                                   MPI_Request *ask, MPI_Request *recv)
+{
+  MPI_Isend(&worker->rank, 1, MPI_INT, worker->upstream,
+            FRACTAL_MPI_PAYLOAD_REQUEST, worker->comm, ask);
+  mpi_payload_chunk_irecv(slot, SCHEDULE_MAX_CHUNK, worker->upstream, worker->comm, recv);
+}
+
+/*
+  worker_wait_fetching: waits for request while answering the tiles
+  rank 0 sends straight to us because we hold them (tiledir.h).
+*/
+static void worker_wait_fetching(worker_t *worker, MPI_Request *request, MPI_Status *status)
+{
+  MPI_Request requests[2] = {*request, worker->fetch_request};
+  while (1) {
+    int index;
+    MPI_Waitany(2, requests, &index, status);
+    if (index == 0) break;
+
+    int count = mpi_payload_count(status);
+    for (int i = 0; i < count; i++) {
+      if (worker->fetched[i].generation == PAYLOAD_GENERATION_EVICT) {
+        tilecache_remove(&worker->fetched[i]);
+        continue;
+      }
+      if (worker->fetched[i].generation == PAYLOAD_GENERATION_FLUSH) {
+        tilecache_clear();
+        continue;
+      }
+      worker_send(worker, worker_compute(worker, &worker->fetched[i]));
+    }
+    mpi_cache_fetch_irecv(worker->fetched, SCHEDULE_MAX_CHUNK, 0, MPI_COMM_WORLD, &requests[1]);
+  }
+  *request = requests[0];
+  worker->fetch_request = requests[1];
+}
+
+/*
+  worker_loop_queue: self-scheduling through rank 0 (or our leader).
+  Every chunk of tiles is requested from main_thread_mpi_send_payloads,
+  up to 1 + prefetch requests are kept outstanding.
+*/
+static void worker_loop_queue(worker_t *worker, int prefetch)
+{
+  // Ring of prefetched chunks: the chunk being computed plus prefetch
+  // chunks whose requests are already on their way to the coordinator
+  int slots = prefetch + 1;
+  payload_t *prefetched = calloc(slots * SCHEDULE_MAX_CHUNK, sizeof(payload_t));
+  MPI_Request *ask_requests = calloc(slots, sizeof(MPI_Request));
+  MPI_Request *recv_requests = calloc(slots, sizeof(MPI_Request));
+  if (prefetched == NULL || ask_requests == NULL || recv_requests == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < slots; i++) {
+    worker_request_payload(worker, &prefetched[i * SCHEDULE_MAX_CHUNK],
+                           &ask_requests[i], &recv_requests[i]);
+  }
+
+  if (worker->cache) {
+    mpi_cache_fetch_irecv(worker->fetched, SCHEDULE_MAX_CHUNK, 0, MPI_COMM_WORLD,
+                          &worker->fetch_request);
+  }
+
+  int current = 0;
+  while (1) {
+    MPI_Status status;
+    if (worker->cache) {
+      worker_wait_fetching(worker, &recv_requests[current], &status);
+    } else {
+      MPI_Wait(&recv_requests[current], &status);
+    }
+    MPI_Wait(&ask_requests[current], MPI_STATUS_IGNORE);
+    payload_t *chunk = &prefetched[current * SCHEDULE_MAX_CHUNK];
+    int count = mpi_payload_count(&status);
+
+    if (chunk[0].generation == PAYLOAD_GENERATION_SHUTDOWN) {
+      // The coordinator answers every outstanding request with a shutdown
+      for (int i = 1; i < slots; i++) {
+        int other = (current + i) % slots;
+        MPI_Wait(&recv_requests[other], MPI_STATUS_IGNORE);
+        MPI_Wait(&ask_requests[other], MPI_STATUS_IGNORE);
+      }
+      if (worker->cache) {
+        MPI_Cancel(&worker->fetch_request); // nothing is fetched after the shutdown
+        MPI_Wait(&worker->fetch_request, MPI_STATUS_IGNORE);
+      }
+      break; // Exit the loop and terminate the worker
+    }
+
+    if (chunk[0].generation == PAYLOAD_GENERATION_DONE) {
+      worker_log_totals(worker);
+      worker_request_payload(worker, chunk, &ask_requests[current], &recv_requests[current]);
+      current = (current + 1) % slots;
+      continue;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (chunk[i].generation == PAYLOAD_GENERATION_EVICT) {
+        tilecache_remove(&chunk[i]); // notices come before the tiles
+        continue;
+      }
+      if (chunk[i].generation == PAYLOAD_GENERATION_FLUSH) {
+        tilecache_clear();
+        continue;
+      }
+      response_t *response = worker_compute(worker, &chunk[i]);
+      if (i == count - 1) {
+        // Ask for a replacement chunk first, so it travels while the response does
+        worker_request_payload(worker, chunk, &ask_requests[current], &recv_requests[current]);
+        current = (current + 1) % slots;
+      }
+      worker_send(worker, response);
+    }
+  }
+
+  free(prefetched);
+  free(ask_requests);
+  free(recv_requests);
+}
+
+/*
+  worker_loop_rma: coordinator-free scheduling. Once notified of a new
+  generation, claim its tiles from the shared counter until none is
+  left, then wait for the next notice.
+*/
+static void worker_loop_rma(worker_t *worker)
+{
+  payload_t generation = {0};
+  generation.generation = -1;
+  payload_t tile;
+
+  while (rma_dispatch_wait_notice() != PAYLOAD_GENERATION_SHUTDOWN) {
+    while (rma_dispatch_claim(&generation, &tile)) {
+      worker_send(worker, worker_compute(worker, &tile));
+    }
+    worker_log_totals(worker);
+  }
+}
+
+/* tiles held by a leader, DONE flags keep their place among them */
+typedef struct {
+  payload_t *items;
+  int count;
+  int capacity;
+} tile_list_t;
+
+static void tile_list_push(tile_list_t *list, const payload_t *payload)
+{
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->items = realloc(list->items, list->capacity * sizeof(payload_t));
+    if (list->items == NULL) {
+      fprintf(stderr, "realloc failed.\n");
+      exit(1);
+    }
+  }
+  list->items[list->count++] = *payload;
+}
+
+static void tile_list_pop(tile_list_t *list)
+{
+  list->count--;
+  memmove(list->items, list->items + 1, list->count * sizeof(payload_t));
+}
+
+/* drop the tiles of obsolete generations, keeping the DONE flags */
+static void tile_list_drop_tiles(tile_list_t *list)
+{
+  int kept = 0;
+  for (int i = 0; i < list->count; i++) {
+    if (list->items[i].generation == PAYLOAD_GENERATION_DONE) {
+      list->items[kept++] = list->items[i];
+    }
+  }
+  list->count = kept;
+}
+
+#define LEADER_MAX_BATCH 64
+
+/* state of a node leader, see worker_loop_leader */
+typedef struct {
+  worker_t *worker;
+  MPI_Comm group;
+  int local_workers;
+  tile_list_t tiles;
+  int local_generation;
+  bool shutting_down;
+  int *parked; // group ranks whose tile request waits for a tile
+  int parked_count;
+  bool *done_sent; // which local workers got the DONE flag in front of tiles
+  int done_count;
+  response_t *batch[LEADER_MAX_BATCH];
+  int batch_count;
+} leader_t;
+
+/* forward the gathered responses to rank 0 as a single message */
+static void leader_flush(leader_t *leader)
+{
+  if (leader->batch_count == 0) return;
+  mpi_response_batch_send(leader->batch, leader->batch_count, 0, MPI_COMM_WORLD);
+  for (int i = 0; i < leader->batch_count; i++) {
+    free_response(leader->batch[i]);
+  }
+  leader->batch_count = 0;
+}
+
+static void leader_collect(leader_t *leader, response_t *response)
+{
+  leader->batch[leader->batch_count++] = response;
+  if (leader->batch_count == LEADER_MAX_BATCH) {
+    leader_flush(leader);
+  }
+}
+
+/* a DONE flag reached the front: log our totals and drop it */
+static void leader_pop_done(leader_t *leader)
+{
+  worker_log_totals(leader->worker);
+  tile_list_pop(&leader->tiles);
+  for (int i = 0; i < leader->local_workers + 1; i++) {
+    leader->done_sent[i] = false;
+  }
+  leader->done_count = 0;
+}
+
+/* answer parked tile requests with what we hold */
+static void leader_serve(leader_t *leader)
+{
+  payload_t shutdown_flag = {0};
+  shutdown_flag.generation = PAYLOAD_GENERATION_SHUTDOWN;
+
+  int i = 0;
+  while (i < leader->parked_count) {
+    int local = leader->parked[i];
+    if (leader->shutting_down) {
+      mpi_payload_send(&shutdown_flag, local, leader->group);
+    } else if (leader->tiles.count == 0) {
+      return; // nothing to give anybody
+    } else if (leader->tiles.items[0].generation == PAYLOAD_GENERATION_DONE) {
+      // Every local worker gets one DONE, others may still need this one
+      if (leader->done_sent[local]) {
+        i++;
+        continue;
+      }
+      mpi_payload_send(&leader->tiles.items[0], local, leader->group);
+      leader->done_sent[local] = true;
+      leader->parked[i] = leader->parked[--leader->parked_count];
+      if (++leader->done_count == leader->local_workers) {
+        leader_pop_done(leader);
+        i = 0; // requests we skipped may be served now
+      }
+      continue;
+    } else {
+      mpi_payload_send(&leader->tiles.items[0], local, leader->group);
+      tile_list_pop(&leader->tiles);
+    }
+    leader->parked[i] = leader->parked[--leader->parked_count];
+  }
+}
+
+/* a chunk of tiles (or flags) arrived from rank 0 */
+static void leader_receive_chunk(leader_t *leader, payload_t *chunk, int count)
+{
+  for (int i = 0; i < count; i++) {
+    if (chunk[i].generation == PAYLOAD_GENERATION_SHUTDOWN) {
+      leader->shutting_down = true;
+      leader->tiles.count = 0;
+      return;
+    }
+    if (chunk[i].generation != PAYLOAD_GENERATION_DONE &&
+        chunk[i].generation != leader->local_generation &&
+        !leader->worker->shared) {
+      // Rank 0 moved on to a newer generation, what we hold is obsolete
+      tile_list_drop_tiles(&leader->tiles);
+      leader->local_generation = chunk[i].generation;
+    }
+    tile_list_push(&leader->tiles, &chunk[i]);
+  }
+}
+
+/*
+  worker_loop_leader: sub-coordinator of a group. Keeps about two tiles
+  per local worker, asking rank 0 for a chunk when it runs low, serves
+  the tile requests of its workers and forwards their responses to rank
+  0 in batches. A leader alone in its group computes the tiles itself.
+*/
+static void worker_loop_leader(worker_t *worker, MPI_Comm group, int prefetch)
+{
+  enum { UPSTREAM, REQUEST, RESPONSE, PENDING };
+
+  int group_size;
+  MPI_Comm_size(group, &group_size);
+
+  leader_t leader = {0};
+  leader.worker = worker;
+  leader.group = group;
+  leader.local_workers = group_size - 1;
+  leader.local_generation = -1;
+  leader.parked = calloc(group_size * (prefetch + 1), sizeof(int));
+  leader.done_sent = calloc(group_size, sizeof(bool));
+
+  int low_watermark = leader.local_workers > 0 ? leader.local_workers : 1;
+  int chunk_max = 2 * low_watermark;
+  payload_t *chunk = calloc(chunk_max, sizeof(payload_t));
+  if (leader.parked == NULL || leader.done_sent == NULL || chunk == NULL) {
+    fprintf(stderr, "malloc failed.\n");
+    exit(1);
+  }
+
+  MPI_Request requests[PENDING] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+  MPI_Request upstream_ask = MPI_REQUEST_NULL;
+  int wanted = 0; // tiles asked to rank 0, 0 when no request is outstanding
+  int request_value;
+  response_t header;
+  if (leader.local_workers > 0) {
+    MPI_Irecv(&request_value, 1, MPI_INT, MPI_ANY_SOURCE,
+              FRACTAL_MPI_PAYLOAD_REQUEST, group, &requests[REQUEST]);
+    mpi_response_header_irecv(&header, MPI_ANY_SOURCE, group, &requests[RESPONSE]);
+  }
+
+  int exited = 0;
+  while (!leader.shutting_down || exited < leader.local_workers) {
+    if (!leader.shutting_down && wanted == 0 && leader.tiles.count <= low_watermark) {
+      wanted = chunk_max - leader.tiles.count;
+      MPI_Isend(&wanted, 1, MPI_INT, 0, FRACTAL_MPI_PAYLOAD_REQUEST, MPI_COMM_WORLD, &upstream_ask);
+      mpi_payload_chunk_irecv(chunk, wanted, 0, MPI_COMM_WORLD, &requests[UPSTREAM]);
+    }
+
+    leader_serve(&leader);
+
+    if (leader.local_workers == 0 && leader.tiles.count > 0) {
+      // Alone in the group, compute while the next chunk travels
+      if (leader.tiles.items[0].generation == PAYLOAD_GENERATION_DONE) {
+        leader_pop_done(&leader);
+      } else {
+        response_t *response = worker_compute(worker, &leader.tiles.items[0]);
+        if (response != NULL) {
+          leader_collect(&leader, response);
+        }
+        tile_list_pop(&leader.tiles);
+      }
+    }
+
+    int index, flag;
+    MPI_Status status;
+    MPI_Testany(PENDING, requests, &index, &flag, &status);
+    if (!flag) {
+      // Nothing else arrived, a good moment to forward what we gathered
+      leader_flush(&leader);
+      MPI_Waitany(PENDING, requests, &index, &status);
+    }
+
+    switch (index) {
+    case UPSTREAM:
+      MPI_Wait(&upstream_ask, MPI_STATUS_IGNORE);
+      wanted = 0;
+      leader_receive_chunk(&leader, chunk, mpi_payload_count(&status));
+      break;
+    case REQUEST:
+      leader.parked[leader.parked_count++] = status.MPI_SOURCE;
+      MPI_Irecv(&request_value, 1, MPI_INT, MPI_ANY_SOURCE,
+                FRACTAL_MPI_PAYLOAD_REQUEST, group, &requests[REQUEST]);
+      break;
+    case RESPONSE: {
+      response_t *response = malloc(sizeof(response_t));
+      *response = header;
+      mpi_response_values_receive(response, status.MPI_SOURCE, group);
+      mpi_response_header_irecv(&header, MPI_ANY_SOURCE, group, &requests[RESPONSE]);
+      if (response->payload.generation == PAYLOAD_GENERATION_SHUTDOWN) {
+        free_response(response);
+        exited++;
+      } else {
+        leader_collect(&leader, response);
+      }
+      break;
+    }
+    default: // MPI_UNDEFINED, nothing was pending
+      break;
+    }
+  }
+  leader_flush(&leader);
+
+  // Our workers are gone, withdraw the receives we kept posted for them
+  for (int i = REQUEST; i < PENDING; i++) {
+    if (requests[i] != MPI_REQUEST_NULL) {
+      MPI_Cancel(&requests[i]);
+      MPI_Wait(&requests[i], MPI_STATUS_IGNORE);
+    }
+  }
+
+  free(leader.tiles.items);
+  free(leader.parked);
+  free(leader.done_sent);
+  free(chunk);
+}
+
+/*
+  worker_loop_steal: decentralized scheduling. Compute our static block
+  of every generation, then steal from other workers until no tile is
+  left anywhere.
+*/
+static void worker_loop_steal(worker_t *worker)
+{
+  payload_t generation = {0};
+  generation.generation = -1;
+  payload_t tile;
+
+  while (steal_dispatch_wait(&generation) != PAYLOAD_GENERATION_SHUTDOWN) {
+    while (steal_dispatch_claim(&generation, &tile)) {
+      worker_send(worker, worker_compute(worker, &tile));
+    }
+    if (generation.generation == PAYLOAD_GENERATION_SHUTDOWN) {
+      break;
+    }
+    steal_stats_t stats = steal_dispatch_take_stats();
+#if LOG_LEVEL >= LOG_BASIC
+    fprintf(worker->log, "[WORKER_%d_STEALS]: %d, %d, %d\n",
+            worker->rank, stats.attempts, stats.steals, stats.tiles);
+#else
+    (void)stats;
+#endif
+    worker_log_totals(worker);
+  }
+}
+
+int main_worker(const options_t *options)
+{
+  worker_t worker;
+  worker_init(&worker, options);
+
+  MPI_Barrier(MPI_COMM_WORLD); // Sync with coordinator before starting
+
+  switch (options->dispatch) {
+  case DISPATCH_RMA:
+    worker_loop_rma(&worker);
+    break;
+  case DISPATCH_STEAL:
+    worker_loop_steal(&worker);
+    break;
+  case DISPATCH_HIERARCHICAL:
+    if (hierarchy_is_leader()) {
+      worker.batched = true;
+      worker_loop_leader(&worker, hierarchy_group_comm(), options->prefetch);
+    } else {
+      worker.comm = hierarchy_group_comm();
+      worker.upstream = 0;
+      worker_loop_queue(&worker, options->prefetch);
+    }
+    break;
+  case DISPATCH_QUEUE:
+  default:
+    worker_loop_queue(&worker, options->prefetch);
+    break;
+  }
+
+  worker_finalize(&worker);
+  return 0;
+}